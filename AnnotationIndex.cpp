@@ -0,0 +1,291 @@
+#include "AnnotationIndex.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static const char INDEX_MAGIC[8] = "PASCIDX";
+static const uint32_t INDEX_VERSION = 1;
+
+// On disk layout: header, string offsets, string data, image records sorted by image id
+// and object records grouped by image. The header is written last.
+struct IndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t nStrings;
+    uint32_t nImages;
+    uint32_t nObjects;
+    uint64_t stringOffsetsPos;
+    uint64_t stringDataPos;
+    uint64_t imagesPos;
+    uint64_t objectsPos;
+};
+
+struct ImageRecord
+{
+    uint32_t id;          // Interned image id (filename without extension)
+    uint32_t filename;    // Interned filename
+    int32_t width, height, depth;
+    uint32_t firstObject;
+    uint32_t nObjects;
+    uint32_t segmented;
+};
+
+struct ObjectRecord
+{
+    uint32_t name;        // Interned category name
+    uint32_t pose;        // Interned pose
+    int32_t xmin, ymin, xmax, ymax;
+    uint8_t truncated, difficult;
+    uint8_t padding[2];
+};
+
+// Whether size bytes starting at pos lie inside a file of the given length
+static bool sectionFits(uint64_t pos, uint64_t size, uint64_t length)
+{
+    return pos <= length && size <= length - pos;
+}
+
+// Assigns consecutive ids to distinct strings
+class StringPool
+{
+public:
+    uint32_t intern(const string &s)
+    {
+        map<string, uint32_t>::iterator it = _ids.find(s);
+        if(it != _ids.end()) return it->second;
+
+        uint32_t id = _strings.size();
+        _ids[s] = id;
+        _strings.push_back(s);
+        return id;
+    }
+
+    const vector<string> &strings() const { return _strings; }
+
+private:
+    map<string, uint32_t> _ids;
+    vector<string> _strings;
+};
+
+AnnotationIndex::AnnotationIndex(const std::string &indexFilename):
+    _fd(-1), _length(0), _data(NULL)
+{
+    _fd = open(indexFilename.c_str(), O_RDONLY);
+    if(_fd < 0)
+        throw std::runtime_error("ERROR: Could not open annotation index " + indexFilename + " for reading");
+
+    struct stat st;
+    if(fstat(_fd, &st) != 0 || st.st_size < (off_t)sizeof(IndexHeader)) {
+        close(_fd);
+        throw std::runtime_error("ERROR: Invalid annotation index " + indexFilename);
+    }
+
+    _length = st.st_size;
+    void *mapped = mmap(NULL, _length, PROT_READ, MAP_SHARED, _fd, 0);
+    if(mapped == MAP_FAILED) {
+        close(_fd);
+        throw std::runtime_error("ERROR: Could not map annotation index " + indexFilename);
+    }
+    _data = (const char *)mapped;
+
+    const IndexHeader *header = (const IndexHeader *)_data;
+    if(memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || header->version != INDEX_VERSION) {
+        munmap((void *)_data, _length);
+        close(_fd);
+        throw std::runtime_error("ERROR: " + indexFilename + " is not an annotation index");
+    }
+
+    // The string data runs up to the image records
+    if(!sectionFits(header->stringOffsetsPos, (uint64_t)header->nStrings * sizeof(uint64_t), _length) ||
+       header->stringDataPos < header->stringOffsetsPos + (uint64_t)header->nStrings * sizeof(uint64_t) ||
+       header->imagesPos < header->stringDataPos ||
+       !sectionFits(header->imagesPos, (uint64_t)header->nImages * sizeof(ImageRecord), _length) ||
+       !sectionFits(header->objectsPos, (uint64_t)header->nObjects * sizeof(ObjectRecord), _length)) {
+        munmap((void *)_data, _length);
+        close(_fd);
+        throw std::runtime_error("ERROR: " + indexFilename + " is not a complete annotation index");
+    }
+}
+
+AnnotationIndex::~AnnotationIndex()
+{
+    if(_data != NULL) munmap((void *)_data, _length);
+    if(_fd >= 0) close(_fd);
+}
+
+const char *AnnotationIndex::lookupString(uint32_t id) const
+{
+    const IndexHeader *header = (const IndexHeader *)_data;
+    const uint64_t *offsets = (const uint64_t *)(_data + header->stringOffsetsPos);
+    return _data + header->stringDataPos + offsets[id];
+}
+
+int AnnotationIndex::getSize() const
+{
+    return ((const IndexHeader *)_data)->nImages;
+}
+
+bool AnnotationIndex::find(const std::string &imageId, pascal_annotation &annotation) const
+{
+    const IndexHeader *header = (const IndexHeader *)_data;
+    const ImageRecord *images = (const ImageRecord *)(_data + header->imagesPos);
+    const ObjectRecord *objects = (const ObjectRecord *)(_data + header->objectsPos);
+
+    // Binary search over the image records, sorted by image id
+    int lo = 0, hi = (int)header->nImages - 1;
+    while(lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(lookupString(images[mid].id), imageId.c_str());
+        if(cmp < 0) {
+            lo = mid + 1;
+        } else if(cmp > 0) {
+            hi = mid - 1;
+        } else {
+            const ImageRecord &image = images[mid];
+            annotation.filename = lookupString(image.filename);
+            annotation.segmented = image.segmented != 0;
+            annotation.size.width = image.width;
+            annotation.size.height = image.height;
+            annotation.size.depth = image.depth;
+            annotation.objects.clear();
+
+            for(uint32_t i = 0; i < image.nObjects; i++) {
+                const ObjectRecord &record = objects[image.firstObject + i];
+                object_annotation object;
+                object.name = lookupString(record.name);
+                object.pose = lookupString(record.pose);
+                object.truncated = record.truncated != 0;
+                object.difficult = record.difficult != 0;
+                object.bndbox.xmin = record.xmin;
+                object.bndbox.ymin = record.ymin;
+                object.bndbox.xmax = record.xmax;
+                object.bndbox.ymax = record.ymax;
+                annotation.objects.push_back(object);
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void AnnotationIndex::build(const std::string &annotationsDir, const std::string &indexFilename)
+{
+    namespace fs = boost::filesystem;
+
+    if(!fs::is_directory(annotationsDir))
+        throw std::runtime_error("ERROR: Annotations directory doesn't exist in: " + annotationsDir);
+
+    // Sorted image ids, the lookup is a binary search
+    vector<string> files;
+    for(fs::directory_iterator it(annotationsDir), end; it != end; ++it) {
+        if(it->path().extension() == ".xml")
+            files.push_back(it->path().string());
+    }
+    sort(files.begin(), files.end());
+
+    StringPool pool;
+    vector<ImageRecord> images;
+    vector<ObjectRecord> objects;
+    vector<pair<string, int> > ids;
+
+    for(int i = 0; i < files.size(); i++) {
+        pascal_annotation annotation;
+        annotation.load(files[i]);
+
+        ImageRecord image;
+        string imageId = fs::path(files[i]).stem().string();
+        image.id = pool.intern(imageId);
+        image.filename = pool.intern(annotation.filename);
+        image.width = annotation.size.width;
+        image.height = annotation.size.height;
+        image.depth = annotation.size.depth;
+        image.segmented = annotation.segmented;
+        image.firstObject = objects.size();
+        image.nObjects = annotation.objects.size();
+
+        for(int j = 0; j < annotation.objects.size(); j++) {
+            const object_annotation &object = annotation.objects[j];
+            ObjectRecord record;
+            memset(&record, 0, sizeof(record));
+            record.name = pool.intern(object.name);
+            record.pose = pool.intern(object.pose);
+            record.xmin = object.bndbox.xmin;
+            record.ymin = object.bndbox.ymin;
+            record.xmax = object.bndbox.xmax;
+            record.ymax = object.bndbox.ymax;
+            record.truncated = object.truncated;
+            record.difficult = object.difficult;
+            objects.push_back(record);
+        }
+
+        ids.push_back(make_pair(imageId, (int)images.size()));
+        images.push_back(image);
+
+        if((i + 1) % 1000 == 0)
+            LOG(INFO) << "Indexed " << (i + 1) << " of " << files.size() << " annotations";
+    }
+
+    // Image ids come from sorted paths in one directory, make the order explicit anyway
+    sort(ids.begin(), ids.end());
+    vector<ImageRecord> sortedImages(images.size());
+    for(int i = 0; i < ids.size(); i++)
+        sortedImages[i] = images[ids[i].second];
+
+    const vector<string> &strings = pool.strings();
+    vector<uint64_t> offsets(strings.size());
+    uint64_t stringDataSize = 0;
+    for(int i = 0; i < strings.size(); i++) {
+        offsets[i] = stringDataSize;
+        stringDataSize += strings[i].size() + 1;
+    }
+
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.nStrings = strings.size();
+    header.nImages = sortedImages.size();
+    header.nObjects = objects.size();
+    header.stringOffsetsPos = sizeof(IndexHeader);
+    header.stringDataPos = header.stringOffsetsPos + offsets.size() * sizeof(uint64_t);
+    // Records start on an 8 byte boundary
+    header.imagesPos = (header.stringDataPos + stringDataSize + 7) & ~(uint64_t)7;
+    header.objectsPos = header.imagesPos + sortedImages.size() * sizeof(ImageRecord);
+
+    ofstream f(indexFilename.c_str(), ios::binary);
+    if(!f.is_open())
+        throw std::runtime_error("ERROR: Could not open file " + indexFilename + " for writing");
+
+    // Written again once the sections are complete, a partial index has no magic
+    IndexHeader placeholder;
+    memset(&placeholder, 0, sizeof(placeholder));
+    f.write((const char *)&placeholder, sizeof(placeholder));
+    if(!offsets.empty())
+        f.write((const char *)&offsets[0], offsets.size() * sizeof(uint64_t));
+    for(int i = 0; i < strings.size(); i++)
+        f.write(strings[i].c_str(), strings[i].size() + 1);
+
+    static const char zeros[8] = { 0 };
+    f.write(zeros, header.imagesPos - (header.stringDataPos + stringDataSize));
+
+    if(!sortedImages.empty())
+        f.write((const char *)&sortedImages[0], sortedImages.size() * sizeof(ImageRecord));
+    if(!objects.empty())
+        f.write((const char *)&objects[0], objects.size() * sizeof(ObjectRecord));
+    f.seekp(0);
+    f.write((const char *)&header, sizeof(header));
+    f.close();
+
+    if(!f.good())
+        throw std::runtime_error("ERROR: Could not write annotation index " + indexFilename);
+
+    LOG(INFO) << "Indexed " << sortedImages.size() << " images, " << objects.size() << " objects and "
+              << strings.size() << " distinct strings into " << indexFilename;
+}
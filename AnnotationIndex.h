@@ -0,0 +1,54 @@
+#ifndef ANNOTATION_INDEX_H
+#define ANNOTATION_INDEX_H
+
+#include "Common.h"
+#include "PascalAnnotation.h"
+
+//! Annotation Index Class
+/*!
+    This class stores the PASCAL annotations of a whole dataset in one compact binary file:
+    image sizes, object boxes, flags and interned strings. The file is built once from the
+    Annotations directory and then memory mapped, so looking up the annotation of an image
+    is a binary search instead of parsing its XML file with boost::property_tree.
+
+    Only the fields used by the databases are kept (folder, source and owner are dropped).
+*/
+class AnnotationIndex
+{
+public:
+    //! Constructor
+    /*!
+        \param indexFilename Path of an index created with AnnotationIndex::build
+    */
+    AnnotationIndex(const std::string &indexFilename);
+
+    //! Destructor
+    ~AnnotationIndex();
+
+    //! Get the annotation of an image
+    /*!
+        \param imageId Name of the image without extension, e.g. 000005
+        \param annotation Annotation filled with the indexed data
+        \return false if the image is not in the index
+    */
+    bool find(const std::string &imageId, pascal_annotation &annotation) const;
+
+    //! Number of images in the index
+    int getSize() const;
+
+    //! Convert every XML file of an Annotations directory into an index file
+    static void build(const std::string &annotationsDir, const std::string &indexFilename);
+
+private:
+    int _fd;
+    size_t _length;
+    const char *_data;
+
+    const char *lookupString(uint32_t id) const;
+
+    // Non copyable, the mapping is released by the destructor
+    AnnotationIndex(const AnnotationIndex &);
+    AnnotationIndex &operator=(const AnnotationIndex &);
+};
+
+#endif // ANNOTATION_INDEX_H
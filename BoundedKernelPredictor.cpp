@@ -0,0 +1,182 @@
+#include "BoundedKernelPredictor.h"
+
+#include <boost/thread/tss.hpp>
+
+using namespace std;
+
+// Suffix bounds of predictAbove, one buffer per detection thread shared by all the predictors
+static boost::thread_specific_ptr<vector<double> > _remainingMax;
+
+static bool sortByMagnitude(const pair<double, int> &a, const pair<double, int> &b)
+{
+    return fabs(a.first) > fabs(b.first);
+}
+
+// Range of u^degree for u in [lo, hi]
+static void powRange(double lo, double hi, int degree, double &outLo, double &outHi)
+{
+    double a = pow(lo, degree), b = pow(hi, degree);
+    if(degree % 2 == 1) {
+        outLo = a;
+        outHi = b;
+    } else {
+        outLo = (lo <= 0 && hi >= 0) ? 0 : std::min(a, b);
+        outHi = std::max(a, b);
+    }
+}
+
+bool BoundedKernelPredictor::supports(const svm_model *model)
+{
+    if(model == NULL || model->nr_class != 2) return false;
+    if(model->param.svm_type != C_SVC && model->param.svm_type != NU_SVC) return false;
+
+    int kernel = model->param.kernel_type;
+    return kernel == RBF || kernel == POLY || kernel == SIGMOID;
+}
+
+BoundedKernelPredictor::BoundedKernelPredictor(const svm_model *model, double sign):
+    _kernelType(model->param.kernel_type),
+    _degree(model->param.degree),
+    _gamma(model->param.gamma),
+    _coef0(model->param.coef0),
+    _bias(-sign * model->rho[0]),
+    _dim(0)
+{
+    if(!supports(model))
+        throw std::runtime_error("ERROR: Bounded prediction needs a two class RBF, POLY or SIGMOID model");
+
+    int l = model->l;
+
+    // Features are stored with zero based indices, see SupportVectorMachine::train
+    for(int i = 0; i < l; i++)
+        for(const svm_node *p = model->SV[i]; p->index != -1; p++)
+            _dim = std::max(_dim, p->index + 1);
+
+    vector<pair<double, int> > order(l);
+    for(int i = 0; i < l; i++)
+        order[i] = make_pair(sign * model->sv_coef[0][i], i);
+    stable_sort(order.begin(), order.end(), sortByMagnitude);
+
+    _sv.assign((size_t)l * _dim, 0.0f);
+    _coef.resize(l);
+    _svNorm.resize(l);
+    _boundSlope.resize(l);
+    _boundOffset.resize(l);
+    for(int k = 0; k < l; k++) {
+        _coef[k] = order[k].first;
+
+        float *row = &_sv[(size_t)k * _dim];
+        double norm2 = 0;
+        for(const svm_node *p = model->SV[order[k].second]; p->index != -1; p++) {
+            row[p->index] = p->value;
+            norm2 += p->value * p->value;
+        }
+        _svNorm[k] = sqrt(norm2);
+
+        // The bound only needs the upper end of the kernel range for positive coefficients and
+        // the lower end for negative ones: exp(-gamma*(|x| -+ |sv|)^2) expanded around |x|
+        _boundSlope[k] = (_coef[k] > 0 ? 2 : -2) * _gamma * _svNorm[k];
+        _boundOffset[k] = -_gamma * norm2;
+    }
+}
+
+double BoundedKernelPredictor::kernel(const float *x, double xnorm2, int i) const
+{
+    const float *sv = &_sv[(size_t)i * _dim];
+
+    if(_kernelType == RBF) {
+        double d2 = 0;
+        for(int k = 0; k < _dim; k++) {
+            double d = x[k] - sv[k];
+            d2 += d * d;
+        }
+        return exp(-_gamma * d2);
+    }
+
+    double dot = 0;
+    for(int k = 0; k < _dim; k++)
+        dot += x[k] * sv[k];
+
+    if(_kernelType == POLY)
+        return pow(_gamma * dot + _coef0, _degree);
+    return tanh(_gamma * dot + _coef0);
+}
+
+void BoundedKernelPredictor::kernelRange(double xnorm, int i, double &lo, double &hi) const
+{
+    double a = xnorm, b = _svNorm[i];
+
+    if(_kernelType == RBF) {
+        // | |x| - |sv| | <= |x - sv| <= |x| + |sv|
+        lo = exp(-_gamma * (a + b) * (a + b));
+        hi = exp(-_gamma * (a - b) * (a - b));
+        return;
+    }
+
+    // Cauchy-Schwarz: |x.sv| <= |x| |sv|
+    double spread = fabs(_gamma) * a * b;
+    double uLo = _coef0 - spread, uHi = _coef0 + spread;
+
+    if(_kernelType == POLY) {
+        powRange(uLo, uHi, _degree, lo, hi);
+    } else {
+        lo = tanh(uLo);
+        hi = tanh(uHi);
+    }
+}
+
+double BoundedKernelPredictor::predict(const float *feature) const
+{
+    double xnorm2 = 0;
+    for(int k = 0; k < _dim; k++)
+        xnorm2 += feature[k] * feature[k];
+
+    double s = _bias;
+    for(int i = 0; i < _coef.size(); i++)
+        s += _coef[i] * kernel(feature, xnorm2, i);
+    return s;
+}
+
+bool BoundedKernelPredictor::predictAbove(const float *feature, double threshold, double &decisionValue, int &kernelEvaluations) const
+{
+    int l = _coef.size();
+
+    double xnorm2 = 0;
+    for(int k = 0; k < _dim; k++)
+        xnorm2 += feature[k] * feature[k];
+    double xnorm = sqrt(xnorm2);
+
+    if(_remainingMax.get() == NULL)
+        _remainingMax.reset(new vector<double>());
+    vector<double> &remainingMax = *_remainingMax;
+    remainingMax.resize(l + 1);
+
+    // Largest value the support vectors from i onwards can still add
+    remainingMax[l] = 0;
+    if(_kernelType == RBF) {
+        double xterm = -_gamma * xnorm2;
+        for(int i = l - 1; i >= 0; i--)
+            remainingMax[i] = remainingMax[i + 1] + _coef[i] * exp(xterm + _boundSlope[i] * xnorm + _boundOffset[i]);
+    } else {
+        for(int i = l - 1; i >= 0; i--) {
+            double lo, hi;
+            kernelRange(xnorm, i, lo, hi);
+            remainingMax[i] = remainingMax[i + 1] + std::max(_coef[i] * lo, _coef[i] * hi);
+        }
+    }
+
+    // Accepted features are evaluated completely so that their decision value is exact
+    double s = _bias;
+    for(int i = 0; i < l; i++) {
+        if(s + remainingMax[i] <= threshold) {
+            decisionValue = s + remainingMax[i];
+            kernelEvaluations = i;
+            return false;
+        }
+        s += _coef[i] * kernel(feature, xnorm2, i);
+    }
+
+    decisionValue = s;
+    kernelEvaluations = l;
+    return s > threshold;
+}
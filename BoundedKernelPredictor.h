@@ -0,0 +1,65 @@
+#ifndef BOUNDED_KERNEL_PREDICTOR_H
+#define BOUNDED_KERNEL_PREDICTOR_H
+
+#include "Common.h"
+
+//! Bounded Kernel Predictor Class
+/*!
+    This class evaluates the decision function of a two class RBF, POLY or SIGMOID libsvm model
+    on dense features. Support vectors are stored contiguously and visited in decreasing order
+    of |coef|. Before every kernel evaluation the contribution of the remaining support vectors
+    is bounded using the norms of the feature and of the support vectors (for RBF the kernel lies
+    in (0,1] and the triangle inequality narrows it further), and the evaluation stops as soon as
+    the side of the threshold is certain. The classification is therefore exact while background
+    windows usually need only a fraction of the kernel evaluations.
+*/
+class BoundedKernelPredictor
+{
+public:
+    //! Constructor
+    /*!
+        \param model Two class model with a RBF, POLY or SIGMOID kernel
+        \param sign Orientation of the decision values, see SupportVectorMachine::getDetector
+    */
+    BoundedKernelPredictor(const svm_model *model, double sign);
+
+    //! True if the model can be evaluated with bounds
+    static bool supports(const svm_model *model);
+
+    //! Full decision value of a feature
+    double predict(const float *feature) const;
+
+    //! Decide if the decision value of a feature is above a threshold
+    /*!
+        \param threshold Features scoring at or below this value are rejected
+        \param decisionValue Exact decision value when the feature is accepted, upper bound of it otherwise
+        \param kernelEvaluations Number of support vectors evaluated before deciding
+        \return true if the decision value is above the threshold
+    */
+    bool predictAbove(const float *feature, double threshold, double &decisionValue, int &kernelEvaluations) const;
+
+    //! Number of dimensions of the support vectors
+    int getDimension() const { return _dim; }
+
+    //! Number of support vectors
+    int getSupportVectorCount() const { return _coef.size(); }
+
+private:
+    int _kernelType;
+    int _degree;
+    double _gamma;
+    double _coef0;
+    double _bias;                 // -rho, oriented
+
+    int _dim;
+    std::vector<float> _sv;       // Support vectors, one row of _dim values each, sorted by |coef|
+    std::vector<double> _coef;    // Oriented coefficients
+    std::vector<double> _svNorm;  // Euclidean norm of every support vector
+    std::vector<double> _boundSlope;  // RBF bound exponent of every support vector: slope in |x| and
+    std::vector<double> _boundOffset; // constant term, the |x|^2 term is shared
+
+    double kernel(const float *x, double xnorm2, int i) const;
+    void kernelRange(double xnorm, int i, double &lo, double &hi) const;
+};
+
+#endif // BOUNDED_KERNEL_PREDICTOR_H
@@ -0,0 +1,348 @@
+#include "CascadeTrainer.h"
+#include "Trace.h"
+
+#include <boost/thread.hpp>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Descriptors of the pipes in a worker process
+#define CASCADE_WORKER_IN_FD      3
+#define CASCADE_WORKER_OUT_FD     4
+
+extern char **environ;
+
+#define CASCADE_PARTITIONS_KEY    "cascade_partitions"
+#define CASCADE_WORKERS_KEY       "cascade_workers"
+#define CASCADE_PROCESSES_KEY     "cascade_processes"
+#define CASCADE_ITERATIONS_KEY    "cascade_iterations"
+#define CASCADE_SEED_KEY          "shuffle_seed"
+
+using namespace cv;
+using namespace std;
+
+// A worker process started by CascadeTrainer, it reads problems from in and answers on out
+struct CascadeWorkerProcess
+{
+    pid_t pid;
+    int in;     // Problems to the worker
+    int out;    // Support vectors from the worker
+};
+
+// Worker processes of one training, stopped and reaped when it ends or fails
+struct CascadeWorkerPool
+{
+    ~CascadeWorkerPool()
+    {
+        for(int w = 0; w < processes.size(); w++) {
+            close(processes[w].in);
+            close(processes[w].out);
+            int status;
+            while(waitpid(processes[w].pid, &status, 0) < 0 && errno == EINTR);
+        }
+    }
+
+    vector<CascadeWorkerProcess> processes;
+};
+
+struct CascadeContext
+{
+    CascadeContext(const ParametersMap &svmParams, const FeatureStore &store, vector<vector<int> > &problems):
+        svmParams(svmParams), store(store), problems(problems), nextProblem(0)
+    {
+    }
+
+    const ParametersMap &svmParams;
+    const FeatureStore &store;
+    vector<vector<int> > &problems;
+
+    boost::mutex mutex;    // Guards nextProblem and error
+    int nextProblem;
+    string error;
+};
+
+// Positions of the support vectors of a sub-SVM trained in this process
+static vector<int> trainSubProblem(const ParametersMap &svmParams, const FeatureStore &store, const vector<int> &problem)
+{
+    SupportVectorMachine sub(svmParams);
+    sub.train(store, problem);
+    return sub.getSupportVectorIndices();
+}
+
+static void writeAll(int fd, const void *data, size_t size)
+{
+    const char *p = (const char *)data;
+    while(size > 0) {
+        ssize_t n = write(fd, p, size);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) throw std::runtime_error("ERROR: A cascade worker process stopped reading");
+        p += n;
+        size -= n;
+    }
+}
+
+// False on end of file before the first byte
+static bool readAll(int fd, void *data, size_t size)
+{
+    char *p = (char *)data;
+    size_t done = 0;
+    while(done < size) {
+        ssize_t n = read(fd, p + done, size - done);
+        if(n < 0 && errno == EINTR) continue;
+        if(n == 0 && done == 0) return false;
+        if(n <= 0) throw std::runtime_error("ERROR: A cascade worker process closed its pipe");
+        done += n;
+    }
+    return true;
+}
+
+// Messages are a count followed by that many sample positions
+static void writeIndices(int fd, const vector<int> &indices)
+{
+    int n = indices.size();
+    writeAll(fd, &n, sizeof(n));
+    if(n > 0) writeAll(fd, &indices[0], n * sizeof(int));
+}
+
+static bool readIndices(int fd, vector<int> &indices)
+{
+    int n;
+    if(!readAll(fd, &n, sizeof(n))) return false;
+    if(n < 0) throw std::runtime_error("ERROR: Invalid message from a cascade worker process");
+    indices.resize(n);
+    if(n > 0 && !readAll(fd, &indices[0], n * sizeof(int)))
+        throw std::runtime_error("ERROR: A cascade worker process closed its pipe");
+    return true;
+}
+
+// Close on exec pipe whose ends are above the descriptors the worker uses
+static void workerPipe(int fds[2])
+{
+    int raw[2];
+    if(pipe(raw) != 0)
+        throw std::runtime_error("ERROR: Could not create a pipe for a cascade worker process");
+    for(int i = 0; i < 2; i++) {
+        fds[i] = fcntl(raw[i], F_DUPFD_CLOEXEC, CASCADE_WORKER_OUT_FD + 1);
+        close(raw[i]);
+    }
+    if(fds[0] < 0 || fds[1] < 0)
+        throw std::runtime_error("ERROR: Could not create a pipe for a cascade worker process");
+}
+
+// The worker is this executable started in its CASCADE_WORKER mode. Spawning execs right away,
+// unlike a fork of this multithreaded process that would run on with the locks of other threads
+static CascadeWorkerProcess spawnWorker(const string &storeFName, const ParametersMap &svmParams)
+{
+    char exe[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if(len <= 0)
+        throw std::runtime_error("ERROR: Could not locate the executable to start cascade worker processes");
+    exe[len] = '\0';
+
+    // Values are passed as key=value so that negative ones aren't taken for options
+    vector<string> args;
+    args.push_back(exe);
+    args.push_back("CASCADE_WORKER");
+    args.push_back(storeFName);
+    for(ParametersMap::const_iterator it = svmParams.begin(); it != svmParams.end(); ++it)
+        args.push_back(it->first + "=" + it->second);
+    vector<char *> argv;
+    for(int i = 0; i < args.size(); i++) argv.push_back(const_cast<char *>(args[i].c_str()));
+    argv.push_back(NULL);
+
+    int toWorker[2], fromWorker[2];
+    workerPipe(toWorker);
+    workerPipe(fromWorker);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, toWorker[0], CASCADE_WORKER_IN_FD);
+    posix_spawn_file_actions_adddup2(&actions, fromWorker[1], CASCADE_WORKER_OUT_FD);
+
+    pid_t pid;
+    int err = posix_spawn(&pid, exe, &actions, NULL, &argv[0], environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(toWorker[0]);
+    close(fromWorker[1]);
+    if(err != 0) {
+        close(toWorker[1]);
+        close(fromWorker[0]);
+        throw std::runtime_error("ERROR: Could not start a cascade worker process");
+    }
+
+    CascadeWorkerProcess process;
+    process.pid = pid;
+    process.in = toWorker[1];
+    process.out = fromWorker[0];
+    return process;
+}
+
+static void cascadeWorker(CascadeContext *context, const CascadeWorkerProcess *process)
+{
+    while(true) {
+        int p;
+        {
+            boost::lock_guard<boost::mutex> lock(context->mutex);
+            if(!context->error.empty() || context->nextProblem >= context->problems.size()) return;
+            p = context->nextProblem++;
+        }
+
+        try {
+            // Every problem is only written by the worker that took it
+            vector<int> &problem = context->problems[p];
+            if(process != NULL) {
+                writeIndices(process->in, problem);
+                if(!readIndices(process->out, problem))
+                    throw std::runtime_error("ERROR: A cascade worker process failed, see its log");
+            } else {
+                problem = trainSubProblem(context->svmParams, context->store, problem);
+            }
+        } catch(std::exception &err) {
+            boost::lock_guard<boost::mutex> lock(context->mutex);
+            context->error = err.what();
+            return;
+        }
+    }
+}
+
+CascadeTrainer::CascadeTrainer(const ParametersMap &params)
+{
+    _partitions = params.getInt(CASCADE_PARTITIONS_KEY);
+    _workers = params.getInt(CASCADE_WORKERS_KEY);
+    _processes = params.getInt(CASCADE_PROCESSES_KEY) != 0;
+    _iterations = params.getInt(CASCADE_ITERATIONS_KEY);
+    _seed = params.getInt(CASCADE_SEED_KEY);
+
+    if(_workers <= 0) _workers = std::max((int)boost::thread::hardware_concurrency(), 1);
+    if(_partitions <= 0) _partitions = _workers;
+}
+
+ParametersMap CascadeTrainer::getDefaultParameters()
+{
+    ParametersMap params;
+    params.set(CASCADE_PARTITIONS_KEY, 0);
+    params.set(CASCADE_WORKERS_KEY, 0);
+    params.set(CASCADE_PROCESSES_KEY, 0);
+    params.set(CASCADE_ITERATIONS_KEY, 5);
+    params.set(CASCADE_SEED_KEY, 0);
+    return params;
+}
+
+void CascadeTrainer::runWorker(const std::string &storeFName, const ParametersMap &svmParams, int in, int out)
+{
+    FeatureStore store(storeFName);
+    vector<int> problem;
+    while(readIndices(in, problem)) {
+        writeIndices(out, trainSubProblem(svmParams, store, problem));
+    }
+}
+
+void CascadeTrainer::trainLevel(const SupportVectorMachine &svm, const FeatureStore &store, vector<vector<int> > &problems,
+                                const CascadeWorkerPool &pool) const
+{
+    TRACE_SCOPE("cascade_level");
+
+    // Every thread feeds its own worker process when there are some
+    ParametersMap svmParams = svm.getParameters();
+    CascadeContext context(svmParams, store, problems);
+    boost::thread_group workers;
+    for(int w = 0; w < std::min(_workers, (int)problems.size()); w++)
+        workers.create_thread(boost::bind(cascadeWorker, &context, pool.processes.empty() ? NULL : &pool.processes[w]));
+    workers.join_all();
+
+    if(!context.error.empty()) {
+        throw std::runtime_error(context.error);
+    }
+}
+
+void CascadeTrainer::train(SupportVectorMachine &svm, const FeatureStore &store) const
+{
+    TRACE_SCOPE("svm_train_cascade");
+
+    vector<int> positives, negatives;
+    for(int i = 0; i < store.getSize(); i++) {
+        if(store.getLabel(i) > 0) positives.push_back(i);
+        else if(store.getLabel(i) < 0) negatives.push_back(i);
+    }
+    if(positives.empty() || negatives.empty())
+        throw std::runtime_error("ERROR: The feature store needs positive and negative samples to train a cascade");
+
+    // Every partition gets its share of both classes so that none trains a single class model
+    int nPartitions = std::min(_partitions, (int)std::min(positives.size(), negatives.size()));
+    RNG rng(_seed);
+    std::random_shuffle(positives.begin(), positives.end(), rng);
+    std::random_shuffle(negatives.begin(), negatives.end(), rng);
+
+    vector<vector<int> > partitions(nPartitions);
+    for(int k = 0; k < positives.size(); k++) partitions[k % nPartitions].push_back(positives[k]);
+    for(int k = 0; k < negatives.size(); k++) partitions[k % nPartitions].push_back(negatives[k]);
+
+    LOG(INFO) << "Cascade of " << nPartitions << " partitions trained by " << _workers
+              << (_processes ? " worker processes" : " threads");
+
+    // Worker processes are started once and kept for all the levels and passes
+    CascadeWorkerPool pool;
+    if(_processes) {
+        if(store.getFilename().empty())
+            throw std::runtime_error("ERROR: Cascade worker processes need a feature store read from a file");
+
+        // A worker that dies must fail the write, not kill the trainer
+        signal(SIGPIPE, SIG_IGN);
+        ParametersMap svmParams = svm.getParameters();
+        for(int w = 0; w < _workers; w++)
+            pool.processes.push_back(spawnWorker(store.getFilename(), svmParams));
+    }
+
+    vector<int> supportVectors;
+    bool converged = false;
+    for(int iteration = 0; iteration < _iterations && !converged; iteration++) {
+        double t = (double)getTickCount();
+
+        // First level, the support vectors of the last pass are added to every partition
+        vector<vector<int> > level(partitions);
+        for(int p = 0; p < level.size(); p++) {
+            vector<int> &problem = level[p];
+            problem.insert(problem.end(), supportVectors.begin(), supportVectors.end());
+            std::sort(problem.begin(), problem.end());
+            problem.erase(std::unique(problem.begin(), problem.end()), problem.end());
+        }
+
+        // Pairs of support vector sets are merged until the last problem, trained by svm itself
+        while(level.size() > 1) {
+            trainLevel(svm, store, level, pool);
+
+            vector<vector<int> > merged((level.size() + 1) / 2);
+            for(int p = 0; p < level.size(); p++) {
+                vector<int> &problem = merged[p / 2];
+                problem.insert(problem.end(), level[p].begin(), level[p].end());
+            }
+            for(int p = 0; p < merged.size(); p++) {
+                std::sort(merged[p].begin(), merged[p].end());
+                merged[p].erase(std::unique(merged[p].begin(), merged[p].end()), merged[p].end());
+            }
+            level.swap(merged);
+        }
+
+        svm.train(store, level[0]);
+        vector<int> previous;
+        previous.swap(supportVectors);
+        supportVectors = svm.getSupportVectorIndices();
+        std::sort(supportVectors.begin(), supportVectors.end());
+
+        t = (double)getTickCount() - t;
+        LOG(INFO) << "Cascade pass " << iteration + 1 << ": " << supportVectors.size() << " support vectors from a last problem of "
+                  << level[0].size() << " samples in " << t/getTickFrequency() << " seconds";
+
+        // The cascade has converged once the feedback doesn't change the support vectors
+        converged = supportVectors == previous;
+    }
+
+    // Otherwise the model solves the last problem only, not the whole store
+    if(!converged) {
+        LOG(WARNING) << "The cascade did not converge in " << _iterations << " passes, the model may differ from"
+                     << " training on the whole store, allow more passes (cascade_iterations)";
+    }
+}
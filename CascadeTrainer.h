@@ -0,0 +1,61 @@
+#ifndef CASCADE_TRAINER_H
+#define CASCADE_TRAINER_H
+
+#include "Common.h"
+#include "ParametersMap.h"
+#include "FeatureStore.h"
+#include "SupportVectorMachine.h"
+
+struct CascadeWorkerPool;
+
+//! Cascade Trainer Class
+/*!
+    This class trains a kernel SVM on a FeatureStore with a Cascade SVM (Graf et al. 2005). The samples
+    are split into partitions with the same ratio of positives, a sub-SVM is trained on every partition
+    in parallel and the support vectors of pairs of sub-SVMs are merged and trained again, level after
+    level, until a single problem is left. Its support vectors are fed back into every partition and the
+    cascade runs again until they don't change, at which point the last model is the solution of the
+    whole problem.
+
+    The sub-SVMs are trained by a pool of threads, or by local worker processes: the executable is
+    started once per worker in its CASCADE_WORKER mode, maps the same store and answers every problem
+    sent through a pipe with the positions of its support vectors. The last problem is always trained
+    by the given SupportVectorMachine, which then holds a regular model. A warning is logged when the
+    feedback passes run out before the support vectors settle.
+*/
+class CascadeTrainer
+{
+public:
+    //! Constructor
+    /*!
+        \param params Partitions, workers and iterations, see getDefaultParameters
+    */
+    CascadeTrainer(const ParametersMap &params = getDefaultParameters());
+
+    static ParametersMap getDefaultParameters();
+
+    //! Train svm, configured with its parameters, on every labelled sample of the store
+    void train(SupportVectorMachine &svm, const FeatureStore &store) const;
+
+    //! Body of a worker process, trains the problems read from in until it is closed
+    /*!
+        \param storeFName Feature store the problem positions refer to
+        \param svmParams Parameters of the sub-SVMs
+        \param in Descriptor the problems are read from
+        \param out Descriptor the support vector positions are written to
+    */
+    static void runWorker(const std::string &storeFName, const ParametersMap &svmParams, int in, int out);
+
+private:
+    int _partitions;        // 0 uses one per worker
+    int _workers;           // 0 uses one per core
+    bool _processes;
+    int _iterations;
+    int _seed;
+
+    //! Train every problem with a sub-SVM and replace it with the positions of its support vectors
+    void trainLevel(const SupportVectorMachine &svm, const FeatureStore &store, std::vector<std::vector<int> > &problems,
+                    const CascadeWorkerPool &pool) const;
+};
+
+#endif // CASCADE_TRAINER_H
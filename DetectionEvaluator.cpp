@@ -0,0 +1,110 @@
+#include "DetectionEvaluator.h"
+
+using namespace std;
+
+static const char *SIGNATURE = "ImageDataset";
+
+const double DetectionEvaluator::DEFAULT_SCORE_RESOLUTION = 1e-4;
+
+DetectionEvaluator::DetectionEvaluator(double scoreResolution):
+    _scoreResolution(scoreResolution),
+    _nGroundTruth(0),
+    _nDetections(0),
+    _nMatched(0)
+{
+}
+
+void DetectionEvaluator::add(const std::vector<Detection> &groundTruth, const std::vector<Detection> &found)
+{
+    vector<float> labels, responses;
+    computeLabels(groundTruth, found, labels, responses);
+
+    int nCorrect = 0;
+    for(int i = 0; i < labels.size(); i++) {
+        float score = responses[i];
+        if(_scoreResolution > 0)
+            score = floor(score / _scoreResolution) * _scoreResolution;
+
+        map<float, PrecisionRecallCounts>::iterator it = _counts.find(score);
+        if(it == _counts.end()) {
+            PrecisionRecallCounts c;
+            c.score = score;
+            c.positives = c.unlabeled = c.negatives = 0;
+            it = _counts.insert(make_pair(score, c)).first;
+        }
+
+        if(labels[i] > 0) {
+            it->second.positives++;
+            nCorrect++;
+        } else {
+            it->second.negatives++;
+        }
+    }
+
+    LOG(INFO) << nCorrect << "/" << labels.size() << " detections matched";
+
+    _nGroundTruth += groundTruth.size();
+    _nDetections += labels.size();
+    _nMatched += nCorrect;
+}
+
+void DetectionEvaluator::merge(const DetectionEvaluator &other)
+{
+    for(map<float, PrecisionRecallCounts>::const_iterator it = other._counts.begin(); it != other._counts.end(); it++) {
+        map<float, PrecisionRecallCounts>::iterator mine = _counts.find(it->first);
+        if(mine == _counts.end()) {
+            _counts.insert(*it);
+        } else {
+            mine->second.positives += it->second.positives;
+            mine->second.unlabeled += it->second.unlabeled;
+            mine->second.negatives += it->second.negatives;
+        }
+    }
+
+    _nGroundTruth += other._nGroundTruth;
+    _nDetections += other._nDetections;
+    _nMatched += other._nMatched;
+}
+
+PrecisionRecall DetectionEvaluator::getPrecisionRecall() const
+{
+    // The map is already sorted by increasing score
+    vector<PrecisionRecallCounts> counts;
+    counts.reserve(_counts.size());
+    for(map<float, PrecisionRecallCounts>::const_iterator it = _counts.begin(); it != _counts.end(); it++)
+        counts.push_back(it->second);
+
+    return PrecisionRecall(counts, _nGroundTruth);
+}
+
+DetectionWriter::DetectionWriter(const std::string &filename, int nImages):
+    _f(filename.c_str()),
+    _next(0)
+{
+    if(!_f.is_open()) {
+        throw std::runtime_error("Could not open file " + filename + " for writing");
+    }
+
+    _f << SIGNATURE << "\n";
+    _f << nImages << "\n";
+}
+
+void DetectionWriter::write(int idx, const std::string &imageFilename, const std::vector<Detection> &dets)
+{
+    ostringstream line;
+    line << imageFilename << " ";
+    line << dets.size() << " ";
+    for(int j = 0; j < dets.size(); j++) {
+        line << dets[j] << " ";
+    }
+    line << "\n";
+
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    _pending[idx] = line.str();
+
+    for(map<int, string>::iterator it = _pending.find(_next); it != _pending.end(); it = _pending.find(_next)) {
+        _f << it->second;
+        _pending.erase(it);
+        _next++;
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef DETECTION_EVALUATOR_H
+#define DETECTION_EVALUATOR_H
+
+#include "Common.h"
+#include "Detection.h"
+#include "PrecisionRecall.h"
+
+#include <boost/thread.hpp>
+
+//! Detection Evaluator Class
+/*!
+    This class matches the detections of each image against its ground truth as soon as the image
+    is processed (see computeLabels) and only keeps, per score bin, how many detections were matched
+    or not. Threads evaluate with their own instance and the instances are merged at the end.
+
+    Scores are rounded down to a multiple of the score resolution, so the number of bins is bounded
+    by the range of the scores over the resolution instead of growing with the number of detections,
+    at the cost of merging thresholds closer than the resolution. A resolution of 0 keeps every
+    distinct score, whose memory grows with the number of images.
+*/
+class DetectionEvaluator
+{
+public:
+    //! Default score resolution, far below the differences between SVM responses that change the curve
+    static const double DEFAULT_SCORE_RESOLUTION;
+
+    //! Constructor
+    /*!
+        \param scoreResolution Width of the score bins, 0 keeps every distinct score
+    */
+    DetectionEvaluator(double scoreResolution = DEFAULT_SCORE_RESOLUTION);
+
+    //! Match the detections of one image against its ground truth
+    void add(const std::vector<Detection> &groundTruth, const std::vector<Detection> &found);
+
+    //! Add the counts of another evaluator
+    void merge(const DetectionEvaluator &other);
+
+    //! Precision recall curve of every image added so far
+    PrecisionRecall getPrecisionRecall() const;
+
+    int getGroundTruthCount() const { return _nGroundTruth; }
+    int getDetectionCount() const { return _nDetections; }
+    int getMatchedCount() const { return _nMatched; }
+
+private:
+    double _scoreResolution;
+    std::map<float, PrecisionRecallCounts> _counts;
+
+    int _nGroundTruth;
+    int _nDetections;
+    int _nMatched;
+};
+
+//! Detection Writer Class
+/*!
+    This class writes the detections of a database in the format of ImageDatabase::save while they
+    are produced. Images may be written from several threads and in any order, they are buffered
+    until every previous image has been written so the file keeps the database order.
+*/
+class DetectionWriter
+{
+public:
+    //! Constructor
+    /*!
+        \param filename Output file
+        \param nImages Number of images that will be written
+    */
+    DetectionWriter(const std::string &filename, int nImages);
+
+    //! Write the detections of image idx
+    void write(int idx, const std::string &imageFilename, const std::vector<Detection> &dets);
+
+private:
+    std::ofstream _f;
+    boost::mutex _mutex;
+    std::map<int, std::string> _pending;
+    int _next;
+};
+
+#endif // DETECTION_EVALUATOR_H
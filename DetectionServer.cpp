@@ -0,0 +1,419 @@
+#include "DetectionServer.h"
+#include "Trace.h"
+
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// Requests kept for the latency percentiles
+#define SERVER_LATENCY_WINDOW   65536
+// Largest encoded image accepted in a request
+#define SERVER_MAX_IMAGE_BYTES  (64 << 20)
+
+using namespace cv;
+using namespace std;
+
+// Buffered reads of the requests of one client and serialized writes of its answers
+class ServerConnection
+{
+public:
+    ServerConnection(int inFd, int outFd, bool owned):
+        _inFd(inFd), _outFd(outFd), _owned(owned), _buffer(1 << 16), _begin(0), _end(0), _broken(false)
+    {
+    }
+
+    ~ServerConnection()
+    {
+        if(_owned) close(_inFd);
+    }
+
+    //! Read a line without its line break, false at the end of the stream
+    bool readLine(string &line)
+    {
+        line.clear();
+        while(true) {
+            char *first = &_buffer[0] + _begin, *last = &_buffer[0] + _end;
+            char *lf = std::find(first, last, '\n');
+            line.append(first, lf);
+            _begin += lf - first;
+            if(lf != last) {
+                _begin++;
+                break;
+            }
+            if(!fill()) {
+                if(line.empty()) return false;
+                break;
+            }
+        }
+
+        if(!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        return true;
+    }
+
+    //! Read exactly n bytes, false if the stream ends before
+    bool readBytes(size_t n, vector<uchar> &data)
+    {
+        data.resize(n);
+        size_t copied = 0;
+        while(copied < n) {
+            if(_begin == _end && !fill()) return false;
+            size_t chunk = std::min(n - copied, _end - _begin);
+            memcpy(&data[copied], &_buffer[_begin], chunk);
+            _begin += chunk;
+            copied += chunk;
+        }
+        return true;
+    }
+
+    //! Write a line, called by the workers concurrently
+    void send(const string &line)
+    {
+        boost::lock_guard<boost::mutex> lock(_writeMutex);
+        if(_broken) return;
+
+        string data = line + "\n";
+        size_t written = 0;
+        while(written < data.size()) {
+            ssize_t n = write(_outFd, data.data() + written, data.size() - written);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) {
+                // The client is gone, its remaining answers are dropped
+                _broken = true;
+                return;
+            }
+            written += n;
+        }
+    }
+
+private:
+    int _inFd;
+    int _outFd;
+    bool _owned;                // Close the socket with the connection
+
+    vector<char> _buffer;
+    size_t _begin;
+    size_t _end;
+
+    boost::mutex _writeMutex;
+    bool _broken;
+
+    bool fill()
+    {
+        _begin = _end = 0;
+        while(true) {
+            ssize_t n = read(_inFd, &_buffer[0], _buffer.size());
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return false;
+            _end = n;
+            return true;
+        }
+    }
+};
+
+static string jsonString(const string &s)
+{
+    ostringstream out;
+    out << '"';
+    for(int i = 0; i < s.size(); i++) {
+        unsigned char c = s[i];
+        if(c == '"' || c == '\\') out << '\\' << c;
+        else if(c == '\n') out << "\\n";
+        else if(c < 0x20) out << "\\u" << hex << setw(4) << setfill('0') << (int)c << dec << setfill(' ');
+        else out << c;
+    }
+    out << '"';
+    return out.str();
+}
+
+DetectionServer::DetectionServer(const ObjectDetector &detector, const std::vector<std::string> &categories, int nWorkers):
+    _detector(detector), _categories(categories), _capacity(std::max(nWorkers, 1) * 4), _stop(false), _shutdown(false),
+    _nextId(0), _pending(0), _requests(0), _errors(0), _firstRequest(0), _totalLatency(0), _maxLatency(0)
+{
+    if(_categories.size() != _detector.getModelCount())
+        throw std::runtime_error("ERROR: One category name is needed per model of the detector");
+
+    for(int w = 0; w < std::max(nWorkers, 1); w++)
+        _workers.create_thread(boost::bind(&DetectionServer::worker, this));
+}
+
+DetectionServer::~DetectionServer()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _queued.notify_all();
+    _taken.notify_all();
+    _workers.join_all();
+
+    for(int i = 0; i < _queue.size(); i++)
+        delete _queue[i];
+}
+
+void DetectionServer::serveStream(int inFd, int outFd)
+{
+    boost::shared_ptr<ServerConnection> connection(new ServerConnection(inFd, outFd, false));
+    readRequests(connection);
+
+    boost::unique_lock<boost::mutex> lock(_mutex);
+    while(_pending > 0)
+        _answered.wait(lock);
+}
+
+void DetectionServer::serveSocket(const std::string &socketPath)
+{
+    // Writing to a client that went away must fail instead of killing the server
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(socketPath.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("ERROR: Socket path is too long: " + socketPath);
+    strcpy(addr.sun_path, socketPath.c_str());
+
+    // A socket left by a previous server is replaced, any other file is kept
+    struct stat st;
+    if(stat(socketPath.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(socketPath.c_str());
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listenFd < 0)
+        throw std::runtime_error("ERROR: Could not create the server socket");
+    if(bind(listenFd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFd, 64) != 0) {
+        close(listenFd);
+        throw std::runtime_error("ERROR: Could not listen on socket " + socketPath);
+    }
+
+    LOG(INFO) << "Listening on " << socketPath;
+
+    boost::thread_group readers;
+    while(true) {
+        {
+            boost::lock_guard<boost::mutex> lock(_mutex);
+            if(_shutdown) break;
+        }
+
+        // Wake up regularly to notice a shutdown requested by a client
+        pollfd p;
+        p.fd = listenFd;
+        p.events = POLLIN;
+        p.revents = 0;
+        if(poll(&p, 1, 200) <= 0) continue;
+
+        int fd = accept(listenFd, NULL, NULL);
+        if(fd < 0) continue;
+
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        _clients.push_back(fd);
+        readers.create_thread(boost::bind(&DetectionServer::readClient, this, fd));
+    }
+
+    close(listenFd);
+    unlink(socketPath.c_str());
+
+    // Unblock the readers of the clients still connected, their queued requests are answered
+    {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        for(int i = 0; i < _clients.size(); i++)
+            shutdown(_clients[i], SHUT_RD);
+    }
+    readers.join_all();
+
+    boost::unique_lock<boost::mutex> lock(_mutex);
+    while(_pending > 0)
+        _answered.wait(lock);
+}
+
+void DetectionServer::readClient(int fd)
+{
+    boost::shared_ptr<ServerConnection> connection(new ServerConnection(fd, fd, true));
+    readRequests(connection);
+
+    // The socket is closed with the connection once its last answer is written
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    _clients.erase(std::remove(_clients.begin(), _clients.end(), fd), _clients.end());
+}
+
+void DetectionServer::readRequests(boost::shared_ptr<ServerConnection> connection)
+{
+    string line;
+    while(connection->readLine(line)) {
+        if(line.empty()) continue;
+
+        if(line == "STATS") {
+            connection->send(statsLine());
+            continue;
+        }
+        if(line == "SHUTDOWN") {
+            boost::lock_guard<boost::mutex> lock(_mutex);
+            _shutdown = true;
+            break;
+        }
+
+        Request *request = new Request();
+        request->connection = connection;
+        request->received = getTickCount();
+        if(line[0] == '@') {
+            char *end;
+            long bytes = strtol(line.c_str() + 1, &end, 10);
+            if(*end != '\0' || bytes <= 0 || bytes > SERVER_MAX_IMAGE_BYTES) {
+                connection->send("{\"error\":" + jsonString("ERROR: Invalid image size in request " + line) + "}");
+                delete request;
+                break;
+            }
+            if(!connection->readBytes(bytes, request->encoded)) {
+                delete request;
+                break;
+            }
+        } else {
+            request->imagePath = line;
+        }
+
+        boost::unique_lock<boost::mutex> lock(_mutex);
+        while(_queue.size() >= _capacity && !_stop)
+            _taken.wait(lock);
+        if(_stop) {
+            delete request;
+            break;
+        }
+        request->id = _nextId++;
+        _queue.push_back(request);
+        _pending++;
+        lock.unlock();
+        _queued.notify_one();
+    }
+}
+
+void DetectionServer::worker()
+{
+    while(true) {
+        Request *request;
+        {
+            boost::unique_lock<boost::mutex> lock(_mutex);
+            while(_queue.empty() && !_stop)
+                _queued.wait(lock);
+            if(_queue.empty()) return;
+
+            request = _queue.front();
+            _queue.pop_front();
+        }
+        _taken.notify_one();
+
+        answer(*request);
+        delete request;
+
+        {
+            boost::lock_guard<boost::mutex> lock(_mutex);
+            _pending--;
+        }
+        _answered.notify_all();
+    }
+}
+
+void DetectionServer::answer(const Request &request)
+{
+    TRACE_SCOPE("serve_request");
+
+    ostringstream body;
+    bool error = false;
+    try {
+        Mat img;
+        if(request.imagePath.empty())
+            img = imdecode(Mat(request.encoded), CV_LOAD_IMAGE_COLOR);
+        else
+            img = imread(request.imagePath, CV_LOAD_IMAGE_COLOR);
+        if(img.empty())
+            throw std::runtime_error("ERROR: Could not decode image " + (request.imagePath.empty() ? "of the request" : request.imagePath));
+
+        vector<vector<Detection> > found;
+        _detector.getDetections(img, found);
+
+        body << ",\"detections\":[";
+        bool first = true;
+        for(int m = 0; m < found.size(); m++) {
+            for(int i = 0; i < found[m].size(); i++) {
+                const Rect &r = found[m][i].rect;
+                body << (first ? "" : ",") << "{\"class\":" << jsonString(_categories[m])
+                     << ",\"score\":" << found[m][i].response << ",\"x\":" << r.x << ",\"y\":" << r.y
+                     << ",\"width\":" << r.width << ",\"height\":" << r.height << "}";
+                first = false;
+            }
+        }
+        body << "]";
+    } catch(std::exception &err) {
+        body.str("");
+        body << ",\"error\":" << jsonString(err.what());
+        error = true;
+    }
+
+    double ms = (getTickCount() - request.received) * 1e3 / getTickFrequency();
+
+    ostringstream line;
+    line << "{\"id\":" << request.id;
+    if(!request.imagePath.empty())
+        line << ",\"image\":" << jsonString(request.imagePath);
+    line << fixed << setprecision(3) << ",\"ms\":" << ms << body.str() << "}";
+    request.connection->send(line.str());
+
+    recordLatency(request.received, ms, error);
+}
+
+void DetectionServer::recordLatency(int64_t received, double ms, bool error)
+{
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    if(_requests == 0 || received < _firstRequest)
+        _firstRequest = received;
+
+    if(_latencies.size() < SERVER_LATENCY_WINDOW)
+        _latencies.push_back(ms);
+    else
+        _latencies[_requests % SERVER_LATENCY_WINDOW] = ms;
+
+    _requests++;
+    if(error) _errors++;
+    _totalLatency += ms;
+    _maxLatency = std::max(_maxLatency, ms);
+}
+
+DetectionServer::Stats DetectionServer::getStats() const
+{
+    vector<float> latencies;
+    Stats stats;
+    {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        latencies = _latencies;
+        stats.requests = _requests;
+        stats.errors = _errors;
+        stats.mean = _requests > 0 ? _totalLatency / _requests : 0;
+        stats.max = _maxLatency;
+        double seconds = (getTickCount() - _firstRequest) / getTickFrequency();
+        stats.throughput = _requests > 0 && seconds > 0 ? _requests / seconds : 0;
+    }
+
+    stats.p50 = stats.p99 = 0;
+    if(!latencies.empty()) {
+        int n = latencies.size();
+        std::nth_element(latencies.begin(), latencies.begin() + n / 2, latencies.end());
+        stats.p50 = latencies[n / 2];
+        std::nth_element(latencies.begin(), latencies.begin() + n * 99 / 100, latencies.end());
+        stats.p99 = latencies[n * 99 / 100];
+    }
+    return stats;
+}
+
+std::string DetectionServer::statsLine() const
+{
+    Stats stats = getStats();
+
+    ostringstream line;
+    line << fixed << setprecision(3) << "{\"requests\":" << stats.requests << ",\"errors\":" << stats.errors
+         << ",\"p50_ms\":" << stats.p50 << ",\"p99_ms\":" << stats.p99 << ",\"mean_ms\":" << stats.mean
+         << ",\"max_ms\":" << stats.max << ",\"requests_per_s\":" << stats.throughput << "}";
+    return line.str();
+}
@@ -0,0 +1,108 @@
+#ifndef DETECTION_SERVER_H
+#define DETECTION_SERVER_H
+
+#include "Common.h"
+#include "ObjectDetector.h"
+
+#include <deque>
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+
+class ServerConnection;
+
+//! Detection Server Class
+/*!
+    This class answers detection requests with a detector that is loaded once. Requests are read
+    from stdin or from the clients of a Unix domain socket, queued and run by a pool of worker
+    threads. The protocol is line based, every request gets one JSON line back:
+
+        <image path>         detect on an image file
+        @<bytes>             detect on the encoded image (JPEG, PNG...) of that size following the line
+        STATS                latency and throughput of the requests answered so far
+        SHUTDOWN             stop the socket server once the queued requests are answered
+
+    A detection answer is {"id":<n>,"image":<path>,"ms":<latency>,"detections":[{"class":<name>,
+    "score":<s>,"x":<x>,"y":<y>,"width":<w>,"height":<h>},...]} or {"id":<n>,"error":<message>}.
+    Answers of one client are written as soon as they are ready, so they may come out of order.
+
+    The latency of a request goes from the moment it is read to the moment its answer is written,
+    queueing included. Percentiles are computed over the last requests.
+*/
+class DetectionServer
+{
+public:
+    //! Constructor, starts the workers
+    /*!
+        \param detector Detector shared by the workers, one model per category
+        \param categories Name of every model of the detector
+        \param nWorkers Number of detection threads
+    */
+    DetectionServer(const ObjectDetector &detector, const std::vector<std::string> &categories, int nWorkers);
+
+    //! Destructor, answers the queued requests and stops the workers
+    ~DetectionServer();
+
+    //! Serve the requests of a stream until its end, e.g. stdin and stdout
+    void serveStream(int inFd, int outFd);
+
+    //! Serve the clients of a Unix domain socket until a SHUTDOWN request
+    void serveSocket(const std::string &socketPath);
+
+    struct Stats
+    {
+        int64_t requests;       // Answered detection requests
+        int64_t errors;
+        double p50;             // Milliseconds
+        double p99;
+        double mean;
+        double max;
+        double throughput;      // Requests per second since the first one
+    };
+
+    Stats getStats() const;
+
+private:
+    struct Request
+    {
+        boost::shared_ptr<ServerConnection> connection;
+        int64_t id;
+        std::string imagePath;
+        std::vector<unsigned char> encoded;
+        int64_t received;       // Tick count
+    };
+
+    const ObjectDetector &_detector;
+    std::vector<std::string> _categories;
+
+    // Bounded request queue, readers wait while it is full
+    mutable boost::mutex _mutex;
+    boost::condition_variable _queued;
+    boost::condition_variable _taken;
+    std::deque<Request *> _queue;
+    int _capacity;
+    bool _stop;
+    bool _shutdown;             // A client asked the socket server to stop
+    int64_t _nextId;
+    int _pending;               // Requests queued or being answered
+    boost::condition_variable _answered;
+    std::vector<int> _clients;  // Sockets of the connected clients
+
+    boost::thread_group _workers;
+
+    // Latencies of the last requests in a ring, guarded by _mutex
+    std::vector<float> _latencies;
+    int64_t _requests;
+    int64_t _errors;
+    int64_t _firstRequest;
+    double _totalLatency;
+    double _maxLatency;
+
+    void worker();
+    void readClient(int fd);
+    void readRequests(boost::shared_ptr<ServerConnection> connection);
+    void answer(const Request &request);
+    void recordLatency(int64_t received, double ms, bool error);
+    std::string statsLine() const;
+};
+
+#endif // DETECTION_SERVER_H
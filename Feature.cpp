@@ -1,4 +1,7 @@
 #include "Feature.h"
+#include "SampleStore.h"
+#include "Trace.h"
+#include "Progress.h"
 #include <boost/accumulators/accumulators.hpp>
 #include <boost/accumulators/statistics/stats.hpp>
 #include <boost/accumulators/statistics/max.hpp>
@@ -12,41 +15,107 @@ void FeatureExtractor::operator()(Mat &img, Feature &feat) const
     this->operator()(img, feat);
 }
 
-void FeatureExtractor::operator()(const PascalImageDatabase &db, FeatureCollection &feats) const
+// Largest decode reduction (1, 2, 4 or 8) that keeps every ROI at least as large as the window.
+// The crops are downscaled to the window anyway, the features only change slightly with the
+// resampling of the reduced decode
+static int decodeReduction(const PascalImageDatabase &db, int first, int end, Size winSize)
 {
+#if CV_MAJOR_VERSION >= 3
+    double ratio = 8;
+    for(int k = first; k < end; k++) {
+        ratio = std::min(ratio, (double)db.getRoi(k).width / winSize.width);
+        ratio = std::min(ratio, (double)db.getRoi(k).height / winSize.height);
+    }
+
+    int factor = 1;
+    while(factor * 2 <= ratio) factor *= 2;
+    return factor;
+#else
+    return 1;
+#endif
+}
+
+void FeatureExtractor::imageRuns(const PascalImageDatabase &db, vector<int> &firsts, vector<string> &filenames, vector<int> &reductions)
+{
+    const Size winSize(64,128);
+    int n = db.getSize();
+
+    firsts.clear();
+    filenames.clear();
+    reductions.clear();
+
+    int first = 0;
+    while(first < n) {
+        int end = first + 1;
+        while(end < n && db.getFilename(end) == db.getFilename(first)) end++;
+
+        firsts.push_back(first);
+        filenames.push_back(db.getFilename(first));
+        reductions.push_back(decodeReduction(db, first, end, winSize));
+        first = end;
+    }
+    firsts.push_back(n);
+}
+
+Mat FeatureExtractor::cropSample(const PascalImageDatabase &db, int idx, const Mat &img, int reduction)
+{
+    // The corners are scaled and rounded, truncating the origin and the size separately
+    // would shift the crop and shrink it by up to a pixel of the reduced image
+    Rect roi = db.getRoi(idx);
+    Point tl(cvRound(roi.x / (double)reduction), cvRound(roi.y / (double)reduction));
+    Point br(cvRound((roi.x + roi.width) / (double)reduction), cvRound((roi.y + roi.height) / (double)reduction));
+    roi = Rect(tl, br) & Rect(0, 0, img.cols, img.rows);
+
+    // The decoded image is shared by the samples, flip into a copy
+    Mat patch;
+    if(db.isFlipped(idx) == true)
+        flip(img(roi), patch, 1);
+    else
+        patch = img(roi);
+    return patch;
+}
+
+void FeatureExtractor::operator()(const PascalImageDatabase &db, FeatureCollection &feats, const ParametersMap &sourceParams) const
+{
+    TRACE_SCOPE("extract_features");
+
     int n = db.getSize();
 
+    // Samples of the same image are consecutive in the database, decode it once for all of them
+    vector<int> firsts, reductions;
+    vector<string> filenames;
+    imageRuns(db, firsts, filenames, reductions);
+    ImageSource images(filenames, reductions, sourceParams);
+
     feats.resize(n);
-    float percent;
-    for(int i = 0; i < n; i++) {
-        printf("\033[s");
-        // Print progress string
-        if((i+1)%1000 == 0 || (i+1) == n)
-        {
-            percent = ((i+1)*100)/n;
-            cout << percent << "% ... ";
-            fflush(stdout);
-            printf("\033[u");
+    ProgressTask progress("extract_features", n);
+    for(int r = 0; r + 1 < firsts.size(); r++) {
+        Mat img;
+        images.next(img);
+
+        // Flipped positives are extracted from their flipped crop, the HOG spatial weights are not
+        // symmetric so permuting the descriptor of the original crop would not give the same feature
+        for(int i = firsts[r]; i < firsts[r + 1]; i++) {
+            Mat patch = cropSample(db, i, img, reductions[r]);
+            (*this)(patch, feats[i]);
         }
+        progress.add(firsts[r + 1] - firsts[r]);
+    }
+}
+
+void FeatureExtractor::operator()(const SampleStore &store, FeatureCollection &feats) const
+{
+    TRACE_SCOPE("extract_features");
 
-        Mat img = imread(db.getFilename(i).c_str());
-        Rect roi = db.getRoi(i);
-        bool flipped = db.isFlipped(i);
-        Mat patch = img(roi);
-        if(flipped == true)
-            flip(patch, patch,1);
-
-        // if(db.getLabel(i)>0){
-        //     rectangle(img,roi,Scalar(255,0,0),2);
-        //     imshow("Patch", img);
-        //     cout << "************" << endl;
-        //     cout << db.getLabel(i) << " - " << flipped << endl;
-        //     waitKey(0);
-        // }
+    int n = store.getSize();
 
+    feats.resize(n);
+    ProgressTask progress("extract_features", n);
+    for(int i = 0; i < n; i++) {
+        Mat patch = store.getSample(i);
         (*this)(patch, feats[i]);
+        progress.add();
     }
-    cout << endl;
 }
 
 FeatureExtractor * FeatureExtractor::create(const std::string &featureType, const ParametersMap &params)
@@ -98,6 +167,8 @@ FeatureExtractor * FeatureExtractor::load(FILE *f)
 
 void FeatureExtractor::scale(FeatureCollection &featureCollection,  FeatureCollection &scaledFeatureCollection)
 {
+    TRACE_SCOPE("scale");
+
     vector<float> feature_max(featureCollection[0].size(),0.0);
     vector<float> feature_min(featureCollection[0].size(),0.0);
 
@@ -172,6 +243,8 @@ HOGFeatureExtractor::HOGFeatureExtractor(const ParametersMap &params)
 
 void HOGFeatureExtractor::operator()(Mat &img, Feature &feat) const
 {
+    TRACE_SCOPE("hog");
+
     //Converting the image to grayscale
     // Mat grayImg;
     // cv::cvtColor(img, grayImg, CV_RGB2GRAY);
@@ -181,7 +254,9 @@ void HOGFeatureExtractor::operator()(Mat &img, Feature &feat) const
     // Canny(img, img, 2, 2*3, 3);
     HOGDescriptor hog(Size(64,128),Size(16,16),Size(8,8),Size(8,8),9);
 
-    resize(img,img,hog.winSize);
+    // Resized into a local image, the input may be a view of an image shared with other samples
+    Mat window;
+    resize(img,window,hog.winSize);
 
     // if(isFlipped == true)
     //     flip(grayImg, grayImg,1);
@@ -198,7 +273,7 @@ void HOGFeatureExtractor::operator()(Mat &img, Feature &feat) const
 
     //vector<float> weights;
     
-    hog.compute(img, feat, Size(8,8), Size(0,0));
+    hog.compute(window, feat, Size(8,8), Size(0,0));
     //int num_features = weights.size();
 
     // //accumulator_set<float, stats<tag::mean, tag::moment<2> > > acc;
@@ -4,9 +4,12 @@
 #include "Common.h"
 #include "PascalImageDatabase.h"
 #include "ParametersMap.h"
+#include "ImageSource.h"
 
 using namespace cv;
 
+class SampleStore;
+
 typedef std::vector<float> Feature;
 typedef std::vector<Feature> FeatureCollection;
 
@@ -35,7 +38,25 @@ public:
 
     // Extracts descriptor for each image in the database, stores result in FeatureCollection,
     // this is used for training the support vector machine.
-    void operator()(const PascalImageDatabase &db, FeatureCollection &featureCollection) const;
+    void operator()(const PascalImageDatabase &db, FeatureCollection &featureCollection,
+                    const ParametersMap &sourceParams = ImageSource::getDefaultParameters()) const;
+
+    // Extracts descriptor for each window of a packed sample store, see SampleStore
+    void operator()(const SampleStore &store, FeatureCollection &featureCollection) const;
+
+    //! Split a database into runs of consecutive samples sharing one image
+    /*!
+        \param firsts First sample of every run, followed by the size of the database
+        \param filenames Image of every run
+        \param reductions Largest decode reduction of every run that keeps all its ROIs larger than the detection window
+    */
+    static void imageRuns(const PascalImageDatabase &db, std::vector<int> &firsts, std::vector<std::string> &filenames, std::vector<int> &reductions);
+
+    //! Crop a sample of a database from its image, decoded at 1/reduction of its resolution
+    /*!
+        The patch is a view of the image unless the sample is flipped, flipped samples are copies.
+    */
+    static Mat cropSample(const PascalImageDatabase &db, int idx, const Mat &img, int reduction);
 
     void scale(FeatureCollection &featureCollection,  FeatureCollection &scaledFeatureCollection);
 
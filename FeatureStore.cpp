@@ -0,0 +1,232 @@
+#include "FeatureStore.h"
+#include "Progress.h"
+#include "Trace.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace cv;
+using namespace std;
+
+static const char STORE_MAGIC[8] = "ODFEATS";
+static const uint32_t STORE_VERSION = 1;
+
+// On disk layout: header, labels, the features starting on a page boundary, one row of dim floats
+// per sample, then the minimum and maximum of every dimension. The header is written last.
+struct FeatureStoreHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t dim;
+    uint64_t nSamples;
+    char category[32];
+    uint64_t labelsPos;
+    uint64_t featuresPos;
+    uint64_t minPos;
+    uint64_t maxPos;
+};
+
+static const uint64_t FEATURES_ALIGNMENT = 4096;
+
+// Appends the features of a store in sample order and keeps the range of every dimension
+class FeatureStoreWriter
+{
+public:
+    FeatureStoreWriter(const string &filename, const string &category, const vector<float> &labels):
+        _filename(filename), _count(0)
+    {
+        memset(&_header, 0, sizeof(_header));
+        memcpy(_header.magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+        _header.version = STORE_VERSION;
+        _header.nSamples = labels.size();
+        strncpy(_header.category, category.c_str(), sizeof(_header.category) - 1);
+        _header.labelsPos = sizeof(FeatureStoreHeader);
+        _header.featuresPos = (_header.labelsPos + labels.size() * sizeof(float) + FEATURES_ALIGNMENT - 1) & ~(FEATURES_ALIGNMENT - 1);
+
+        _f.open(filename.c_str(), ios::binary);
+        if(!_f.is_open())
+            throw std::runtime_error("ERROR: Could not open file " + filename + " for writing");
+
+        // The header is incomplete until the dimension is known, it is written again by close
+        vector<char> padding(FEATURES_ALIGNMENT, 0);
+        _f.write((const char *)&_header, sizeof(_header));
+        if(!labels.empty())
+            _f.write((const char *)&labels[0], labels.size() * sizeof(float));
+        _f.write(&padding[0], _header.featuresPos - (_header.labelsPos + labels.size() * sizeof(float)));
+    }
+
+    void append(const Feature &feat)
+    {
+        if(_count == 0) {
+            _header.dim = feat.size();
+            // Same initial range as FeatureExtractor::scale
+            _min.assign(feat.size(), 0.f);
+            _max.assign(feat.size(), 0.f);
+        }
+        if(feat.size() != _header.dim)
+            throw std::runtime_error("ERROR: Every feature of a store must have the same dimension");
+
+        for(int j = 0; j < feat.size(); j++) {
+            _min[j] = std::min(_min[j], feat[j]);
+            _max[j] = std::max(_max[j], feat[j]);
+        }
+        _f.write((const char *)&feat[0], feat.size() * sizeof(float));
+        _count++;
+    }
+
+    void close()
+    {
+        if(_count != _header.nSamples)
+            throw std::runtime_error("ERROR: Feature store " + _filename + " is missing samples");
+
+        _header.minPos = _header.featuresPos + _count * _header.dim * sizeof(float);
+        _header.maxPos = _header.minPos + _header.dim * sizeof(float);
+        if(_header.dim > 0) {
+            _f.write((const char *)&_min[0], _header.dim * sizeof(float));
+            _f.write((const char *)&_max[0], _header.dim * sizeof(float));
+        }
+        _f.seekp(0);
+        _f.write((const char *)&_header, sizeof(_header));
+        _f.close();
+
+        if(!_f.good())
+            throw std::runtime_error("ERROR: Could not write feature store " + _filename);
+    }
+
+private:
+    string _filename;
+    ofstream _f;
+    FeatureStoreHeader _header;
+    uint64_t _count;
+    vector<float> _min;
+    vector<float> _max;
+};
+
+FeatureStore::FeatureStore(const std::string &filename):
+    _filename(filename), _fd(-1), _length(0), _data(NULL)
+{
+    _fd = open(filename.c_str(), O_RDONLY);
+    if(_fd < 0)
+        throw std::runtime_error("ERROR: Could not open feature store " + filename + " for reading");
+
+    struct stat st;
+    if(fstat(_fd, &st) != 0 || st.st_size < (off_t)sizeof(FeatureStoreHeader)) {
+        close(_fd);
+        throw std::runtime_error("ERROR: Invalid feature store " + filename);
+    }
+
+    _length = st.st_size;
+    void *mapped = mmap(NULL, _length, PROT_READ, MAP_SHARED, _fd, 0);
+    if(mapped == MAP_FAILED) {
+        close(_fd);
+        throw std::runtime_error("ERROR: Could not map feature store " + filename);
+    }
+    _data = (const char *)mapped;
+
+    const FeatureStoreHeader *header = (const FeatureStoreHeader *)_data;
+    if(memcmp(header->magic, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0 || header->version != STORE_VERSION ||
+       header->maxPos + header->dim * sizeof(float) > _length) {
+        munmap((void *)_data, _length);
+        close(_fd);
+        throw std::runtime_error("ERROR: " + filename + " is not a complete feature store");
+    }
+
+    _size = header->nSamples;
+    _dim = header->dim;
+    _category = string(header->category, strnlen(header->category, sizeof(header->category)));
+    _labels = (const float *)(_data + header->labelsPos);
+    _features = (const float *)(_data + header->featuresPos);
+    _min = (const float *)(_data + header->minPos);
+    _max = (const float *)(_data + header->maxPos);
+}
+
+FeatureStore::~FeatureStore()
+{
+    if(_data != NULL) munmap((void *)_data, _length);
+    if(_fd >= 0) close(_fd);
+}
+
+void FeatureStore::getScaledFeature(int idx, float *scaled) const
+{
+    // Same mapping as FeatureExtractor::scale
+    const float *f = getFeature(idx);
+    for(int j = 0; j < _dim; j++) {
+        if(f[j] == _min[j])
+            scaled[j] = -1;
+        else if(f[j] == _max[j])
+            scaled[j] = 1;
+        else
+            scaled[j] = -1 + (2 * ((f[j] - _min[j]) / (_max[j] - _min[j])));
+    }
+}
+
+void FeatureStore::release(int first, int end) const
+{
+    // Only whole pages inside the range are dropped
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t begin = ((const char *)getFeature(first) - _data + pageSize - 1) / pageSize * pageSize;
+    size_t stop = ((const char *)getFeature(end) - _data) / pageSize * pageSize;
+    if(stop > begin)
+        madvise((void *)(_data + begin), stop - begin, MADV_DONTNEED);
+}
+
+bool FeatureStore::isFeatureStore(const std::string &filename)
+{
+    ifstream f(filename.c_str(), ios::binary);
+    char magic[sizeof(STORE_MAGIC)];
+    if(!f.read(magic, sizeof(magic))) return false;
+    return memcmp(magic, STORE_MAGIC, sizeof(STORE_MAGIC)) == 0;
+}
+
+void FeatureStore::build(const PascalImageDatabase &db, const FeatureExtractor &extractor, const std::string &category,
+                         const std::string &filename, const ParametersMap &sourceParams)
+{
+    TRACE_SCOPE("extract_features");
+
+    int n = db.getSize();
+    FeatureStoreWriter writer(filename, category, db.getLabels());
+
+    vector<int> firsts, reductions;
+    vector<string> images;
+    FeatureExtractor::imageRuns(db, firsts, images, reductions);
+    ImageSource source(images, reductions, sourceParams);
+
+    ProgressTask progress("extract_features", n);
+    Feature feat;
+    for(int r = 0; r + 1 < firsts.size(); r++) {
+        Mat img;
+        source.next(img);
+
+        for(int i = firsts[r]; i < firsts[r + 1]; i++) {
+            // Flipped samples are extracted from their flipped crop, see FeatureExtractor
+            Mat patch = FeatureExtractor::cropSample(db, i, img, reductions[r]);
+            extractor(patch, feat);
+            writer.append(feat);
+        }
+        progress.add(firsts[r + 1] - firsts[r]);
+    }
+
+    writer.close();
+}
+
+void FeatureStore::build(const SampleStore &store, const FeatureExtractor &extractor, const std::string &filename)
+{
+    TRACE_SCOPE("extract_features");
+
+    int n = store.getSize();
+    FeatureStoreWriter writer(filename, store.getCategory(), store.getLabels());
+
+    ProgressTask progress("extract_features", n);
+    Feature feat;
+    for(int i = 0; i < n; i++) {
+        Mat patch = store.getSample(i);
+        extractor(patch, feat);
+        writer.append(feat);
+        progress.add();
+    }
+
+    writer.close();
+}
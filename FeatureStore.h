@@ -0,0 +1,89 @@
+#ifndef FEATURE_STORE_H
+#define FEATURE_STORE_H
+
+#include "Common.h"
+#include "Feature.h"
+#include "SampleStore.h"
+
+//! Feature Store Class
+/*!
+    This class stores the features of every training sample in one file along with their labels, so
+    that training can stream them instead of holding a FeatureCollection in memory. The features are
+    written one at a time while they are extracted and the file is memory mapped for reading, the
+    pages of the samples already used can be dropped with release.
+
+    The store also keeps the range of every dimension over all the samples, so features can be read
+    back scaled exactly like FeatureExtractor::scale scales a whole collection before training.
+*/
+class FeatureStore
+{
+public:
+    //! Constructor
+    /*!
+        \param filename Path of a store created with FeatureStore::build
+    */
+    FeatureStore(const std::string &filename);
+
+    //! Destructor
+    ~FeatureStore();
+
+    //! Number of samples
+    int getSize() const { return _size; }
+
+    //! Dimension of the features
+    int getDimension() const { return _dim; }
+
+    //! Path the store was read from
+    std::string getFilename() const { return _filename; }
+
+    //! Category the store was created for
+    std::string getCategory() const { return _category; }
+
+    //! Label of a sample
+    float getLabel(int idx) const { return _labels[idx]; }
+
+    //! Labels of all the samples
+    std::vector<float> getLabels() const { return std::vector<float>(_labels, _labels + _size); }
+
+    //! Unscaled feature of a sample, a view of the mapped file
+    const float *getFeature(int idx) const { return _features + (size_t)idx * _dim; }
+
+    //! Feature of a sample scaled to [-1, 1] with the range of the whole store
+    /*!
+        \param scaled Output buffer of getDimension() values
+    */
+    void getScaledFeature(int idx, float *scaled) const;
+
+    //! Drop the mapped pages of the samples [first, end) from memory, they are read again if needed
+    void release(int first, int end) const;
+
+    //! Extract and write the features of every sample of a database
+    static void build(const PascalImageDatabase &db, const FeatureExtractor &extractor, const std::string &category,
+                      const std::string &filename, const ParametersMap &sourceParams = ImageSource::getDefaultParameters());
+
+    //! Extract and write the features of every window of a sample store
+    static void build(const SampleStore &store, const FeatureExtractor &extractor, const std::string &filename);
+
+    //! True if the file starts like a feature store
+    static bool isFeatureStore(const std::string &filename);
+
+private:
+    std::string _filename;
+    int _fd;
+    size_t _length;
+    const char *_data;
+
+    int _size;
+    int _dim;
+    std::string _category;
+    const float *_labels;
+    const float *_features;
+    const float *_min;
+    const float *_max;
+
+    // Non copyable, the mapping is released by the destructor
+    FeatureStore(const FeatureStore &);
+    FeatureStore &operator=(const FeatureStore &);
+};
+
+#endif // FEATURE_STORE_H
@@ -3,6 +3,8 @@
 #include <boost/foreach.hpp>
 #include "PascalAnnotation.h"
 #include "ImageDatabase.h"
+#include "ImageList.h"
+#include "Trace.h"
 
 
 using namespace std;
@@ -13,13 +15,17 @@ static const char *SIGNATURE = "ImageDataset";
 
 ImageDatabase::ImageDatabase():
     _positivesCount(0), 
-    _negativesCount(0)
+    _negativesCount(0),
+    _index(NULL)
 {
 }
 
-ImageDatabase::ImageDatabase(const string &dbFilename, const string category):
+ImageDatabase::ImageDatabase(const string &dbFilename, const string category, const AnnotationIndex *index,
+                             const VocPaths &paths):
     _positivesCount(0), 
-    _negativesCount(0)
+    _negativesCount(0),
+    _index(index),
+    _paths(paths)
 {
     _category = category;
     load(dbFilename);
@@ -30,21 +36,55 @@ ImageDatabase::ImageDatabase(const vector<vector<Detection> > &dets,
     _detections(dets),
     _filenames(fnames),
     _positivesCount(0), 
-    _negativesCount(0)
+    _negativesCount(0),
+    _index(NULL)
 {
 }
 
-vector<Detection> ImageDatabase::getGroundTruth(string imageName)
+// Reads the ground truth of a range of images, every image writes its own slot
+class GroundTruthLoader : public cv::ParallelLoopBody
+{
+public:
+    GroundTruthLoader(const ImageDatabase &db, const vector<string> &filenames,
+                      vector<vector<Detection> > &detections, vector<string> &errors):
+        _db(db), _filenames(filenames), _detections(detections), _errors(errors)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        for(int k = range.start; k < range.end; k++) {
+            // Exceptions can't cross the worker threads, they are raised again once all are done
+            try {
+                _detections[k] = _db.getGroundTruth(_filenames[k]);
+            } catch(std::exception &err) {
+                _errors[k] = err.what();
+            }
+        }
+    }
+
+private:
+    const ImageDatabase &_db;
+    const vector<string> &_filenames;
+    vector<vector<Detection> > &_detections;
+    vector<string> &_errors;
+};
+
+vector<Detection> ImageDatabase::getGroundTruth(const string &imageName) const
 {
     vector<Detection> dets;
 
     vector<string> parts;
     boost::split(parts,imageName,boost::is_any_of("/."),boost::token_compress_on);
-    string annotationsPath = "/Users/david/Documents/Development/VOC2007/VOCdevkit/VOC2007/Annotations/";
-    string annotationsFilename = annotationsPath + parts[parts.size()-2] + ".xml";
+    string imageId = parts[parts.size()-2];
 
     pascal_annotation annotation;
-    annotation.load(annotationsFilename);
+    if(_index != NULL) {
+        if(!_index->find(imageId, annotation))
+            throw std::runtime_error("ERROR: Image " + imageId + " is not in the annotation index");
+    } else {
+        annotation.load(_paths.getAnnotationFilename(imageId));
+    }
 
     for(int i = 0; i < annotation.objects.size(); ++i){
         if(boost::iequals(annotation.objects[i].name,_category))
@@ -64,34 +104,35 @@ vector<Detection> ImageDatabase::getGroundTruth(string imageName)
 
 void ImageDatabase::load(const string &dbFilename)
 {
-    string imagePath = "/Users/david/Documents/Development/VOC2007/VOCdevkit/VOC2007/JPEGImages/";
+    TRACE_SCOPE("database_load");
 
     _dbFilename = dbFilename;
 
-    ifstream f(dbFilename.c_str());
-    if(!f.is_open()) {
-        throw std::runtime_error("Could not open file " + dbFilename + " for reading");
+    ImageList list(dbFilename);
+    int first = _filenames.size();
+    for(int k = 0; k < list.getSize(); k++) {
+        string imageName = _paths.getImageFilename(list.getName(k));
+        _filenames.push_back(imageName);
+
+        int label = -1;
+        if(list[k].label > 0)
+            label = 1;
+        _labels.push_back(label);
+
+        if(label < 0) _negativesCount++;
+            else if(label > 0) _positivesCount++;
     }
-    else
-    {
-        string line;
-        while(getline(f, line)){
-            vector<string> parts;
-            boost::split(parts, line, boost::is_any_of(" "), boost::token_compress_on);
-            string imageName = imagePath + parts[0] + ".jpg";
-            _filenames.push_back(imageName);
-            vector<Detection> detections = getGroundTruth(imageName);
-            _detections.push_back(detections);
-
-            int label = -1;
-            if(atof(parts[1].c_str()) > 0)
-                label = 1;
-            _labels.push_back(label);
-
-            if(label < 0) _negativesCount++;
-                else if(label > 0) _positivesCount++;
-        }
+
+    vector<string> names(_filenames.begin() + first, _filenames.end());
+    vector<vector<Detection> > detections(names.size());
+    vector<string> errors(names.size());
+    cv::parallel_for_(cv::Range(0, names.size()), GroundTruthLoader(*this, names, detections, errors));
+
+    for(int k = 0; k < errors.size(); k++) {
+        if(!errors[k].empty())
+            throw std::runtime_error(errors[k]);
     }
+    _detections.insert(_detections.end(), detections.begin(), detections.end());
 }
 
 void ImageDatabase::save(const string &dbFilename)
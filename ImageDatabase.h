@@ -3,6 +3,8 @@
 
 #include "Common.h"
 #include "Detection.h"
+#include "AnnotationIndex.h"
+#include "VocPaths.h"
 
 using namespace std;
 
@@ -24,6 +26,12 @@ private:
 
     vector<float> _labels;
 
+    // Optional binary index used instead of the XML annotations
+    const AnnotationIndex *_index;
+
+    // Location of the annotations and images of the lists
+    VocPaths _paths;
+
 public:
     //! Constructor
     ImageDatabase();
@@ -32,8 +40,11 @@ public:
     /*!
         \param dbFilename Path where the input image list is located.
         \param category  Class that we want to train.
+        \param index Annotation index used instead of the XML files, must outlive the database.
+        \param paths Dataset root where the images and annotations of the list are located.
     */
-    ImageDatabase(const string &dbFilename, const string category);
+    ImageDatabase(const string &dbFilename, const string category, const AnnotationIndex *index = NULL,
+                  const VocPaths &paths = VocPaths());
     ImageDatabase(const vector<vector<Detection> > &dets, const vector<string> &fnames);
 
     //! Load a database from file.
@@ -60,7 +71,7 @@ public:
     string getDatabaseFilename() const { return _dbFilename; }
 
     // Getting the ground truth from the annotations
-    vector<Detection> getGroundTruth(string imageName);
+    vector<Detection> getGroundTruth(const string &imageName) const;
 };
 
 // Prints information about the dataset
@@ -0,0 +1,63 @@
+#include "ImageList.h"
+
+using namespace std;
+
+static inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+ImageList::ImageList(const std::string &filename)
+{
+    ifstream f(filename.c_str(), ios::binary);
+    if(!f.is_open()) {
+        throw std::runtime_error("ERROR: Could not open file " + filename + " for reading");
+    }
+
+    f.seekg(0, ios::end);
+    size_t length = f.tellg();
+    f.seekg(0, ios::beg);
+
+    // Null terminated so that strtod never reads past the end
+    _buffer.resize(length + 1);
+    if(length > 0) f.read(&_buffer[0], length);
+    _buffer[length] = '\0';
+
+    const char *p = &_buffer[0];
+    const char *end = p + length;
+    while(p < end) {
+        while(p < end && isBlank(*p)) p++;
+
+        const char *name = p;
+        while(p < end && !isBlank(*p) && *p != '\n') p++;
+
+        if(p > name) {
+            ImageListEntry entry;
+            entry.name = name;
+            entry.nameLength = p - name;
+            entry.label = 0;
+
+            while(p < end && isBlank(*p)) p++;
+            if(p < end && *p != '\n') {
+                char *labelEnd;
+                entry.label = strtod(p, &labelEnd);
+                p = labelEnd;
+            }
+            _entries.push_back(entry);
+        }
+
+        while(p < end && *p != '\n') p++;
+        p++;
+    }
+}
+
+uint64_t imageSeed(const std::string &imageId)
+{
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    for(int i = 0; i < imageId.size(); i++) {
+        h ^= (unsigned char)imageId[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
@@ -0,0 +1,46 @@
+#ifndef IMAGE_LIST_H
+#define IMAGE_LIST_H
+
+#include "Common.h"
+
+//! Entry of an image list, the name points inside the buffer of the ImageList
+struct ImageListEntry
+{
+    const char *name;
+    int nameLength;
+    float label;
+};
+
+//! Image List Class
+/*!
+    This class reads a PASCAL VOC image set file (one "<image id> [<label>]" entry per line) with a
+    single read. Lines are tokenized in place, entries only keep pointers into the file buffer so
+    no string is allocated until an image name is actually needed. A missing label reads as 0.
+*/
+class ImageList
+{
+public:
+    //! Constructor
+    /*!
+        \param filename Path of the image set file
+    */
+    ImageList(const std::string &filename);
+
+    //! Number of entries
+    int getSize() const { return _entries.size(); }
+
+    //! Accessor to a specific entry
+    const ImageListEntry &operator[](int idx) const { return _entries[idx]; }
+
+    //! Image id of a specific entry
+    std::string getName(int idx) const { return std::string(_entries[idx].name, _entries[idx].nameLength); }
+
+private:
+    std::vector<char> _buffer;
+    std::vector<ImageListEntry> _entries;
+};
+
+//! Deterministic seed derived from an image id, independent of the list order and of the threads
+uint64_t imageSeed(const std::string &imageId);
+
+#endif // IMAGE_LIST_H
@@ -0,0 +1,157 @@
+#include "ImageSource.h"
+#include "Trace.h"
+
+#define PREFETCH_THREADS_KEY   "prefetch_threads"
+#define PREFETCH_QUEUE_KEY     "prefetch_queue"
+#define PREFETCH_MEMORY_KEY    "prefetch_memory_mb"
+
+using namespace cv;
+using namespace std;
+
+ImageSource::ImageSource(const std::vector<std::string> &filenames, int flags, const ParametersMap &params):
+    _filenames(filenames),
+    _reductions(filenames.size(), 1),
+    _flags(flags)
+{
+    start(params);
+}
+
+ImageSource::ImageSource(const std::vector<std::string> &filenames, const std::vector<int> &reductions, const ParametersMap &params):
+    _filenames(filenames),
+    _reductions(reductions),
+    _flags(CV_LOAD_IMAGE_COLOR)
+{
+    if(_reductions.size() != _filenames.size())
+        throw std::runtime_error("ERROR: One decode reduction is needed per image");
+
+    start(params);
+}
+
+ImageSource::~ImageSource()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _consumed.notify_all();
+    _workers.join_all();
+}
+
+ParametersMap ImageSource::getDefaultParameters()
+{
+    ParametersMap params;
+    params.set(PREFETCH_THREADS_KEY, 2);
+    params.set(PREFETCH_QUEUE_KEY, 16);
+    params.set(PREFETCH_MEMORY_KEY, 512);
+    return params;
+}
+
+void ImageSource::start(const ParametersMap &params)
+{
+    _queueLength = std::max(params.getInt(PREFETCH_QUEUE_KEY), 1);
+    _memoryCap = (size_t)std::max(params.getInt(PREFETCH_MEMORY_KEY), 1) << 20;
+    _nextToDecode = 0;
+    _nextToConsume = 0;
+    _memoryUsed = 0;
+    _stop = false;
+
+    int nThreads = params.getInt(PREFETCH_THREADS_KEY);
+    for(int i = 0; i < nThreads; i++)
+        _workers.create_thread(boost::bind(&ImageSource::worker, this));
+}
+
+Mat ImageSource::read(const std::string &filename, int reduction, int flags)
+{
+    TRACE_SCOPE("imread");
+
+#if CV_MAJOR_VERSION >= 3
+    if(flags == IMREAD_COLOR || flags == IMREAD_GRAYSCALE) {
+        bool color = (flags == IMREAD_COLOR);
+        switch(reduction) {
+            case 2: return imread(filename, color ? IMREAD_REDUCED_COLOR_2 : IMREAD_REDUCED_GRAYSCALE_2);
+            case 4: return imread(filename, color ? IMREAD_REDUCED_COLOR_4 : IMREAD_REDUCED_GRAYSCALE_4);
+            case 8: return imread(filename, color ? IMREAD_REDUCED_COLOR_8 : IMREAD_REDUCED_GRAYSCALE_8);
+        }
+    }
+#endif
+    return imread(filename, flags);
+}
+
+void ImageSource::decodeImage(int idx, Mat &img, std::string &error) const
+{
+    // Exceptions can't cross the worker threads, they are raised again by next()
+    try {
+        img = read(_filenames[idx], _reductions[idx], _flags);
+        if(img.empty())
+            error = "ERROR: Could not read image " + _filenames[idx];
+    } catch(std::exception &err) {
+        error = err.what();
+    }
+}
+
+void ImageSource::worker()
+{
+    int n = _filenames.size();
+
+    while(true) {
+        int idx;
+        {
+            boost::unique_lock<boost::mutex> lock(_mutex);
+
+            // Wait for room in the queue, the image the consumer waits for is always allowed
+            while(!_stop && _nextToDecode < n && _nextToDecode != _nextToConsume &&
+                  (_nextToDecode >= _nextToConsume + _queueLength || _memoryUsed >= _memoryCap))
+                _consumed.wait(lock);
+
+            if(_stop || _nextToDecode >= n) return;
+            idx = _nextToDecode++;
+        }
+
+        Mat img;
+        string error;
+        decodeImage(idx, img, error);
+
+        {
+            boost::lock_guard<boost::mutex> lock(_mutex);
+            _memoryUsed += img.total() * img.elemSize();
+            _ready[idx] = img;
+            if(!error.empty()) _errors[idx] = error;
+        }
+        _decoded.notify_all();
+    }
+}
+
+bool ImageSource::next(Mat &img)
+{
+    int n = _filenames.size();
+    if(_nextToConsume >= n) return false;
+
+    if(_workers.size() == 0) {
+        string error;
+        decodeImage(_nextToConsume++, img, error);
+        if(!error.empty()) throw std::runtime_error(error);
+        return true;
+    }
+
+    string error;
+    {
+        boost::unique_lock<boost::mutex> lock(_mutex);
+        while(_ready.count(_nextToConsume) == 0)
+            _decoded.wait(lock);
+
+        map<int, Mat>::iterator it = _ready.find(_nextToConsume);
+        img = it->second;
+        _memoryUsed -= img.total() * img.elemSize();
+        _ready.erase(it);
+
+        if(_errors.count(_nextToConsume) == 1) {
+            error = _errors[_nextToConsume];
+            _errors.erase(_nextToConsume);
+        }
+        _nextToConsume++;
+    }
+    _consumed.notify_all();
+
+    if(!error.empty()) throw std::runtime_error(error);
+    return true;
+}
@@ -0,0 +1,86 @@
+#ifndef IMAGE_SOURCE_H
+#define IMAGE_SOURCE_H
+
+#include "Common.h"
+#include "ParametersMap.h"
+
+#include <boost/thread.hpp>
+
+//! Image Source Class
+/*!
+    This class decodes a list of images ahead of the thread consuming them. A pool of I/O threads
+    reads and decodes the images into a bounded queue while the caller receives them strictly in list
+    order through next(). Decoding stops ahead of the consumer when either the queue holds
+    prefetch_queue images or the decoded images take more than prefetch_memory_mb, the next image
+    to be consumed is always decoded so the cap can't stall the pipeline.
+
+    With prefetch_threads set to 0 the images are decoded on the calling thread.
+*/
+class ImageSource
+{
+public:
+    //! Constructor
+    /*!
+        \param filenames Images to decode, in the order they will be consumed
+        \param flags imread flags used for every image
+        \param params Prefetching parameters, see getDefaultParameters
+    */
+    ImageSource(const std::vector<std::string> &filenames, int flags, const ParametersMap &params = getDefaultParameters());
+
+    //! Constructor
+    /*!
+        \param filenames Images to decode, in the order they will be consumed
+        \param reductions Per image decode reduction (1, 2, 4 or 8), see ImageSource::read
+        \param params Prefetching parameters, see getDefaultParameters
+    */
+    ImageSource(const std::vector<std::string> &filenames, const std::vector<int> &reductions, const ParametersMap &params = getDefaultParameters());
+
+    //! Destructor, stops the I/O threads
+    ~ImageSource();
+
+    static ParametersMap getDefaultParameters();
+
+    //! Get the next image of the list
+    /*!
+        \param img Decoded image, throws if the image could not be read
+        \return false once every image has been consumed
+    */
+    bool next(cv::Mat &img);
+
+    //! Number of images in the list
+    int getSize() const { return _filenames.size(); }
+
+    //! Decode an image at 1/reduction of its resolution, JPEG files are scaled in the DCT domain
+    static cv::Mat read(const std::string &filename, int reduction, int flags = CV_LOAD_IMAGE_COLOR);
+
+private:
+    std::vector<std::string> _filenames;
+    std::vector<int> _reductions;
+    int _flags;
+
+    int _queueLength;
+    size_t _memoryCap;
+
+    // Shared state, guarded by _mutex
+    boost::mutex _mutex;
+    boost::condition_variable _decoded;      // A worker stored an image
+    boost::condition_variable _consumed;     // The consumer took an image or the source is closing
+    std::map<int, cv::Mat> _ready;
+    std::map<int, std::string> _errors;
+    int _nextToDecode;
+    int _nextToConsume;
+    size_t _memoryUsed;
+    bool _stop;
+
+    boost::thread_group _workers;
+
+    void start(const ParametersMap &params);
+    void decodeImage(int idx, cv::Mat &img, std::string &error) const;
+    void worker();
+
+    // Non copyable, the workers reference this object
+    ImageSource(const ImageSource &);
+    ImageSource &operator=(const ImageSource &);
+};
+
+#endif // IMAGE_SOURCE_H
@@ -0,0 +1,97 @@
+#include "LinearBlockScorer.h"
+
+using namespace std;
+
+static bool sortByEnergy(const pair<double, int> &a, const pair<double, int> &b)
+{
+    return a.first > b.first;
+}
+
+LinearBlockScorer::LinearBlockScorer():
+    _bias(0), _blockLength(1), _remainingMax(1, 0)
+{
+}
+
+LinearBlockScorer::LinearBlockScorer(const vector<float> &detector, int blockLength, float featureMin, float featureMax):
+    _bias(0), _blockLength(blockLength)
+{
+    if(detector.empty() || blockLength <= 0)
+        throw std::runtime_error("ERROR: Invalid linear detector for block scoring");
+
+    _weights.assign(detector.begin(), detector.end() - 1);
+    _bias = detector.back();
+
+    if(_weights.size() % _blockLength != 0)
+        throw std::runtime_error("ERROR: Detector size is not a multiple of the HOG block length");
+
+    int nBlocks = _weights.size() / _blockLength;
+    vector<pair<double, int> > energy(nBlocks);
+    for(int b = 0; b < nBlocks; b++) {
+        double e = 0;
+        for(int k = b * _blockLength; k < (b + 1) * _blockLength; k++)
+            e += _weights[k] * _weights[k];
+        energy[b] = make_pair(e, b);
+    }
+
+    stable_sort(energy.begin(), energy.end(), sortByEnergy);
+
+    _order.resize(nBlocks);
+    for(int b = 0; b < nBlocks; b++)
+        _order[b] = energy[b].second;
+
+    // Suffix sums of the largest contribution of every block in visiting order
+    _remainingMax.assign(nBlocks + 1, 0);
+    for(int b = nBlocks - 1; b >= 0; b--) {
+        double blockMax = 0;
+        for(int k = _order[b] * _blockLength; k < (_order[b] + 1) * _blockLength; k++)
+            blockMax += std::max(_weights[k] * featureMin, _weights[k] * featureMax);
+        _remainingMax[b] = _remainingMax[b + 1] + blockMax;
+    }
+}
+
+float LinearBlockScorer::score(const float *feat) const
+{
+    float s = _bias;
+    for(int k = 0; k < _weights.size(); k++)
+        s += _weights[k] * feat[k];
+    return s;
+}
+
+float LinearBlockScorer::partialScore(const float *feat, int nBlocks) const
+{
+    nBlocks = std::min(nBlocks, (int)_order.size());
+
+    float s = _bias;
+    for(int b = 0; b < nBlocks; b++) {
+        int offset = _order[b] * _blockLength;
+        const float *w = &_weights[offset];
+        const float *f = feat + offset;
+        for(int k = 0; k < _blockLength; k++)
+            s += w[k] * f[k];
+    }
+    return s;
+}
+
+bool LinearBlockScorer::scoreAbove(const float *feat, float threshold, float &score, int &blocksVisited) const
+{
+    float s = _bias;
+    int nBlocks = _order.size();
+
+    for(int b = 0; b < nBlocks; b++) {
+        if(s + _remainingMax[b] <= threshold) {
+            score = s + _remainingMax[b];
+            blocksVisited = b;
+            return false;
+        }
+
+        int offset = _order[b] * _blockLength;
+        const float *w = &_weights[offset];
+        const float *f = feat + offset;
+        for(int k = 0; k < _blockLength; k++)
+            s += w[k] * f[k];
+    }
+
+    score = s;
+    blocksVisited = nBlocks;
+    return s > threshold;
+}
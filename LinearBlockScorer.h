@@ -0,0 +1,57 @@
+#ifndef LINEAR_BLOCK_SCORER_H
+#define LINEAR_BLOCK_SCORER_H
+
+#include "Common.h"
+
+//! Linear Block Scorer Class
+/*!
+    This class scores HOG windows with the primal form of a linear model (see
+    SupportVectorMachine::getDetector). The descriptor is split in its normalization blocks
+    and the blocks are visited in decreasing order of weight energy, so the partial score
+    over the first blocks is a cheap approximation of the full score.
+*/
+class LinearBlockScorer
+{
+public:
+    //! Constructor
+    LinearBlockScorer();
+
+    //! Constructor
+    /*!
+        \param detector Primal weights followed by the bias term
+        \param blockLength Number of descriptor values in a HOG block
+        \param featureMin Smallest value a descriptor entry can take
+        \param featureMax Largest value a descriptor entry can take
+    */
+    LinearBlockScorer(const std::vector<float> &detector, int blockLength, float featureMin = 0, float featureMax = 1);
+
+    //! Score of the full window
+    float score(const float *feat) const;
+
+    //! Score restricted to the nBlocks blocks with the highest weight energy
+    float partialScore(const float *feat, int nBlocks) const;
+
+    //! Score the window only if it can exceed the threshold
+    /*!
+        \param threshold Windows scoring at or below this value are rejected
+        \param score Full score when the window is accepted, upper bound of it otherwise
+        \param blocksVisited Number of blocks accumulated before deciding
+        \return true if the score is above the threshold
+    */
+    bool scoreAbove(const float *feat, float threshold, float &score, int &blocksVisited) const;
+
+    //! Number of blocks in the descriptor
+    int getBlockCount() const { return _order.size(); }
+
+    //! Length of the descriptor
+    int getDescriptorSize() const { return _weights.size(); }
+
+private:
+    std::vector<float> _weights;  // Weights without the bias term
+    float _bias;
+    int _blockLength;
+    std::vector<int> _order;      // Block indices sorted by decreasing weight energy
+    std::vector<float> _remainingMax; // Largest contribution of the blocks from _order[b] onwards
+};
+
+#endif // LINEAR_BLOCK_SCORER_H
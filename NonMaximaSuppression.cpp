@@ -0,0 +1,471 @@
+#include "NonMaximaSuppression.h"
+#include "Trace.h"
+
+#include <queue>
+#include <cfloat>
+#include <climits>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+const char *NMS_METHOD_KEY            = "nms_method";
+const char *NMS_OVERLAP_THRESHOLD_KEY = "nms_overlap_threshold";
+const char *NMS_SOFT_SIGMA_KEY        = "nms_soft_sigma";
+const char *NMS_SCORE_THRESHOLD_KEY   = "nms_score_threshold";
+const char *NMS_BANDWIDTH_XY_KEY      = "nms_bandwidth_xy";
+const char *NMS_BANDWIDTH_SCALE_KEY   = "nms_bandwidth_scale";
+
+namespace {
+
+// Corners and areas of a set of boxes stored as separate arrays (structure of arrays),
+// this is the layout expected by overlapOneToMany.
+struct BoxArrays
+{
+    vector<float> x1, y1, x2, y2, area;
+
+    void clear()
+    {
+        x1.clear(); y1.clear(); x2.clear(); y2.clear(); area.clear();
+    }
+
+    void push_back(const Rect &r)
+    {
+        x1.push_back(r.x);
+        y1.push_back(r.y);
+        x2.push_back(r.x + r.width);
+        y2.push_back(r.y + r.height);
+        area.push_back(float(r.width) * r.height);
+    }
+
+    int size() const { return x1.size(); }
+};
+
+// Uniform grid covering the detections. A box is registered in every cell it touches, so
+// two boxes that intersect always share at least one cell. The cell side is the median box
+// side: boxes of the typical scale touch at most four cells and only share them with their
+// neighbours, while the few larger boxes of coarser levels are registered in every cell they
+// span instead of making the cells of every box as large as theirs.
+class BoxGrid
+{
+public:
+    BoxGrid(const vector<Detection> &dets):
+        _x0(0), _y0(0), _cell(1), _cols(1), _rows(1), _query(0)
+    {
+        if(dets.empty()) {
+            _cells.resize(1);
+            return;
+        }
+
+        int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+        vector<int> sides(dets.size());
+        for(int i = 0; i < dets.size(); i++) {
+            const Rect &r = dets[i].rect;
+            x0 = std::min(x0, r.x);
+            y0 = std::min(y0, r.y);
+            x1 = std::max(x1, r.x + r.width);
+            y1 = std::max(y1, r.y + r.height);
+            sides[i] = std::max(r.width, r.height);
+        }
+
+        nth_element(sides.begin(), sides.begin() + sides.size() / 2, sides.end());
+        _cell = std::max(sides[sides.size() / 2], 1);
+
+        // Sparse detections over a large area would leave most cells empty
+        while((double)((x1 - x0) / _cell + 1) * ((y1 - y0) / _cell + 1) > 4.0 * dets.size() + 16)
+            _cell *= 2;
+
+        _x0 = x0;
+        _y0 = y0;
+        _cols = (x1 - x0) / _cell + 1;
+        _rows = (y1 - y0) / _cell + 1;
+        _cells.resize(_cols * _rows);
+        _stamp.assign(dets.size(), -1);
+    }
+
+    void insert(int idx, const Rect &r)
+    {
+        int cx0, cy0, cx1, cy1;
+        cellRange(r, cx0, cy0, cx1, cy1);
+        for(int cy = cy0; cy <= cy1; cy++)
+            for(int cx = cx0; cx <= cx1; cx++)
+                _cells[cy * _cols + cx].push_back(idx);
+    }
+
+    // Collects the registered boxes sharing a cell with r, each one reported once
+    void query(const Rect &r, vector<int> &found)
+    {
+        found.clear();
+        _query++;
+
+        int cx0, cy0, cx1, cy1;
+        cellRange(r, cx0, cy0, cx1, cy1);
+        for(int cy = cy0; cy <= cy1; cy++) {
+            for(int cx = cx0; cx <= cx1; cx++) {
+                const vector<int> &cell = _cells[cy * _cols + cx];
+                for(int k = 0; k < cell.size(); k++) {
+                    int idx = cell[k];
+                    if(_stamp[idx] == _query) continue;
+                    _stamp[idx] = _query;
+                    found.push_back(idx);
+                }
+            }
+        }
+    }
+
+private:
+    int _x0, _y0, _cell, _cols, _rows;
+    int _query;
+    vector<vector<int> > _cells;
+    vector<int> _stamp;
+
+    void cellRange(const Rect &r, int &cx0, int &cy0, int &cx1, int &cy1) const
+    {
+        cx0 = clampCol((r.x - _x0) / _cell);
+        cy0 = clampRow((r.y - _y0) / _cell);
+        cx1 = clampCol((r.x + r.width - _x0) / _cell);
+        cy1 = clampRow((r.y + r.height - _y0) / _cell);
+    }
+
+    int clampCol(int c) const { return std::min(std::max(c, 0), _cols - 1); }
+    int clampRow(int r) const { return std::min(std::max(r, 0), _rows - 1); }
+};
+
+bool sortIndexByResponse(const pair<float, int> &a, const pair<float, int> &b)
+{
+    return a.first > b.first;
+}
+
+// Indices of the detections sorted by decreasing response
+void sortByResponse(const vector<Detection> &dets, vector<int> &order)
+{
+    vector<pair<float, int> > idxResp(dets.size());
+    for(int i = 0; i < dets.size(); i++)
+        idxResp[i] = make_pair(dets[i].response, i);
+
+    stable_sort(idxResp.begin(), idxResp.end(), sortIndexByResponse);
+
+    order.resize(dets.size());
+    for(int i = 0; i < idxResp.size(); i++)
+        order[i] = idxResp[i].second;
+}
+
+// Overlap between r and the boxes listed in idx
+void overlapWith(const Rect &r, const BoxArrays &boxes, const vector<int> &idx, BoxArrays &gathered, vector<float> &overlap)
+{
+    gathered.clear();
+    for(int k = 0; k < idx.size(); k++) {
+        int j = idx[k];
+        gathered.x1.push_back(boxes.x1[j]);
+        gathered.y1.push_back(boxes.y1[j]);
+        gathered.x2.push_back(boxes.x2[j]);
+        gathered.y2.push_back(boxes.y2[j]);
+        gathered.area.push_back(boxes.area[j]);
+    }
+
+    overlap.resize(idx.size());
+    if(idx.empty()) return;
+
+    float box[4] = { float(r.x), float(r.y), float(r.x + r.width), float(r.y + r.height) };
+    overlapOneToMany(box, &gathered.x1[0], &gathered.y1[0], &gathered.x2[0], &gathered.y2[0],
+                     &gathered.area[0], gathered.size(), &overlap[0]);
+}
+
+} // namespace
+
+void overlapOneToMany(const float box[4], const float *x1, const float *y1, const float *x2, const float *y2,
+                      const float *area, int n, float *overlap)
+{
+    const float boxArea = (box[2] - box[0]) * (box[3] - box[1]);
+    int i = 0;
+
+#ifdef __SSE__
+    const __m128 bx1 = _mm_set1_ps(box[0]);
+    const __m128 by1 = _mm_set1_ps(box[1]);
+    const __m128 bx2 = _mm_set1_ps(box[2]);
+    const __m128 by2 = _mm_set1_ps(box[3]);
+    const __m128 barea = _mm_set1_ps(boxArea);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 eps = _mm_set1_ps(FLT_EPSILON);
+
+    for(; i + 4 <= n; i += 4) {
+        __m128 ix1 = _mm_max_ps(bx1, _mm_loadu_ps(x1 + i));
+        __m128 iy1 = _mm_max_ps(by1, _mm_loadu_ps(y1 + i));
+        __m128 ix2 = _mm_min_ps(bx2, _mm_loadu_ps(x2 + i));
+        __m128 iy2 = _mm_min_ps(by2, _mm_loadu_ps(y2 + i));
+
+        __m128 w = _mm_max_ps(_mm_sub_ps(ix2, ix1), zero);
+        __m128 h = _mm_max_ps(_mm_sub_ps(iy2, iy1), zero);
+        __m128 inter = _mm_mul_ps(w, h);
+        __m128 uni = _mm_sub_ps(_mm_add_ps(barea, _mm_loadu_ps(area + i)), inter);
+
+        _mm_storeu_ps(overlap + i, _mm_div_ps(inter, _mm_max_ps(uni, eps)));
+    }
+#endif
+
+    for(; i < n; i++) {
+        float w = std::max(std::min(box[2], x2[i]) - std::max(box[0], x1[i]), 0.0f);
+        float h = std::max(std::min(box[3], y2[i]) - std::max(box[1], y1[i]), 0.0f);
+        float inter = w * h;
+        float uni = boxArea + area[i] - inter;
+        overlap[i] = inter / std::max(uni, FLT_EPSILON);
+    }
+}
+
+// Non Maxima Suppression class
+
+NonMaximaSuppression::NonMaximaSuppression(const ParametersMap &params)
+{
+    string method = params.getStr(NMS_METHOD_KEY);
+
+    if(boost::iequals(method, "NONE"))
+        _method = NMS_NONE;
+    else if(boost::iequals(method, "GREEDY"))
+        _method = NMS_GREEDY;
+    else if(boost::iequals(method, "SOFT"))
+        _method = NMS_SOFT;
+    else if(boost::iequals(method, "MEANSHIFT"))
+        _method = NMS_MEANSHIFT;
+    else
+        throw std::runtime_error("ERROR: Unknown non maxima suppression method: " + method);
+
+    _overlapThreshold = params.getFloat(NMS_OVERLAP_THRESHOLD_KEY);
+    _softSigma = params.getFloat(NMS_SOFT_SIGMA_KEY);
+    _scoreThreshold = params.getFloat(NMS_SCORE_THRESHOLD_KEY);
+    _bandwidthXY = params.getFloat(NMS_BANDWIDTH_XY_KEY);
+    _bandwidthScale = params.getFloat(NMS_BANDWIDTH_SCALE_KEY);
+}
+
+ParametersMap NonMaximaSuppression::getDefaultParameters()
+{
+    ParametersMap params;
+    params.set(NMS_METHOD_KEY, "greedy");
+    params.set(NMS_OVERLAP_THRESHOLD_KEY, 0.5);
+    params.set(NMS_SOFT_SIGMA_KEY, 0.5);
+    params.set(NMS_SCORE_THRESHOLD_KEY, -1.0);
+    params.set(NMS_BANDWIDTH_XY_KEY, 0.125);  // 8x16 pixels for a 64x128 window
+    params.set(NMS_BANDWIDTH_SCALE_KEY, 0.26); // log(1.3)
+    return params;
+}
+
+ParametersMap NonMaximaSuppression::getParameters() const
+{
+    const char *methods[] = { "none", "greedy", "soft", "meanshift" };
+
+    ParametersMap params;
+    params.set(NMS_METHOD_KEY, methods[_method]);
+    params.set(NMS_OVERLAP_THRESHOLD_KEY, _overlapThreshold);
+    params.set(NMS_SOFT_SIGMA_KEY, _softSigma);
+    params.set(NMS_SCORE_THRESHOLD_KEY, _scoreThreshold);
+    params.set(NMS_BANDWIDTH_XY_KEY, _bandwidthXY);
+    params.set(NMS_BANDWIDTH_SCALE_KEY, _bandwidthScale);
+    return params;
+}
+
+void NonMaximaSuppression::operator()(vector<Detection> &dets) const
+{
+    TRACE_SCOPE("nms");
+
+    if(dets.empty()) return;
+
+    switch(_method) {
+        case NMS_GREEDY:    greedy(dets);    break;
+        case NMS_SOFT:      soft(dets);      break;
+        case NMS_MEANSHIFT: meanShift(dets); break;
+        default: break;
+    }
+}
+
+void NonMaximaSuppression::greedy(vector<Detection> &dets) const
+{
+    int n = dets.size();
+
+    vector<int> order;
+    sortByResponse(dets, order);
+
+    BoxArrays boxes;
+    for(int i = 0; i < n; i++)
+        boxes.push_back(dets[i].rect);
+
+    // Only the boxes that survive are registered in the grid
+    BoxGrid grid(dets);
+    BoxArrays gathered;
+    vector<int> neighbours;
+    vector<float> overlap;
+    vector<Detection> kept;
+
+    for(int k = 0; k < n; k++) {
+        int i = order[k];
+        if(dets[i].response < _scoreThreshold) break;
+
+        grid.query(dets[i].rect, neighbours);
+        overlapWith(dets[i].rect, boxes, neighbours, gathered, overlap);
+
+        bool suppressed = false;
+        for(int j = 0; j < overlap.size() && !suppressed; j++)
+            suppressed = overlap[j] > _overlapThreshold;
+
+        if(!suppressed) {
+            grid.insert(i, dets[i].rect);
+            kept.push_back(dets[i]);
+        }
+    }
+
+    dets.swap(kept);
+}
+
+void NonMaximaSuppression::soft(vector<Detection> &dets) const
+{
+    int n = dets.size();
+
+    BoxArrays boxes;
+    BoxGrid grid(dets);
+    vector<float> scores(n);
+    vector<bool> alive(n, true);
+    priority_queue<pair<float, int> > heap;
+
+    for(int i = 0; i < n; i++) {
+        boxes.push_back(dets[i].rect);
+        grid.insert(i, dets[i].rect);
+        scores[i] = dets[i].response;
+        heap.push(make_pair(scores[i], i));
+    }
+
+    BoxArrays gathered;
+    vector<int> neighbours, aliveNeighbours;
+    vector<float> overlap;
+    vector<Detection> kept;
+
+    // Stale heap entries are skipped, decays only lower a score so the first stale or
+    // current entry below the threshold means that every remaining box is below it too
+    while(!heap.empty()) {
+        pair<float, int> top = heap.top();
+        heap.pop();
+
+        int i = top.second;
+        if(!alive[i] || top.first != scores[i]) continue;
+        if(scores[i] < _scoreThreshold) break;
+
+        alive[i] = false;
+        Detection det = dets[i];
+        det.response = scores[i];
+        kept.push_back(det);
+
+        grid.query(dets[i].rect, neighbours);
+        aliveNeighbours.clear();
+        for(int k = 0; k < neighbours.size(); k++)
+            if(alive[neighbours[k]]) aliveNeighbours.push_back(neighbours[k]);
+
+        overlapWith(dets[i].rect, boxes, aliveNeighbours, gathered, overlap);
+
+        for(int k = 0; k < aliveNeighbours.size(); k++) {
+            if(overlap[k] <= 0) continue;
+            int j = aliveNeighbours[k];
+            // Responses are decayed towards the score threshold, SVM margins can be negative
+            float decay = exp(-(overlap[k] * overlap[k]) / _softSigma);
+            scores[j] = _scoreThreshold + (scores[j] - _scoreThreshold) * decay;
+            heap.push(make_pair(scores[j], j));
+        }
+    }
+
+    dets.swap(kept);
+}
+
+void NonMaximaSuppression::meanShift(vector<Detection> &dets) const
+{
+    const int maxIterations = 100;
+    const double convergence = 1e-3;
+
+    int n = dets.size();
+
+    // Points in (x, y, log scale) space with hard clipped weights
+    vector<double> px(n), py(n), ps(n), sx(n), sy(n), weight(n);
+    for(int i = 0; i < n; i++) {
+        const Rect &r = dets[i].rect;
+        px[i] = r.x + r.width / 2.0;
+        py[i] = r.y + r.height / 2.0;
+        ps[i] = log(double(std::max(r.width, 1)));
+        sx[i] = _bandwidthXY * r.width;
+        sy[i] = _bandwidthXY * r.height;
+        weight[i] = std::max(dets[i].response - _scoreThreshold, 0.0);
+    }
+
+    BoxGrid grid(dets);
+    for(int i = 0; i < n; i++)
+        grid.insert(i, dets[i].rect);
+
+    vector<int> neighbours;
+    vector<double> modeX, modeY, modeS;
+    vector<int> modeBest;
+
+    for(int i = 0; i < n; i++) {
+        if(weight[i] <= 0) continue;
+
+        double x = px[i], y = py[i], s = ps[i];
+        for(int it = 0; it < maxIterations; it++) {
+            // Support of the kernel, three bandwidths around the current estimate
+            double w = exp(s);
+            double h = w * dets[i].rect.height / std::max(dets[i].rect.width, 1);
+            Rect support(cvRound(x - w / 2 - 3 * _bandwidthXY * w), cvRound(y - h / 2 - 3 * _bandwidthXY * h),
+                         cvRound(w * (1 + 6 * _bandwidthXY)), cvRound(h * (1 + 6 * _bandwidthXY)));
+            grid.query(support, neighbours);
+
+            double sumW = 0, nx = 0, ny = 0, ns = 0;
+            for(int k = 0; k < neighbours.size(); k++) {
+                int j = neighbours[k];
+                if(weight[j] <= 0) continue;
+                double dx = (x - px[j]) / sx[j];
+                double dy = (y - py[j]) / sy[j];
+                double ds = (s - ps[j]) / _bandwidthScale;
+                double kw = weight[j] * exp(-0.5 * (dx * dx + dy * dy + ds * ds)) / (sx[j] * sy[j]);
+                sumW += kw;
+                nx += kw * px[j];
+                ny += kw * py[j];
+                ns += kw * ps[j];
+            }
+            if(sumW <= 0) break;
+
+            nx /= sumW;
+            ny /= sumW;
+            ns /= sumW;
+
+            double shift = fabs(nx - x) / sx[i] + fabs(ny - y) / sy[i] + fabs(ns - s) / _bandwidthScale;
+            x = nx;
+            y = ny;
+            s = ns;
+            if(shift < convergence) break;
+        }
+
+        // Merge with an existing mode closer than one bandwidth
+        int mode = -1;
+        for(int m = 0; m < modeX.size() && mode < 0; m++) {
+            double dx = (x - modeX[m]) / sx[i];
+            double dy = (y - modeY[m]) / sy[i];
+            double ds = (s - modeS[m]) / _bandwidthScale;
+            if(dx * dx + dy * dy + ds * ds < 1.0) mode = m;
+        }
+
+        if(mode < 0) {
+            modeX.push_back(x);
+            modeY.push_back(y);
+            modeS.push_back(s);
+            modeBest.push_back(i);
+        } else if(dets[i].response > dets[modeBest[mode]].response) {
+            modeBest[mode] = i;
+        }
+    }
+
+    vector<Detection> kept;
+    for(int m = 0; m < modeX.size(); m++) {
+        const Detection &best = dets[modeBest[m]];
+        double w = exp(modeS[m]);
+        double h = w * best.rect.height / std::max(best.rect.width, 1);
+        Rect r(cvRound(modeX[m] - w / 2), cvRound(modeY[m] - h / 2), cvRound(w), cvRound(h));
+        kept.push_back(Detection(r, best.response));
+    }
+
+    dets.swap(kept);
+}
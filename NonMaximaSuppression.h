@@ -0,0 +1,70 @@
+#ifndef NON_MAXIMA_SUPPRESSION_H
+#define NON_MAXIMA_SUPPRESSION_H
+
+#include "Common.h"
+#include "Detection.h"
+#include "ParametersMap.h"
+
+//! Non Maxima Suppression Class
+/*!
+    This class removes the overlapping windows reported by the ObjectDetector. Detections are
+    visited in decreasing order of response and each one is only compared against the detections
+    that share a cell of a uniform grid, so the cost stays close to linear in the number of
+    windows instead of the all-pairs comparison done by cv::partition.
+
+    Three strategies can be selected with the nms_method parameter:
+    - greedy: keep the best box and drop every box overlapping it more than nms_overlap_threshold.
+    - soft: decay the response of the overlapping boxes with a gaussian of the overlap (Bodla et al.).
+    - meanshift: find the modes of the detections in (x, y, scale) space (Dalal and Triggs).
+*/
+class NonMaximaSuppression
+{
+public:
+    enum Method
+    {
+        NMS_NONE,
+        NMS_GREEDY,
+        NMS_SOFT,
+        NMS_MEANSHIFT
+    };
+
+    //! Constructor
+    /*!
+        \param params ParametersMap containing the suppression configuration
+    */
+    NonMaximaSuppression(const ParametersMap &params = getDefaultParameters());
+
+    //! Suppress the overlapping detections in place
+    void operator()(std::vector<Detection> &dets) const;
+
+    //! Get default parameters
+    static ParametersMap getDefaultParameters();
+    ParametersMap getParameters() const;
+
+    Method getMethod() const { return _method; }
+
+private:
+    Method _method;
+    double _overlapThreshold;   // Maximum overlap allowed between two kept boxes (greedy)
+    double _softSigma;          // Width of the gaussian decay (soft)
+    double _scoreThreshold;     // Boxes whose response falls below this value are discarded
+    double _bandwidthXY;        // Spatial bandwidth relative to the box size (meanshift)
+    double _bandwidthScale;     // Bandwidth in log scale (meanshift)
+
+    void greedy(std::vector<Detection> &dets) const;
+    void soft(std::vector<Detection> &dets) const;
+    void meanShift(std::vector<Detection> &dets) const;
+};
+
+//! Intersection over union of one box against n boxes
+/*!
+    Boxes are given by their corners (x1, y1, x2, y2) stored as separate arrays so the
+    comparison can be vectorized, four boxes at a time when SSE is available.
+    \param box Corners of the reference box
+    \param area Precomputed areas of the n boxes
+    \param overlap Output array of n intersection over union values
+*/
+void overlapOneToMany(const float box[4], const float *x1, const float *y1, const float *x2, const float *y2,
+                      const float *area, int n, float *overlap);
+
+#endif // NON_MAXIMA_SUPPRESSION_H
@@ -1,234 +1,530 @@
-#include <boost/foreach.hpp>
-#include <boost/accumulators/accumulators.hpp>
-#include <boost/accumulators/statistics/stats.hpp>
-#include <boost/accumulators/statistics/max.hpp>
-#include <boost/accumulators/statistics/min.hpp>
-
 #include "ObjectDetector.h"
+#include "Trace.h"
+
+#include <cfloat>
 
-#define WIN_SIZE_NMS_KEY   "nms_win_size"
-#define RESP_THESH_KEY     "sv_response_threshold"
-#define OVERLAP_THRESH_KEY "detection_overlap_threshold"
+#define HIT_THRESHOLD_KEY         "hit_threshold"
+#define EARLY_EXIT_KEY            "early_exit"
+#define SCAN_MODE_KEY             "scan_mode"
+#define CASCADE_COARSE_FACTOR_KEY "cascade_coarse_factor"
+#define CASCADE_BLOCKS_KEY        "cascade_blocks"
+#define CASCADE_THRESHOLD_KEY     "cascade_threshold"
+#define CASCADE_MISS_RATE_KEY     "cascade_max_miss_rate"
+
+// Cascade threshold accepting every window
+#define UNCALIBRATED_CASCADE_THRESHOLD -1e9
 
-using namespace boost::accumulators;
 using namespace cv;
 using namespace std;
 
 // Object Detector class
 
-ObjectDetector::ObjectDetector(const SupportVectorMachine& svm):
-    _svm(svm)
+ObjectDetector::ObjectDetector(const SupportVectorMachine& svm, const ParametersMap &params,
+                               const PrincipalComponentAnalysis *projection, const std::string &category):
+    _winSize(64,128),
+    _blockSize(16,16),
+    _blockStride(8,8),
+    _cellSize(8,8),
+    _nbins(9),
+    _params(params),
+    _nms(params)
 {
-    _svmDetector = svm.getDetector();
+    initialize(vector<const SupportVectorMachine*>(1, &svm), vector<const PrincipalComponentAnalysis*>(1, projection),
+               category.empty() ? vector<string>() : vector<string>(1, category));
 }
 
-ObjectDetector::~ObjectDetector()
+ObjectDetector::ObjectDetector(const vector<const SupportVectorMachine*>& svms, const ParametersMap &params,
+                               const vector<const PrincipalComponentAnalysis*>& projections,
+                               const vector<std::string>& categories):
+    _winSize(64,128),
+    _blockSize(16,16),
+    _blockStride(8,8),
+    _cellSize(8,8),
+    _nbins(9),
+    _params(params),
+    _nms(params)
 {
-    //HOGDescriptor::~HOGDescriptor();
+    initialize(svms, projections, categories);
 }
 
-void ObjectDetector::getDetections(Mat img, vector<Detection>& found)
+void ObjectDetector::initialize(const vector<const SupportVectorMachine*>& svms, const vector<const PrincipalComponentAnalysis*>& projections,
+                                const vector<std::string>& categories)
 {
-    //TODO: Put the hit theshold to be configurable from the outside
-    _winSize = Size(64,128);
-    _blockSize = Size(16,16);
-    _blockStride = Size(8,8);
-    _cellSize = Size(8,8);
-    _nbins = 9;
+    if(svms.empty())
+        throw std::runtime_error("ERROR: The object detector needs at least one model");
+    if(!projections.empty() && projections.size() != svms.size())
+        throw std::runtime_error("ERROR: The object detector needs one projection per model");
+    if(!categories.empty() && categories.size() != svms.size())
+        throw std::runtime_error("ERROR: The object detector needs one category per model");
+
+    _hitThreshold = _params.getFloat(HIT_THRESHOLD_KEY);
+    _earlyExit = _params.getInt(EARLY_EXIT_KEY) != 0;
+
+    string scanMode = _params.getStr(SCAN_MODE_KEY);
+    if(boost::iequals(scanMode, "DENSE"))
+        _cascade = false;
+    else if(boost::iequals(scanMode, "CASCADE"))
+        _cascade = true;
+    else
+        throw std::runtime_error("ERROR: Unknown scan mode: " + scanMode);
+
+    // A single calibrated threshold only fits the model it was calibrated for
+    if(_cascade && svms.size() > 1 && categories.empty())
+        throw std::runtime_error("ERROR: The cascade scan of several models needs their categories to read their thresholds");
+
+    _coarseFactor = std::max(_params.getInt(CASCADE_COARSE_FACTOR_KEY), 1);
+    _cascadeBlocks = _params.getInt(CASCADE_BLOCKS_KEY);
+    _cascadeMaxMissRate = _params.getFloat(CASCADE_MISS_RATE_KEY);
+
+    int blockLength = (_blockSize.width / _cellSize.width) * (_blockSize.height / _cellSize.height) * _nbins;
+    int dsize = HOGDescriptor(_winSize,_blockSize,_blockStride,_cellSize,_nbins).getDescriptorSize();
+
+    vector<vector<float> > detectors(svms.size());
+    _models.resize(svms.size());
+    for(int m = 0; m < svms.size(); m++)
+    {
+        ClassModel &model = _models[m];
+        model.svm = svms[m];
+        model.linear = (svms[m]->getKernelType() == LINEAR);
+        model.category = categories.empty() ? "" : categories[m];
+        model.cascadeThreshold = UNCALIBRATED_CASCADE_THRESHOLD;
+        model.stackedRow = -1;
+        model.projection = projections.empty() ? NULL : projections[m];
+
+        // The primal weights of a kernel model (the sum of alpha*SV) are not its decision function,
+        // so kernel models have no partial score and the cascade keeps all their windows
+        if(!model.linear)
+            continue;
+
+        detectors[m] = svms[m]->getDetector();
+        if(model.projection != NULL)
+        {
+            // A linear model over projected features is a linear model over the descriptors
+            detectors[m] = model.projection->foldDetector(detectors[m]);
+            model.projection = NULL;
+        }
+        model.scorer = LinearBlockScorer(detectors[m], blockLength);
+        model.cascadeThreshold = cascadeThreshold(model.category, svms.size() == 1);
 
-    HOGDescriptor hog(_winSize,_blockSize,_blockStride,_cellSize,_nbins);
-    hog.setSVMDetector(_svmDetector);
+        // Trailing features that are zero in every support vector have no weight
+        if((int)detectors[m].size() - 1 <= dsize)
+            _stackedModels.push_back(m);
+    }
 
-    vector<Point> hits;
-    vector<Point> locations;
-    vector<double> weights;
-
-    float hitThreshold = -1;
-
-
-    // vector<Rect> f;
-    // vector<double> w;
-    // hog.detectMultiScale(img, f, w, hitThreshold, Size(32,32), Size(0,0), 1.05,6);
-    // for(int i = 0; i < f.size(); i++)
-    // {
-    //     Detection det(f[i],w[i]);
-    //     found.push_back(det);
-    //     cout << det << endl;
-    //     // if(w[i] > hitThreshold)
-    //     // {
-    //     //     Detection det(f[i],w[i]);
-    //     //     found.push_back(det);
-    //     //     cout << det << endl;
-    //     // }
-    // }
-
-    detect(img,hits,weights,hitThreshold,Size(16,16),Size(0,0),locations, &hog);
-    //HOGDescriptor::detect(img,hits,weights,0.0,Size(8,8),Size(32,32),locations);
-    for(int i = 0; i < hits.size(); i++)
+    if(_stackedModels.size() < 2)
+    {
+        _stackedModels.clear();
+        return;
+    }
+
+    _stackedWeights = Mat::zeros(_stackedModels.size(), dsize, CV_32F);
+    _stackedBias.resize(_stackedModels.size());
+    for(int j = 0; j < _stackedModels.size(); j++)
     {
-        Rect r(hits[i],Size(64,128));
-        Detection det(r,weights[i]);
-        found.push_back(det);
-        cout << det << endl;
+        const vector<float> &detector = detectors[_stackedModels[j]];
+        float *row = _stackedWeights.ptr<float>(j);
+        for(int k = 0; k < detector.size() - 1; k++)
+            row[k] = detector[k];
+        _stackedBias[j] = detector.back();
+        _models[_stackedModels[j]].stackedRow = j;
     }
 
-    // // cout << found.size() << endl;
-    // // groupRectangles(found, 2, 0.2);
-    // // cout << found.size() << endl;
+    LOG(INFO) << _stackedModels.size() << " of " << _models.size() << " models scored with one stacked product";
+}
+
+ObjectDetector::~ObjectDetector()
+{
+}
+
+double ObjectDetector::cascadeThreshold(const std::string &category, bool single) const
+{
+    if(!category.empty()) {
+        ParametersMap::const_iterator it = _params.find(CASCADE_THRESHOLD_KEY "_" + category);
+        if(it != _params.end())
+            return atof(it->second.c_str());
+    }
+
+    // The shared threshold belongs to the single model it was calibrated for
+    if(single)
+        return _params.getFloat(CASCADE_THRESHOLD_KEY);
+
+    if(_cascade)
+        LOG(WARNING) << "No cascade threshold calibrated for class " << category << ", the cascade keeps all its windows";
+    return UNCALIBRATED_CASCADE_THRESHOLD;
+}
+
+ParametersMap ObjectDetector::getDefaultParameters()
+{
+    ParametersMap params = NonMaximaSuppression::getDefaultParameters();
+    params.set(HIT_THRESHOLD_KEY, 0.0);
+    params.set(EARLY_EXIT_KEY, 1);
+    params.set(SCAN_MODE_KEY, "dense");
+    params.set(CASCADE_COARSE_FACTOR_KEY, 2);
+    params.set(CASCADE_BLOCKS_KEY, 16);
+    params.set(CASCADE_THRESHOLD_KEY, UNCALIBRATED_CASCADE_THRESHOLD); // Accept everything until calibrated
+    params.set(CASCADE_MISS_RATE_KEY, 0.01);
+    return params;
+}
+
+void ObjectDetector::getDetections(const Mat& img, vector<Detection>& found) const
+{
+    vector<vector<Detection> > perModel;
+    getDetections(img, perModel);
+    found.swap(perModel[0]);
+}
 
-    cout << "Detecting on upper pyramid" << endl;
+void ObjectDetector::getDetections(const Mat& img, vector<vector<Detection> >& found) const
+{
+    found.assign(_models.size(), vector<Detection>());
+
+    detectLevel(img, Size(16,16), 1, found);
+
+    VLOG(2) << "Detecting on upper pyramid";
     Mat imgDown;
-    hits.clear();
-    locations.clear();
-    weights.clear();
     pyrDown(img,imgDown,Size(img.cols/2,img.rows/2));
-    detect(imgDown,hits,weights,hitThreshold,Size(8,8),Size(0,0),locations, &hog);
-    for(int j = 0; j < hits.size(); j++)
+    detectLevel(imgDown, Size(8,8), 2, found);
+
+    for(int m = 0; m < found.size(); m++)
+        _nms(found[m]);
+}
+
+void ObjectDetector::detectLevel(const Mat& img, Size winStride, int scale, vector<vector<Detection> >& found) const
+{
+    TRACE_SCOPE("detect_level");
+
+    // The windows of a level and their descriptors are computed once for all the models
+    vector<Point> locations;
+    vector<float> descriptors;
+
+    if(_cascade)
+    {
+        cascadeWindows(img, winStride, locations, descriptors);
+    }
+    else
+    {
+        windowLocations(img, winStride, locations);
+        if(!locations.empty())
+            computeDescriptors(img, locations, descriptors);
+    }
+
+    if(locations.empty()) return;
+    int dsize = descriptors.size() / locations.size();
+
+    vector<vector<int> > hits(_models.size());
+    vector<vector<double> > scores(_models.size());
+    scoreWindows(&descriptors[0], locations.size(), dsize, hits, scores);
+
+    for(int m = 0; m < _models.size(); m++)
     {
-        Rect r(Point(hits[j].x*2,hits[j].y*2),Size(64*2,128*2));
-        Detection det(r,weights[j]);
-        found.push_back(det);
-        cout << det << endl;
-    }
-
-    // cout << "Detecting on lower pyramid" << endl;
-    // Mat imgUp;
-    // hits.clear();
-    // locations.clear();
-    // weights.clear();
-    // pyrUp(img,imgUp,Size(img.cols*2,img.rows*2));
-    // detect(imgUp,hits,weights,hitThreshold,Size(32,32),Size(0,0),locations, &hog);
-    // for(int j = 0; j < hits.size(); j++)
-    // {
-    //     Rect r(Point(hits[j].x/2,hits[j].y/2),Size(64/2,128/2));
-    //     found.push_back(r);
-    //     cout << r << " score: " << weights[j] << endl;
-    // }
-    
-    //groupRectangles(found,weights,4,0.2);
-
-    //HOGDescriptor::detectMultiScale(img,found, 0, Size(8,8), Size(32,32), 1.05, 3,true);
-}
-
-void ObjectDetector::detect(const Mat& img, vector<Point>& hits, vector<double>& weights, 
-        double hitThreshold, Size winStride, Size padding, const vector<Point>& locations, HOGDescriptor* hog)
+        for(int i = 0; i < hits[m].size(); i++)
+        {
+            const Point &p = locations[hits[m][i]];
+            Rect r(Point(p.x*scale,p.y*scale),Size(_winSize.width*scale,_winSize.height*scale));
+            Detection det(r,scores[m][i]);
+            found[m].push_back(det);
+            VLOG(3) << det;
+        }
+    }
+}
+
+void ObjectDetector::cascadeWindows(const Mat& img, Size winStride, vector<Point>& refined, vector<float>& descriptors) const
 {
-    for(int i = 0; i < img.cols-_winSize.width; i=i+winStride.width)
+    refined.clear();
+
+    // Number of windows along each axis on the fine grid
+    int cols = std::max((img.cols - _winSize.width + winStride.width - 1) / winStride.width, 0);
+    int rows = std::max((img.rows - _winSize.height + winStride.height - 1) / winStride.height, 0);
+    if(cols == 0 || rows == 0) return;
+
+    // First stage: partial linear score over the highest energy blocks on the coarse grid
+    Size coarseStride(winStride.width*_coarseFactor, winStride.height*_coarseFactor);
+    vector<Point> coarse;
+    windowLocations(img, coarseStride, coarse);
+    if(coarse.empty()) return;
+
+    computeDescriptors(img, coarse, descriptors);
+    int dsize = descriptors.size() / coarse.size();
+
+    // Second stage: fine grid around the windows that survived for any of the models, every
+    // fine window is evaluated once even when it is close to several promising coarse windows
+    vector<uchar> visited(cols*rows, 0);
+    for(int k = 0; k < coarse.size(); k++)
     {
-        for(int j = 0; j < img.rows-_winSize.height; j=j+winStride.height)
+        bool promising = false;
+        for(int m = 0; m < _models.size() && !promising; m++)
+            promising = !_models[m].linear ||
+                        _models[m].scorer.partialScore(&descriptors[k*dsize], _cascadeBlocks) >= _models[m].cascadeThreshold;
+        if(!promising)
+            continue;
+
+        int ci = coarse[k].x / winStride.width;
+        int cj = coarse[k].y / winStride.height;
+        for(int dj = 1 - _coarseFactor; dj < _coarseFactor; dj++)
+        {
+            for(int di = 1 - _coarseFactor; di < _coarseFactor; di++)
+            {
+                int fi = ci + di, fj = cj + dj;
+                if(fi < 0 || fj < 0 || fi >= cols || fj >= rows || visited[fj*cols + fi]) continue;
+                visited[fj*cols + fi] = 1;
+                refined.push_back(Point(fi*winStride.width, fj*winStride.height));
+            }
+        }
+    }
+
+    if(refined.empty()) return;
+
+    computeDescriptors(img, refined, descriptors);
+}
+
+void ObjectDetector::scoreWindows(const float *descriptors, int nWindows, int dsize, vector<vector<int> >& hits,
+                                  vector<vector<double> >& scores) const
+{
+    // Stacked linear models: the scores of every class and window come out of one product
+    bool stacked = !_stackedModels.empty() && dsize == _stackedWeights.cols;
+    if(stacked)
+    {
+        Mat windows(nWindows, dsize, CV_32F, (void*)descriptors);
+        Mat batchScores;
+        gemm(windows, _stackedWeights, 1, Mat(), 0, batchScores, GEMM_2_T);
+
+        for(int k = 0; k < nWindows; k++)
         {
-            Rect r(Point(i,j),_winSize);
-            Mat patch = img(r);
-            vector<float> patchWeights;
-            hog->compute(patch, patchWeights, Size(8,8), Size(0,0));
-
-            vector<float> features;
-            int num_features = patchWeights.size();
-            accumulator_set<float, stats<tag::max, tag::min> > acc;
-            for(int k = 0; k < num_features; ++k)
-                acc(patchWeights[k]);
-            //float mu = boost::accumulators::mean(acc);
-            //float std = sqrt(moment<2>(acc));
-            float xmax = boost::accumulators::max(acc);
-            float xmin = boost::accumulators::min(acc);
-
-            for(int i = 0; i < num_features; i++)
+            const float *row = batchScores.ptr<float>(k);
+            for(int j = 0; j < _stackedModels.size(); j++)
             {
-                //features.push_back((patchWeights[i]-mu)/std);
-                features.push_back((patchWeights[i]-xmin)/(xmax-xmin));
-                //cout << features[i] << endl;
+                double score = row[j] + _stackedBias[j];
+                if(score > _hitThreshold)
+                {
+                    hits[_stackedModels[j]].push_back(k);
+                    scores[_stackedModels[j]].push_back(score);
+                }
             }
+        }
+    }
+
+    // Remaining models share the same descriptor buffer
+    for(int m = 0; m < _models.size(); m++)
+    {
+        if(stacked && _models[m].stackedRow >= 0) continue;
+
+        // Kernel models trained on projected features score the projected batch
+        const float *features = descriptors;
+        int featureSize = dsize;
+        Mat projected;
+        if(_models[m].projection != NULL)
+        {
+            _models[m].projection->project(Mat(nWindows, dsize, CV_32F, (void*)descriptors), projected);
+            features = projected.ptr<float>(0);
+            featureSize = projected.cols;
+        }
 
+        for(int k = 0; k < nWindows; k++)
+        {
             double score;
-            float predictedLabel = _svm.predictLabel(features,score);
-            if(predictedLabel > 0) //&& score > hitThreshold)
+            if(scoreWindow(_models[m], features + k*featureSize, featureSize, score))
             {
-                hits.push_back(Point(i,j));
-                weights.push_back(score);
+                hits[m].push_back(k);
+                scores[m].push_back(score);
             }
         }
     }
-    
 }
 
-void ObjectDetector::groupRectangles(vector<cv::Rect>& rectList, vector<double>& weights, int groupThreshold, double eps)
+void ObjectDetector::windowLocations(const Mat& img, Size winStride, vector<Point>& locations) const
 {
-    cout << "Grouping rectangles" << endl;
-    if( groupThreshold <= 0 || rectList.empty() )
+    locations.clear();
+    for(int i = 0; i < img.cols-_winSize.width; i=i+winStride.width)
+        for(int j = 0; j < img.rows-_winSize.height; j=j+winStride.height)
+            locations.push_back(Point(i,j));
+}
+
+void ObjectDetector::computeDescriptors(const Mat& img, const vector<Point>& locations, vector<float>& descriptors) const
+{
+    TRACE_SCOPE("hog_level");
+
+    // Every window is cropped into a local image like the training samples (see FeatureExtractor),
+    // so the gradients at its border don't see the pixels around it
+    HOGDescriptor hog(_winSize,_blockSize,_blockStride,_cellSize,_nbins);
+    int dsize = hog.getDescriptorSize();
+    descriptors.resize(locations.size()*dsize);
+
+    Mat patch;
+    vector<float> feat;
+    for(int k = 0; k < locations.size(); k++)
     {
-        return;
+        img(Rect(locations[k], _winSize)).copyTo(patch);
+        hog.compute(patch, feat, Size(8,8), Size(0,0));
+        std::copy(feat.begin(), feat.end(), descriptors.begin() + k*dsize);
+        normalizeFeature(&descriptors[k*dsize], dsize);
     }
+}
 
-    CV_Assert(rectList.size() == weights.size());
+bool ObjectDetector::scoreWindow(const ClassModel& model, const float *feat, int dsize, double& score) const
+{
+    if(model.linear && dsize == model.scorer.getDescriptorSize())
+    {
+        float s;
+        bool hit;
+        if(_earlyExit)
+        {
+            int blocksVisited;
+            hit = model.scorer.scoreAbove(feat, _hitThreshold, s, blocksVisited);
+        }
+        else
+        {
+            s = model.scorer.score(feat);
+            hit = s > _hitThreshold;
+        }
+        score = s;
+        return hit;
+    }
 
-    vector<int> labels;
-    int nclasses = partition(rectList, labels, SimilarRects(eps));
-    cout << "nclasses: " << nclasses << endl;
+    if(_earlyExit)
+        return model.svm->predictAbove(feat, dsize, _hitThreshold, score);
+
+    Feature features(feat, feat + dsize);
+    model.svm->predictLabel(features,score);
+    return score > _hitThreshold;
+}
 
-    vector<cv::Rect_<double> > rrects(nclasses);
-    vector<int> numInClass(nclasses, 0);
-    vector<double> foundWeights(nclasses, DBL_MIN);
-    int i, j, nlabels = (int)labels.size();
+void ObjectDetector::normalizeFeature(float *feat, int n)
+{
+    if(n == 0) return;
 
-    for( i = 0; i < nlabels; i++ )
+    float xmin = feat[0], xmax = feat[0];
+    for(int k = 1; k < n; ++k)
     {
-        int cls = labels[i];
-        rrects[cls].x += rectList[i].x;
-        rrects[cls].y += rectList[i].y;
-        rrects[cls].width += rectList[i].width;
-        rrects[cls].height += rectList[i].height;
-        foundWeights[cls] = cv::max(foundWeights[cls], weights[i]);
-        numInClass[cls]++;
+        xmin = std::min(xmin, feat[k]);
+        xmax = std::max(xmax, feat[k]);
     }
 
-    for( i = 0; i < nclasses; i++ )
-    {
-        // find the average of all ROI in the cluster
-        cv::Rect_<double> r = rrects[i];
-        double s = 1.0/numInClass[i];
-        rrects[i] = cv::Rect_<double>(cv::saturate_cast<double>(r.x*s),
-            cv::saturate_cast<double>(r.y*s),
-            cv::saturate_cast<double>(r.width*s),
-            cv::saturate_cast<double>(r.height*s));
+    float range = xmax - xmin;
+    for(int k = 0; k < n; ++k)
+        feat[k] = (range > 0) ? (feat[k]-xmin)/range : 0;
+}
+
+double ObjectDetector::calibrateCascade(const PascalImageDatabase &db, int model, const ParametersMap &sourceParams)
+{
+    TRACE_SCOPE("calibrate_cascade");
+
+    if(model < 0 || model >= _models.size())
+        throw std::runtime_error("ERROR: Invalid model index to calibrate the cascade");
+
+    ClassModel &classModel = _models[model];
+    if(!classModel.linear)
+        throw std::runtime_error("ERROR: Kernel models have no partial score to calibrate, the cascade keeps all their windows");
+
+    // Only the images with positives are decoded, a run of samples shares one image
+    vector<int> firsts, reductions;
+    vector<string> filenames;
+    FeatureExtractor::imageRuns(db, firsts, filenames, reductions);
+
+    vector<int> runs;
+    vector<string> runFilenames;
+    for(int r = 0; r + 1 < firsts.size(); r++) {
+        for(int i = firsts[r]; i < firsts[r + 1]; i++) {
+            if(db.getLabel(i) > 0) {
+                runs.push_back(r);
+                runFilenames.push_back(filenames[r]);
+                break;
+            }
+        }
+    }
+    if(runs.empty())
+        throw std::runtime_error("ERROR: No positive samples available to calibrate the cascade");
+
+    ImageSource images(runFilenames, CV_LOAD_IMAGE_COLOR, sourceParams);
+    vector<float> scores;
+    vector<float> shifted;
+    for(int k = 0; k < runs.size(); k++) {
+        Mat img;
+        images.next(img);
+
+        for(int i = firsts[runs[k]]; i < firsts[runs[k] + 1]; i++) {
+            if(db.getLabel(i) <= 0) continue;
+            shiftedPartialScores(classModel, img, db.getRoi(i), db.isFlipped(i), shifted);
+            scores.push_back(recoverableScore(shifted));
+        }
     }
 
-    rectList.clear();
-    weights.clear();
+    sort(scores.begin(), scores.end());
 
-    for( i = 0; i < nclasses; i++ )
-    {
-        cv::Rect r1 = rrects[i];
-        int n1 = numInClass[i];
-        double w1 = foundWeights[i];
-        cout << "n1: " << n1 << " groupThreshold: " << groupThreshold << endl;
-        // if( n1 <= groupThreshold )
-        //     continue;
-        // filter out small rectangles inside large rectangles
-        for( j = 0; j < nclasses; j++ )
-        {
-            int n2 = numInClass[j];
+    // Windows strictly below the threshold are rejected
+    int k = std::min((int)(_cascadeMaxMissRate * scores.size()), (int)scores.size() - 1);
+    classModel.cascadeThreshold = scores[k];
+    if(!classModel.category.empty())
+        _params.set(CASCADE_THRESHOLD_KEY "_" + classModel.category, classModel.cascadeThreshold);
+    if(_models.size() == 1)
+        _params.set(CASCADE_THRESHOLD_KEY, classModel.cascadeThreshold);
 
-            if( j == i || n2 <= groupThreshold )
-                continue;
+    LOG(INFO) << "Cascade threshold" << (classModel.category.empty() ? "" : " of class " + classModel.category) << ": "
+              << classModel.cascadeThreshold << " (" << k << " of " << scores.size() << " validation positives rejected by the first " << _cascadeBlocks << " blocks)";
 
-            cv::Rect r2 = rrects[j];
+    return classModel.cascadeThreshold;
+}
 
-            int dx = cv::saturate_cast<int>( r2.width * eps );
-            int dy = cv::saturate_cast<int>( r2.height * eps );
+void ObjectDetector::shiftedPartialScores(const ClassModel& model, const Mat& img, const Rect& roi, bool flipped,
+                                          vector<float>& scores) const
+{
+    // Fine grid offsets reached by refining one coarse window, in window pixels. The stride of
+    // the first pyramid level is the widest of the scan (see getDetections)
+    Size stride(16, 16);
+    int reach = _coarseFactor - 1, side = 2*reach + 1;
 
-            if( r1.x >= r2.x - dx &&
-                r1.y >= r2.y - dy &&
-                r1.x + r1.width <= r2.x + r2.width + dx &&
-                r1.y + r1.height <= r2.y + r2.height + dy &&
-                (n2 > std::max(3, n1) || n1 < 3) )
-                break;
+    HOGDescriptor hog(_winSize,_blockSize,_blockStride,_cellSize,_nbins);
+    scores.resize(side*side);
+
+    Mat patch, window;
+    vector<float> feat;
+    for(int dy = -reach; dy <= reach; dy++)
+    {
+        for(int dx = -reach; dx <= reach; dx++)
+        {
+            // The offset is scaled from the window to the sample, the borders of the image are replicated
+            Rect r(cvRound(roi.x + (double)dx*stride.width*roi.width/_winSize.width),
+                   cvRound(roi.y + (double)dy*stride.height*roi.height/_winSize.height), roi.width, roi.height);
+            Rect inside = r & Rect(0, 0, img.cols, img.rows);
+            if(inside.area() == 0)
+                throw std::runtime_error("ERROR: Sample outside of its image while calibrating the cascade");
+
+            copyMakeBorder(img(inside), patch, inside.y - r.y, r.br().y - inside.br().y,
+                           inside.x - r.x, r.br().x - inside.br().x, BORDER_REPLICATE);
+            resize(patch, window, _winSize);
+            if(flipped)
+                flip(window, window, 1);
+
+            hog.compute(window, feat, Size(8,8), Size(0,0));
+            normalizeFeature(&feat[0], feat.size());
+            scores[(dy + reach)*side + dx + reach] = model.scorer.partialScore(&feat[0], _cascadeBlocks);
         }
+    }
+}
 
-        if( j == nclasses )
+float ObjectDetector::recoverableScore(const vector<float>& shifted) const
+{
+    // With the object at phase p of the coarse grid along an axis, the coarse windows that can be
+    // refined onto it sit at offsets p and p - factor (when within reach). The object survives the
+    // first stage if the best of them passes, the positive is kept at its worst phase
+    int reach = _coarseFactor - 1, side = 2*reach + 1;
+    float worst = FLT_MAX;
+    for(int py = 0; py < _coarseFactor; py++)
+    {
+        for(int px = 0; px < _coarseFactor; px++)
         {
-            cout << "Adding r1: " << r1 << " weight: " << w1 << endl;
-            rectList.push_back(r1);
-            weights.push_back(w1);
+            float best = -FLT_MAX;
+            for(int oy = 0; oy < 2; oy++)
+            {
+                int dy = py - oy*_coarseFactor;
+                if(dy < -reach) continue;
+                for(int ox = 0; ox < 2; ox++)
+                {
+                    int dx = px - ox*_coarseFactor;
+                    if(dx < -reach) continue;
+                    best = std::max(best, shifted[(dy + reach)*side + dx + reach]);
+                }
+            }
+            worst = std::min(worst, best);
         }
     }
-}
\ No newline at end of file
+    return worst;
+}
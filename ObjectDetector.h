@@ -3,36 +3,143 @@
 
 #include "Common.h"
 #include "Detection.h"
+#include "Feature.h"
 #include "ParametersMap.h"
 #include "SupportVectorMachine.h"
+#include "NonMaximaSuppression.h"
+#include "LinearBlockScorer.h"
+#include "PrincipalComponentAnalysis.h"
 
 using namespace cv;
 
-// Class responsible for performing Non-Maxima Suppression on the response
-// pyramid generated by SupportVectorMachine
+// Class responsible for scanning the images with the SupportVectorMachine and
+// performing Non-Maxima Suppression on the windows found
 class ObjectDetector
 {
 public:
-    ObjectDetector(const SupportVectorMachine& svm);
+    //! Constructor
+    /*!
+        \param svm Trained model, it must outlive the detector
+        \param params ParametersMap containing the detector and non maxima suppression configuration
+        \param projection Projection the model was trained on (see TRAIN -k), NULL for the full features.
+               Folded into linear models, kernel models project the windows and it must outlive the detector
+        \param category Class of the model. When given, its cascade threshold is read from
+               cascade_threshold_<category> if present and calibrateCascade saves it there too
+    */
+    ObjectDetector(const SupportVectorMachine& svm, const ParametersMap &params = getDefaultParameters(),
+                   const PrincipalComponentAnalysis *projection = NULL, const std::string &category = "");
+
+    //! Constructor
+    /*!
+        Every class model scores the windows of one shared feature pyramid. Linear models
+        are stacked in one weight matrix so all their scores come out of one product per level.
+        \param svms Trained models, one per class, they must outlive the detector
+        \param params ParametersMap containing the detector and non maxima suppression configuration
+        \param projections Projection of every model or NULL, empty when no model uses one
+        \param categories Class of every model. With several models the cascade scan reads the
+               threshold of each one from cascade_threshold_<category>, so they are required then
+    */
+    ObjectDetector(const vector<const SupportVectorMachine*>& svms, const ParametersMap &params = getDefaultParameters(),
+                   const vector<const PrincipalComponentAnalysis*>& projections = vector<const PrincipalComponentAnalysis*>(),
+                   const vector<std::string>& categories = vector<std::string>());
     ~ObjectDetector();
 
-    void getDetections(Mat img, vector<Detection>& found);
-    void detect(const Mat& img, vector<Point>& hits, vector<double>& weights, double hitThreshold,
-							Size winStride, Size padding, const vector<Point>& locations, HOGDescriptor* hog);
+    //! Get default parameters
+    static ParametersMap getDefaultParameters();
+    ParametersMap getParameters() const { return _params; }
+
+    //! Number of class models scored by the detector
+    int getModelCount() const { return _models.size(); }
+
+    //! Detections of the first model
+    void getDetections(const Mat& img, vector<Detection>& found) const;
+
+    //! Detections of every model
+    /*!
+        \param found One list per model, in the order given to the constructor, each one
+               after its own non maxima suppression
+    */
+    void getDetections(const Mat& img, vector<vector<Detection> >& found) const;
+
+    //! Calibrate the rejection threshold of the cascade scan
+    /*!
+        The threshold is set so that at most cascade_max_miss_rate of the positive
+        samples are rejected by the partial score of the first stage. The scan only scores
+        the coarse grid, so every positive is cropped from its image shifted by each fine
+        grid offset the refinement of a coarse window reaches, and it counts as kept at an
+        alignment of the coarse grid when one of the coarse windows that can be refined onto
+        it passes. The positive is scored at its worst alignment. The parameters returned by
+        getParameters keep the threshold in cascade_threshold_<category> when the model has
+        a class, and also in cascade_threshold when it is the only model.
+        \param db Validation database, its positives are cropped from the images
+        \param model Index of the model the positives belong to
+        \param sourceParams Configuration of the image decoding (see ImageSource)
+    */
+    double calibrateCascade(const PascalImageDatabase &db, int model = 0,
+                            const ParametersMap &sourceParams = ImageSource::getDefaultParameters());
+
+    //! Normalization applied to every window descriptor before scoring
+    static void normalizeFeature(float *feat, int n);
+
 private:
-	// HOGDescriptor _hog;
-	// vector<float> _svmDetector;
     Size _winSize;
     Size _blockSize;
     Size _blockStride;
     Size _cellSize;
     int _nbins;
 
-    SupportVectorMachine _svm;
-    vector<float> _svmDetector;
+    // Windows scoring above _hitThreshold are reported as detections. Linear models are
+    // scored with their block scorer and kernel models with the bounded predictor of the
+    // svm, both can stop early once a window cannot reach the threshold. Only linear models
+    // take part in the first stage of the cascade scan, the windows of kernel models all
+    // go on to the fine grid
+    struct ClassModel
+    {
+        const SupportVectorMachine *svm;
+        bool linear;
+        LinearBlockScorer scorer;   // Linear models only
+        std::string category;       // Empty when unknown
+        double cascadeThreshold;    // Partial score below which a coarse window is rejected
+        int stackedRow;             // Row in _stackedWeights, -1 when scored on its own
+        const PrincipalComponentAnalysis *projection; // Applied to the windows of kernel models
+    };
+
+    vector<ClassModel> _models;
+    ParametersMap _params;
+
+    NonMaximaSuppression _nms;
+
+    double _hitThreshold;
+    bool _earlyExit;
+
+    // Linear models sharing the descriptor size, one row of primal weights each. Only
+    // used with two or more linear models, a single one keeps the early exit of its scorer
+    Mat _stackedWeights;
+    vector<float> _stackedBias;
+    vector<int> _stackedModels;     // Model index of every row
+
+    // Cascade scan
+    bool _cascade;
+    int _coarseFactor;              // Coarse stride as a multiple of the level stride
+    int _cascadeBlocks;             // Number of blocks in the partial score
+    double _cascadeMaxMissRate;     // Fraction of positives the calibration allows to reject
+
+    void initialize(const vector<const SupportVectorMachine*>& svms, const vector<const PrincipalComponentAnalysis*>& projections,
+                    const vector<std::string>& categories);
+
+    double cascadeThreshold(const std::string &category, bool single) const;
+
+    void detectLevel(const Mat& img, Size winStride, int scale, vector<vector<Detection> >& found) const;
+    void cascadeWindows(const Mat& img, Size winStride, vector<Point>& refined, vector<float>& descriptors) const;
+    void scoreWindows(const float *descriptors, int nWindows, int dsize, vector<vector<int> >& hits,
+                      vector<vector<double> >& scores) const;
 
-    void groupRectangles(vector<Rect>& rectList, vector<double>& weights, int groupThreshold, double eps);
+    void shiftedPartialScores(const ClassModel& model, const Mat& img, const Rect& roi, bool flipped, vector<float>& scores) const;
+    float recoverableScore(const vector<float>& shifted) const;
 
+    void windowLocations(const Mat& img, Size winStride, vector<Point>& locations) const;
+    void computeDescriptors(const Mat& img, const vector<Point>& locations, vector<float>& descriptors) const;
+    bool scoreWindow(const ClassModel& model, const float *feat, int dsize, double& score) const;
 };
 
-#endif // OBJECT_DETECTOR_H
\ No newline at end of file
+#endif // OBJECT_DETECTOR_H
@@ -0,0 +1,244 @@
+#include "OutOfCoreTrainer.h"
+#include "Progress.h"
+#include "Trace.h"
+
+#define OOC_MEMORY_BUDGET_KEY     "memory_budget_mb"
+#define OOC_LINEAR_SOLVER_KEY     "linear_solver"
+#define OOC_EPOCHS_KEY            "sgd_epochs"
+#define OOC_FEEDBACK_PASSES_KEY   "feedback_passes"
+#define OOC_SEED_KEY              "shuffle_seed"
+
+using namespace cv;
+using namespace std;
+
+// Computes the margin of a range of samples, every sample writes its own slot
+class MarginScanner : public cv::ParallelLoopBody
+{
+public:
+    MarginScanner(const SupportVectorMachine &svm, const FeatureStore &store, const vector<int> &samples, vector<float> &margins):
+        _svm(svm), _store(store), _samples(samples), _margins(margins)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        Feature feat(_store.getDimension());
+        for(int k = range.start; k < range.end; k++) {
+            _store.getScaledFeature(_samples[k], &feat[0]);
+            _margins[k] = (_store.getLabel(_samples[k]) > 0 ? 1 : -1) * _svm.predict(feat);
+        }
+        _store.release(_samples[range.start], _samples[range.end - 1] + 1);
+    }
+
+private:
+    const SupportVectorMachine &_svm;
+    const FeatureStore &_store;
+    const vector<int> &_samples;
+    vector<float> &_margins;
+};
+
+OutOfCoreTrainer::OutOfCoreTrainer(const ParametersMap &params)
+{
+    _memoryBudget = params.getInt(OOC_MEMORY_BUDGET_KEY);
+    _linearSolver = params.getStr(OOC_LINEAR_SOLVER_KEY);
+    _epochs = params.getInt(OOC_EPOCHS_KEY);
+    _feedbackPasses = params.getInt(OOC_FEEDBACK_PASSES_KEY);
+    _seed = params.getInt(OOC_SEED_KEY);
+
+    if(!boost::iequals(_linearSolver, "sgd") && !boost::iequals(_linearSolver, "cascade"))
+        throw std::runtime_error("ERROR: Unknown linear solver " + _linearSolver + ", expected sgd or cascade");
+}
+
+ParametersMap OutOfCoreTrainer::getDefaultParameters()
+{
+    ParametersMap params;
+    params.set(OOC_MEMORY_BUDGET_KEY, 1024);
+    params.set(OOC_LINEAR_SOLVER_KEY, "sgd");
+    params.set(OOC_EPOCHS_KEY, 10);
+    params.set(OOC_FEEDBACK_PASSES_KEY, 3);
+    params.set(OOC_SEED_KEY, 0);
+    return params;
+}
+
+int OutOfCoreTrainer::getChunkSize(const SupportVectorMachine &svm, int dim) const
+{
+    // The libsvm nodes of a sample, its label and row pointer, and the solver state (alpha, gradients...)
+    double bytesPerSample = (dim + 1) * sizeof(svm_node) + sizeof(double) + sizeof(svm_node *) + 64;
+    double available = (_memoryBudget - svm.getParameters().getInt("cache_size")) * 1048576.0;
+
+    double chunk = available / bytesPerSample;
+    if(chunk < 1000) {
+        ostringstream err;
+        err << "ERROR: A memory budget of " << _memoryBudget << " MB leaves room for less than 1000 samples of dimension "
+            << dim << " besides the kernel cache";
+        throw std::runtime_error(err.str());
+    }
+    return (int)std::min(chunk, (double)INT_MAX);
+}
+
+void OutOfCoreTrainer::train(SupportVectorMachine &svm, const FeatureStore &store) const
+{
+    vector<int> samples;
+    for(int i = 0; i < store.getSize(); i++)
+        if(store.getLabel(i) != 0) samples.push_back(i);
+    if(samples.empty())
+        throw std::runtime_error("ERROR: The feature store has no labelled samples");
+
+    LOG(INFO) << "Training on " << samples.size() << " samples of dimension " << store.getDimension()
+              << " within " << _memoryBudget << " MB";
+
+    if(svm.getKernelType() == LINEAR && boost::iequals(_linearSolver, "sgd"))
+        trainLinear(svm, store, samples);
+    else
+        trainCascade(svm, store, samples);
+}
+
+void OutOfCoreTrainer::trainLinear(SupportVectorMachine &svm, const FeatureStore &store, const std::vector<int> &samples) const
+{
+    TRACE_SCOPE("svm_train_sgd");
+
+    int n = samples.size();
+    int dim = store.getDimension();
+
+    // libsvm minimizes |w|^2 / 2 + C sum(hinge), the same minimum as lambda |w|^2 / 2 + mean(hinge)
+    double lambda = 1.0 / (svm.getParameters().getFloat("c") * n);
+
+    // Chunks of consecutive samples are visited in a shuffled order, so the pages of one are
+    // read together and dropped once it is done
+    int chunk = std::max((int)(_memoryBudget * 1048576.0 / (dim * sizeof(float))), 1);
+    int nChunks = (n + chunk - 1) / chunk;
+    RNG rng(_seed);
+
+    // Step size eta0 / (1 + lambda eta0 t) with eta0 from the mean squared norm of the first samples
+    vector<float> x(dim);
+    double meanNorm = 0;
+    int nNorm = std::min(n, 1000);
+    for(int k = 0; k < nNorm; k++) {
+        store.getScaledFeature(samples[k], &x[0]);
+        for(int j = 0; j < dim; j++) meanNorm += x[j] * x[j];
+    }
+    meanNorm = std::max(meanNorm / nNorm, 1e-6);
+    double eta0 = std::min(1.0 / meanNorm, 0.5 / lambda);
+
+    // The weights are w = wScale * v, so the shrinking of the regularization costs O(1) per sample
+    vector<double> v(dim, 0.0);
+    double wScale = 1, bias = 0;
+    int64_t t = 0;
+    for(int epoch = 0; epoch < _epochs; epoch++) {
+        ProgressTask progress("sgd_samples", n);
+
+        vector<int> chunkOrder(nChunks);
+        for(int c = 0; c < nChunks; c++) chunkOrder[c] = c;
+        std::random_shuffle(chunkOrder.begin(), chunkOrder.end(), rng);
+
+        double loss = 0;
+        for(int c = 0; c < nChunks; c++) {
+            int first = chunkOrder[c] * chunk, end = std::min(first + chunk, n);
+            vector<int> order(samples.begin() + first, samples.begin() + end);
+            std::random_shuffle(order.begin(), order.end(), rng);
+
+            for(int k = 0; k < order.size(); k++, t++) {
+                store.getScaledFeature(order[k], &x[0]);
+                double y = store.getLabel(order[k]) > 0 ? 1 : -1;
+                double eta = eta0 / (1 + lambda * eta0 * t);
+
+                double dot = 0;
+                for(int j = 0; j < dim; j++) dot += v[j] * x[j];
+                double margin = y * (wScale * dot + bias);
+
+                wScale *= 1 - eta * lambda;
+                if(margin < 1) {
+                    loss += 1 - margin;
+                    double step = eta * y / wScale;
+                    for(int j = 0; j < dim; j++) v[j] += step * x[j];
+                    // Unregularized bias with a smaller rate, as in Bottou's svmsgd
+                    bias += 0.01 * eta * y;
+                }
+
+                if(wScale < 1e-9) {
+                    for(int j = 0; j < dim; j++) v[j] *= wScale;
+                    wScale = 1;
+                }
+            }
+
+            progress.add(end - first);
+            store.release(samples[first], samples[end - 1] + 1);
+        }
+
+        double norm = 0;
+        for(int j = 0; j < dim; j++) norm += v[j] * v[j];
+        norm *= wScale * wScale;
+        LOG(INFO) << "Epoch " << epoch + 1 << " of " << _epochs << ": objective " << lambda * norm / 2 + loss / n;
+    }
+
+    vector<float> detector(dim + 1);
+    for(int j = 0; j < dim; j++) detector[j] = wScale * v[j];
+    detector[dim] = bias;
+    svm.setLinearModel(detector);
+}
+
+void OutOfCoreTrainer::trainCascade(SupportVectorMachine &svm, const FeatureStore &store, const std::vector<int> &samples) const
+{
+    TRACE_SCOPE("svm_train_cascade");
+
+    int chunk = getChunkSize(svm, store.getDimension());
+    LOG(INFO) << "Training problems of at most " << chunk << " samples";
+
+    // Chunks draw the samples in a shuffled order so every one has both classes
+    vector<int> order(samples);
+    RNG rng(_seed);
+    std::random_shuffle(order.begin(), order.end(), rng);
+
+    vector<int> supportVectors, problem;
+    int next = 0, step = 0;
+    while(next < order.size()) {
+        // At least half of every problem is new samples
+        if(supportVectors.size() > chunk / 2)
+            throw std::runtime_error("ERROR: The support vectors take more than half of the memory budget, increase it");
+
+        int nNew = std::min(chunk - (int)supportVectors.size(), (int)order.size() - next);
+        problem = supportVectors;
+        problem.insert(problem.end(), order.begin() + next, order.begin() + next + nNew);
+        next += nNew;
+
+        // Sorted samples are read sequentially from the store
+        std::sort(problem.begin(), problem.end());
+        svm.train(store, problem);
+        supportVectors = svm.getSupportVectorIndices();
+
+        LOG(INFO) << "Cascade step " << ++step << ": " << next << " of " << order.size() << " samples seen, "
+                  << supportVectors.size() << " support vectors";
+    }
+
+    // Samples left out of the last problem that violate the margin of the model are fed back
+    double tolerance = svm.getParameters().getFloat("eps");
+    for(int pass = 0; pass < _feedbackPasses; pass++) {
+        vector<float> margins(samples.size());
+        parallel_for_(Range(0, samples.size()), MarginScanner(svm, store, samples, margins));
+
+        vector<bool> inProblem(store.getSize(), false);
+        for(int k = 0; k < problem.size(); k++) inProblem[problem[k]] = true;
+
+        vector<pair<float, int> > violators;
+        for(int k = 0; k < samples.size(); k++)
+            if(!inProblem[samples[k]] && margins[k] < 1 - tolerance)
+                violators.push_back(make_pair(margins[k], samples[k]));
+
+        LOG(INFO) << "Feedback pass " << pass + 1 << ": " << violators.size() << " samples violate the margin";
+        if(violators.empty()) break;
+
+        // The worst violators when they don't all fit
+        int nNew = std::min(chunk - (int)supportVectors.size(), (int)violators.size());
+        if(nNew <= 0)
+            throw std::runtime_error("ERROR: The support vectors fill the memory budget, increase it");
+        std::nth_element(violators.begin(), violators.begin() + nNew - 1, violators.end());
+
+        problem = supportVectors;
+        for(int k = 0; k < nNew; k++) problem.push_back(violators[k].second);
+        std::sort(problem.begin(), problem.end());
+        svm.train(store, problem);
+        supportVectors = svm.getSupportVectorIndices();
+
+        LOG(INFO) << "Feedback pass " << pass + 1 << ": " << supportVectors.size() << " support vectors";
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef OUT_OF_CORE_TRAINER_H
+#define OUT_OF_CORE_TRAINER_H
+
+#include "Common.h"
+#include "ParametersMap.h"
+#include "FeatureStore.h"
+#include "SupportVectorMachine.h"
+
+//! Out Of Core Trainer Class
+/*!
+    This class trains a SVM on a FeatureStore that doesn't fit in memory. The samples are streamed
+    from the store in chunks and the memory taken by the training problem stays under a budget.
+
+    Linear models are trained by stochastic gradient descent on the same objective as libsvm, the
+    weights are the only state and every epoch makes one pass over the store in shuffled chunks.
+
+    Kernel models are trained with a cascade: the support vectors found so far are merged with the
+    next chunk of samples and the problem is solved again, so only the support vectors are carried
+    from one chunk to the next. Once every chunk has been seen, feedback passes scan the whole store
+    and train again with the samples that violate the margin of the model, until none does.
+*/
+class OutOfCoreTrainer
+{
+public:
+    //! Constructor
+    /*!
+        \param params Memory budget and solver settings, see getDefaultParameters
+    */
+    OutOfCoreTrainer(const ParametersMap &params = getDefaultParameters());
+
+    static ParametersMap getDefaultParameters();
+
+    //! Train svm, configured with its parameters, on every labelled sample of the store
+    void train(SupportVectorMachine &svm, const FeatureStore &store) const;
+
+    //! Largest number of samples whose training problem fits the memory budget
+    int getChunkSize(const SupportVectorMachine &svm, int dim) const;
+
+private:
+    int _memoryBudget;      // MB
+    std::string _linearSolver;
+    int _epochs;
+    int _feedbackPasses;
+    int _seed;
+
+    void trainLinear(SupportVectorMachine &svm, const FeatureStore &store, const std::vector<int> &samples) const;
+    void trainCascade(SupportVectorMachine &svm, const FeatureStore &store, const std::vector<int> &samples) const;
+};
+
+#endif // OUT_OF_CORE_TRAINER_H
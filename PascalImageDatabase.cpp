@@ -4,6 +4,8 @@
 
 #include "PascalAnnotation.h"
 #include "PascalImageDatabase.h"
+#include "ImageList.h"
+#include "Trace.h"
 
 using namespace std;
 using namespace cv;
@@ -11,19 +13,20 @@ using namespace cv;
 //Pascal Image Database class
 
 PascalImageDatabase::PascalImageDatabase():
-    _positivesCount(0), _negativesCount(0)
+    _positivesCount(0), _negativesCount(0), _index(NULL)
 {
 }
 
-PascalImageDatabase::PascalImageDatabase(const char *dbFilename, string category):
-    _positivesCount(0), _negativesCount(0)
+PascalImageDatabase::PascalImageDatabase(const char *dbFilename, string category, const AnnotationIndex *index,
+                                         const VocPaths &paths):
+    _positivesCount(0), _negativesCount(0), _index(index), _paths(paths)
 {
     _category = category;
     load(dbFilename);
 }
 
 PascalImageDatabase::PascalImageDatabase(const vector<float> &labels, const vector<string> &filenames):
-    _positivesCount(0), _negativesCount(0)
+    _positivesCount(0), _negativesCount(0), _index(NULL)
 {
     _labels = labels;
     _filenames = filenames;
@@ -34,16 +37,45 @@ PascalImageDatabase::PascalImageDatabase(const vector<float> &labels, const vect
     }
 }
 
-bool PascalImageDatabase::getROI(string imageName, vector<Rect>& rois, vector<float>& roiLabels)
+// Generates the samples of a range of image list entries, every entry writes its own slot
+class PascalDatabaseLoader : public ParallelLoopBody
 {
-    vector<string> parts;
-    boost::split(parts,imageName,boost::is_any_of("/."),boost::token_compress_on);
+public:
+    PascalDatabaseLoader(const PascalImageDatabase &db, const ImageList &list, vector<PascalImageDatabase::ListSamples> &samples):
+        _db(db), _list(list), _samples(samples)
+    {
+    }
+
+    void operator()(const Range &range) const
+    {
+        for(int k = range.start; k < range.end; k++) {
+            // Exceptions can't cross the worker threads, they are raised again after the merge
+            try {
+                _db.loadSamples(_list.getName(k), _list[k].label, _samples[k]);
+            } catch(std::exception &err) {
+                _samples[k].error = err.what();
+            }
+        }
+    }
 
-    string annotationsPath = "/Users/david/Documents/Development/VOC2007/VOCdevkit/VOC2007/Annotations/";
-    string annotationsFilename = annotationsPath + parts[parts.size()-2] + ".xml";
+private:
+    const PascalImageDatabase &_db;
+    const ImageList &_list;
+    vector<PascalImageDatabase::ListSamples> &_samples;
+};
 
+bool PascalImageDatabase::getROI(const string &imageId, vector<Rect>& rois, vector<float>& roiLabels, Size& imageSize) const
+{
     pascal_annotation annotation;
-    annotation.load(annotationsFilename);
+    if(_index != NULL) {
+        if(!_index->find(imageId, annotation))
+            throw std::runtime_error("ERROR: Image " + imageId + " is not in the annotation index");
+    } else {
+        annotation.load(_paths.getAnnotationFilename(imageId));
+    }
+
+    // The annotated size avoids decoding the image just to know its dimensions
+    imageSize = Size(annotation.size.width, annotation.size.height);
 
     //Mat img = imread(imageName,1);
     //cout << "Obtaining annotations from: " << imageName << endl;
@@ -116,99 +148,100 @@ bool PascalImageDatabase::getROI(string imageName, vector<Rect>& rois, vector<fl
     return true;
 }
 
+void PascalImageDatabase::loadSamples(const string &imageId, float label, ListSamples &samples) const
+{
+    samples.positivesCount = 0;
+    samples.negativesCount = 0;
+
+    vector<Rect> roi;
+    vector<float> roiLabels;
+    Size imageSize;
+    if(getROI(imageId, roi, roiLabels, imageSize) == false)
+        return;
+
+    if(label > 0)
+    {
+        for(int i = 0; i < roi.size(); ++i)
+        {
+            samples.labels.push_back(roiLabels[i]);
+            samples.rois.push_back(roi[i]);
+            samples.flipped.push_back(false);
+
+            if(roiLabels[i] > 0)
+            {
+                // Add a flipped image
+                samples.labels.push_back(roiLabels[i]);
+                samples.rois.push_back(roi[i]);
+                samples.flipped.push_back(true);
+
+                samples.positivesCount++;
+            }
+
+            if(roiLabels[i] < 0) samples.negativesCount++;
+            else if(roiLabels[i] > 0) samples.positivesCount++;
+        }
+    }
+    if(label < 0)
+    {
+        if(imageSize.width <= 64 || imageSize.height <= 128)
+        {
+            // Too small for a random cut, use the first annotated object instead
+            if(!roi.empty())
+            {
+                samples.labels.push_back(-1);
+                samples.rois.push_back(roi[0]);
+                samples.flipped.push_back(false);
+                samples.negativesCount++;
+            }
+        }
+        else
+        {
+            // Get the random negatives, the same cuts are generated whatever the thread or list order
+            RNG rng(imageSeed(imageId));
+            for(int i = 0; i < 10; i++)
+            {
+                int x = rng.uniform(0, imageSize.width-64);
+                int y = rng.uniform(0, imageSize.height-128);
+
+                samples.labels.push_back(-1);
+                samples.rois.push_back(Rect(x,y,64,128));
+                samples.flipped.push_back(false);
+                samples.negativesCount++;
+            }
+        }
+    }
+}
+
 void PascalImageDatabase::load(const char *dbFilename)
 {
-    string imagePath = "/Users/david/Documents/Development/VOC2007/VOCdevkit/VOC2007/JPEGImages/";
+    TRACE_SCOPE("database_load");
 
     _dbFilename = string(dbFilename);
 
     _negativesCount = 0;
     _positivesCount = 0;
 
-    ifstream f(dbFilename);
     LOG(INFO) << "Loading the database";
-    if(!f.is_open()) {
-        throw std::runtime_error("ERROR: Could not open file " + _dbFilename + " for reading");
-    }
-    else{
-        string line;
-        int i = 0;
-        while(getline(f,line)){
-            if(i > 10)
-                break;
-            vector<string> parts;
-            boost::split(parts,line,boost::is_any_of(" "),boost::token_compress_on);
-
-            float label = atof(parts[1].c_str());
-            string imageName = imagePath + parts[0] + ".jpg";
-
-            vector<Rect> roi;
-            vector<float> roiLabels;
-            if(getROI(imageName, roi, roiLabels) == true)
-            {
-                Mat img = imread(imageName, CV_LOAD_IMAGE_GRAYSCALE);
-
-                if(label > 0)
-                {
-                    for(int i = 0; i < roi.size(); ++i) 
-                    {
-                        //Mat roiImg = img(roi[i]);
-                        _filenames.push_back(imageName);
-                        _labels.push_back(roiLabels[i]);
-                        _rois.push_back(roi[i]);
-                        _flipped.push_back(false);
-
-                        if(roiLabels[i] > 0)
-                        {
-                            // Add a flipped image
-                            _filenames.push_back(imageName);
-                            _labels.push_back(roiLabels[i]);
-                            _rois.push_back(roi[i]);
-                            _flipped.push_back(true);
-
-                            _positivesCount++;
-                        }  
-
-                        if(roiLabels[i] < 0) _negativesCount++;
-                        else if(roiLabels[i] > 0) _positivesCount++;
-                    }
-                }
-                if(label < 0)
-                {
-                    //Get the random negatives
-                    for(int i = 0; i < 10; i++)
-                    {
-                        _filenames.push_back(imageName);
-                        _labels.push_back(-1);
-
-                        if(img.cols <= 64 || img.rows <= 128){
-                            _rois.push_back(roi[i]);
-                            _flipped.push_back(false);
-                            _negativesCount++;
-                            i = 10;
-                        }
-                        else
-                        {
-                            int x = rand() % (img.cols-64);
-                            int y = rand() % (img.rows-128);
-                            Rect r(x,y,64,128);
-
-                            _rois.push_back(r);
-                            _flipped.push_back(false);
-
-                            _negativesCount++;
-
-                        }
-                        
-                    }
-                }
-
-                img.release();
-                //i++;
-            }
-        }
+    ImageList list(_dbFilename);
+
+    vector<ListSamples> samples(list.getSize());
+    parallel_for_(Range(0, list.getSize()), PascalDatabaseLoader(*this, list, samples));
+
+    // Merge in file order
+    for(int k = 0; k < samples.size(); k++)
+    {
+        if(!samples[k].error.empty())
+            throw std::runtime_error(samples[k].error);
+
+        string imageName = _paths.getImageFilename(list.getName(k));
+        _filenames.insert(_filenames.end(), samples[k].labels.size(), imageName);
+        _labels.insert(_labels.end(), samples[k].labels.begin(), samples[k].labels.end());
+        _rois.insert(_rois.end(), samples[k].rois.begin(), samples[k].rois.end());
+        _flipped.insert(_flipped.end(), samples[k].flipped.begin(), samples[k].flipped.end());
+
+        _positivesCount += samples[k].positivesCount;
+        _negativesCount += samples[k].negativesCount;
     }
-    f.close();
 }
 
 void PascalImageDatabase::save(const char *dbFilename)
@@ -2,6 +2,8 @@
 #define PASCAL_IMAGE_DATABASE_H
 
 #include "Common.h"
+#include "AnnotationIndex.h"
+#include "VocPaths.h"
 
 using namespace std;
 
@@ -30,7 +32,28 @@ private:
     // centered and of the same size in all images)
     vector<cv::Rect> _rois;
 
-    bool getROI(string imageName, vector<cv::Rect>& rois, vector<float>& roiLabels);
+    // Optional binary index used instead of the XML annotations
+    const AnnotationIndex *_index;
+
+    // Location of the annotations and images of the lists
+    VocPaths _paths;
+
+    bool getROI(const string &imageId, vector<cv::Rect>& rois, vector<float>& roiLabels, cv::Size& imageSize) const;
+
+    // Samples generated by one entry of the image list, filled concurrently by PascalDatabaseLoader
+    struct ListSamples
+    {
+        vector<cv::Rect> rois;
+        vector<float> labels;
+        vector<bool> flipped;
+        int positivesCount;
+        int negativesCount;
+        string error;
+    };
+
+    void loadSamples(const string &imageId, float label, ListSamples &samples) const;
+
+    friend class PascalDatabaseLoader;
 
 
 public:
@@ -39,9 +62,12 @@ public:
     
     //! Constructor
     /*!
-        This constructor takes the filename of the database to use and the name of the category that will be trained
+        This constructor takes the filename of the database to use and the name of the category that will be trained.
+        When an annotation index is given the annotations are read from it instead of the XML files, the index
+        must outlive the database. The image ids of the list are resolved under the given dataset root.
     */
-    PascalImageDatabase(const char *dbFilename, const string category);
+    PascalImageDatabase(const char *dbFilename, const string category, const AnnotationIndex *index = NULL,
+                        const VocPaths &paths = VocPaths());
 
     //! Constructor
     /*!
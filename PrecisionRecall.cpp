@@ -1,29 +1,66 @@
 #include "PrecisionRecall.h"
+#include "Trace.h"
 
 using namespace std;
 
-static void computePrecisionRecallForThreshold(const vector<float> &gt, const vector<float>& preds, 
-	                               float threshold, int nGroundTruthDetections, float& precision, float& recall)
+// Prediction and ground truth label of a sample
+typedef std::pair<float, float> ScoredLabel;
+
+static bool sortByScore(const ScoredLabel& a, const ScoredLabel& b)
+{
+	return a.first < b.first;
+}
+
+// Sorts or merges consecutive chunks of a vector, one chunk per iteration
+class ChunkSorter : public cv::ParallelLoopBody
 {
-	// Compute tp, fp, fn, tn
-	int truePos = 0, trueNeg = 0, falsePos = 0, falseNeg = 0;
-	for(int i = 0; i < preds.size(); i++) {
-		if(preds[i] > threshold) {
-			if(gt[i] > 0) truePos++;
-			else falsePos++;
-		} else if(preds[i] <= threshold) {
-			if(gt[i] < 0) trueNeg++;
-			else falseNeg++;			
+public:
+	ChunkSorter(std::vector<ScoredLabel>& data, int chunkSize, bool merge):
+		_data(data), _chunkSize(chunkSize), _merge(merge)
+	{
+	}
+
+	void operator()(const cv::Range& range) const
+	{
+		for(int c = range.start; c < range.end; c++) {
+			size_t first = (size_t)c * _chunkSize;
+			size_t last = std::min(first + _chunkSize, _data.size());
+			if(first >= last) continue;
+
+			if(_merge) {
+				// Each chunk is made of two sorted halves
+				size_t middle = std::min(first + _chunkSize / 2, last);
+				std::inplace_merge(_data.begin() + first, _data.begin() + middle, _data.begin() + last, sortByScore);
+			} else {
+				std::sort(_data.begin() + first, _data.begin() + last, sortByScore);
+			}
 		}
 	}
 
-	if(truePos + falsePos == 0) precision = 1.0;
-	else precision = float(truePos) / (truePos + falsePos);
+private:
+	std::vector<ScoredLabel>& _data;
+	int _chunkSize;
+	bool _merge;
+};
 
-	int nGt = (nGroundTruthDetections >= 0)? nGroundTruthDetections:(truePos + falseNeg);
+// Sorts chunks in parallel and merges them pairwise, also in parallel
+static void parallelSortByScore(std::vector<ScoredLabel>& data)
+{
+	const int minChunkSize = 1 << 16;
+	int nThreads = std::max(cv::getNumThreads(), 1);
+	if(data.size() < 2 * (size_t)minChunkSize || nThreads == 1) {
+		std::sort(data.begin(), data.end(), sortByScore);
+		return;
+	}
+
+	int nChunks = std::min(nThreads, (int)(data.size() / minChunkSize));
+	int chunkSize = (data.size() + nChunks - 1) / nChunks;
+	cv::parallel_for_(cv::Range(0, nChunks), ChunkSorter(data, chunkSize, false));
 
-	if(truePos + falseNeg == 0) recall = 1.0;
-	else recall = float(truePos) / nGt;
+	for(; nChunks > 1; nChunks = (nChunks + 1) / 2) {
+		chunkSize *= 2;
+		cv::parallel_for_(cv::Range(0, (nChunks + 1) / 2), ChunkSorter(data, chunkSize, true));
+	}
 }
 
 bool sortByRecall(const PrecisionRecallPoint& a, const PrecisionRecallPoint& b)
@@ -33,17 +70,72 @@ bool sortByRecall(const PrecisionRecallPoint& a, const PrecisionRecallPoint& b)
 
 PrecisionRecall::PrecisionRecall(const std::vector<float> &gt, const std::vector<float>& preds, int nGroundTruthDetections)
 {
-	std::set<float> thresholds;
-	for (int i = 0; i < preds.size(); ++i) {
-		thresholds.insert(preds[i]);
+	TRACE_SCOPE("precision_recall");
+
+	// Every distinct prediction is a threshold, samples scoring strictly above it are detections.
+	// Sorting the predictions once lets all the thresholds be evaluated with running counts.
+	std::vector<ScoredLabel> scored;
+	scored.reserve(preds.size());
+	for (int i = 0; i < preds.size(); ++i)
+		scored.push_back(ScoredLabel(preds[i], gt[i]));
+	parallelSortByScore(scored);
+
+	std::vector<PrecisionRecallCounts> counts;
+	for(int i = 0; i < scored.size(); ) {
+		PrecisionRecallCounts c;
+		c.score = scored[i].first;
+		c.positives = c.unlabeled = c.negatives = 0;
+		for(; i < scored.size() && scored[i].first == c.score; i++) {
+			if(scored[i].second > 0) c.positives++;
+			else if(scored[i].second < 0) c.negatives++;
+			else c.unlabeled++;
+		}
+		counts.push_back(c);
+	}
+
+	compute(counts, nGroundTruthDetections);
+}
+
+PrecisionRecall::PrecisionRecall(const std::vector<PrecisionRecallCounts>& counts, int nGroundTruthDetections)
+{
+	TRACE_SCOPE("precision_recall");
+
+	compute(counts, nGroundTruthDetections);
+}
+
+void PrecisionRecall::compute(const std::vector<PrecisionRecallCounts>& counts, int nGroundTruthDetections)
+{
+	int nPositives = 0, nUnlabeled = 0, nNegatives = 0;
+	for(int i = 0; i < counts.size(); i++) {
+		nPositives += counts[i].positives;
+		nUnlabeled += counts[i].unlabeled;
+		nNegatives += counts[i].negatives;
 	}
 
 	_data.resize(0);
 
-	for(std::set<float>::iterator th = thresholds.begin(); th != thresholds.end(); th++) {
+	// Samples scoring at or below the current threshold
+	int positivesBelow = 0, unlabeledBelow = 0, negativesBelow = 0;
+	for(int i = 0; i < counts.size(); i++) {
+		positivesBelow += counts[i].positives;
+		unlabeledBelow += counts[i].unlabeled;
+		negativesBelow += counts[i].negatives;
+
+		// Unlabeled samples count as false positives above the threshold and false negatives below it
+		int truePos = nPositives - positivesBelow;
+		int falsePos = (nUnlabeled - unlabeledBelow) + (nNegatives - negativesBelow);
+		int falseNeg = positivesBelow + unlabeledBelow;
+
 		PrecisionRecallPoint pr;
-		computePrecisionRecallForThreshold(gt, preds, *th, nGroundTruthDetections, pr.precision, pr.recall); 
-		pr.threshold = *th;
+		if(truePos + falsePos == 0) pr.precision = 1.0;
+		else pr.precision = float(truePos) / (truePos + falsePos);
+
+		int nGt = (nGroundTruthDetections >= 0)? nGroundTruthDetections:(truePos + falseNeg);
+
+		if(truePos + falseNeg == 0) pr.recall = 1.0;
+		else pr.recall = float(truePos) / nGt;
+
+		pr.threshold = counts[i].score;
 
 		_data.push_back(pr);
 	}
@@ -59,6 +151,7 @@ PrecisionRecall::PrecisionRecall(const std::vector<float> &gt, const std::vector
 
 	// Compute average precision as area under the curve
 	_averagePrecision = 0.0;
+	if(_data.empty()) return;
 	for(std::vector<PrecisionRecallPoint>::iterator pr = _data.begin() + 1, prPrev = _data.begin(); pr != _data.end(); pr++, prPrev++) {
 		float xdiff = pr->recall - prPrev->recall;
 		float ydiff = pr->precision - prPrev->precision;
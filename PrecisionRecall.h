@@ -8,6 +8,12 @@ typedef struct {
 	float precision, recall, threshold;
 } PrecisionRecallPoint;
 
+//! Number of positive, unlabeled and negative samples sharing one prediction
+typedef struct {
+	float score;
+	int positives, unlabeled, negatives;
+} PrecisionRecallCounts;
+
 //! Precision Recall Class
 /*!
     This class computes and stores a precision recall curve
@@ -21,6 +27,8 @@ private:
 	//! Average precision calculated for the current curve
 	float _averagePrecision;
 
+	void compute(const std::vector<PrecisionRecallCounts>& counts, int nGroundTruthDetections);
+
 public:
 	//! Constructor
 	/*! 
@@ -32,6 +40,14 @@ public:
 	 */
 	PrecisionRecall(const std::vector<float>& gt, const std::vector<float>& preds, int nGroundTruthDetections = -1);
 
+	//! Constructor
+	/*!
+		Computes precision recall from samples already grouped by prediction.
+		\param counts Samples of every distinct prediction, sorted by increasing score
+		\param nGroundTruthDetections Add ground truth detections.
+	 */
+	PrecisionRecall(const std::vector<PrecisionRecallCounts>& counts, int nGroundTruthDetections = -1);
+
 	//! Returns area under the curve
 	double getAveragePrecision() const { return _averagePrecision; }
 
@@ -1,4 +1,6 @@
 #include "PrincipalComponentAnalysis.h"
+#include "FeatureStore.h"
+#include "Trace.h"
 
 #include <boost/accumulators/accumulators.hpp>
 #include <boost/accumulators/statistics/stats.hpp>
@@ -8,58 +10,410 @@ using namespace boost::accumulators;
 using namespace std;
 using namespace cv;
 
-PrincipalComponentAnalysis::PrincipalComponentAnalysis()
+#define BLOCK_SAMPLES    256  // Samples multiplied together when accumulating or projecting
+#define STRIPE_ROWS      128  // Rows of the covariance updated by one task
+#define OVERSAMPLING     10   // Extra directions of the randomized subspace
+#define POWER_ITERATIONS 4
+
+template<typename T>
+static void standardizeSample(const float *feat, int num_features, bool standardize, T *out)
 {
+	if(!standardize) {
+		for(int k = 0; k < num_features; ++k)
+			out[k] = feat[k];
+		return;
+	}
+
+	accumulator_set<float, stats<tag::mean, tag::moment<2> > > acc;
+	for(int k = 0; k < num_features; ++k)
+		acc(feat[k]);
 
+	float mu = boost::accumulators::mean(acc);
+	float std = sqrt(moment<2>(acc));
+
+	for(int k = 0; k < num_features; ++k)
+		out[k] = (feat[k]-mu)/std;
 }
 
-void PrincipalComponentAnalysis::pre_process(const FeatureCollection fset, Mat& data)
+// Adds the upper triangle of block^T * block to the products, one stripe of rows per task
+class OuterProductAccumulator : public cv::ParallelLoopBody
 {
-	int num_samples = fset.size();
-	int num_features = fset[0].size();
-	for(int i = 0; i < num_samples; ++i){
-		Feature feat = fset[i];
-		
-		accumulator_set<float, stats<tag::mean, tag::moment<2> > > acc;
-		for(int k = 0; k < num_features; ++k)
-			acc(feat[k]);
+public:
+	OuterProductAccumulator(const Mat &block, Mat &products):
+		_block(block), _products(products)
+	{
+	}
 
-		float mu = boost::accumulators::mean(acc);
-		float std = sqrt(moment<2>(acc));
+	virtual void operator()(const cv::Range &range) const
+	{
+		int dim = _block.cols;
+		for(int s = range.start; s < range.end; s++) {
+			int first = s * STRIPE_ROWS, last = std::min(first + STRIPE_ROWS, dim);
+			Mat stripe = _products(Range(first, last), Range(first, dim));
+			gemm(_block.colRange(first, last), _block.colRange(first, dim), 1, stripe, 1, stripe, GEMM_1_T);
+		}
+	}
+
+private:
+	const Mat &_block;
+	Mat &_products;
+};
 
-		for(int j = 0; j < num_features; ++j){
-			data.at<float>(j,i) = (feat[j]-mu)/std;
+// Modified Gram-Schmidt on the rows of m
+static void orthonormalizeRows(Mat &m)
+{
+	for(int i = 0; i < m.rows; i++) {
+		double *vi = m.ptr<double>(i);
+		for(int j = 0; j < i; j++) {
+			const double *vj = m.ptr<double>(j);
+			double d = 0;
+			for(int k = 0; k < m.cols; k++)
+				d += vi[k]*vj[k];
+			for(int k = 0; k < m.cols; k++)
+				vi[k] -= d*vj[k];
 		}
+
+		double norm = 0;
+		for(int k = 0; k < m.cols; k++)
+			norm += vi[k]*vi[k];
+		norm = sqrt(norm);
+		for(int k = 0; k < m.cols; k++)
+			vi[k] = (norm > 0) ? vi[k]/norm : 0;
 	}
 }
 
-void PrincipalComponentAnalysis::compute(const Mat data, const PascalImageDatabase db)
+// Top eigenpairs of a symmetric matrix by randomized subspace iteration, the eigenvectors
+// are returned as rows sorted by decreasing eigenvalue like cv::eigen does. Only the
+// reduced l x l problem is decomposed densely, cv::eigen is a Jacobi solver whose cost on
+// the whole covariance grows much faster than the products of the iteration
+static void randomizedEigen(const Mat &cov, int nComponents, Mat &eigenvalues, Mat &eigenvectors)
 {
-	int num_principal_components = 2;
+	int dim = cov.rows;
+	int l = std::min(nComponents + OVERSAMPLING, dim);
 
-	PCA pca(data, Mat(), CV_PCA_DATA_AS_COL, num_principal_components);
-	PCA pca2(data, Mat(), CV_PCA_DATA_AS_COL);
+	// A subspace as large as the space needs no iteration, any orthonormal basis spans it
+	int iterations = (l == dim) ? 0 : POWER_ITERATIONS;
 
-	for(int i = 0; i < data.cols; ++i)
-	{
-		Mat proj = pca.project(data.col(i));
-		int label = db.getLabel(i);
-		_projectedPoints.push_back(proj);
-		_labels.push_back(label);
-		proj.release();
+	// Fixed seed so that the components are reproducible
+	cv::RNG rng(0x50434121);
+	Mat basis(l, dim, CV_64F);
+	for(int i = 0; i < l; i++) {
+		double *row = basis.ptr<double>(i);
+		for(int k = 0; k < dim; k++)
+			row[k] = rng.gaussian(1.0);
 	}
+	orthonormalizeRows(basis);
+
+	// The covariance is symmetric, so basis * cov is the transpose of cov * basis^T
+	Mat product;
+	for(int it = 0; it < iterations; it++) {
+		gemm(basis, cov, 1, Mat(), 0, product);
+		product.copyTo(basis);
+		orthonormalizeRows(basis);
+	}
+
+	// Rayleigh-Ritz: eigen decomposition of the covariance restricted to the subspace
+	gemm(basis, cov, 1, Mat(), 0, product);
+	Mat reduced;
+	gemm(product, basis, 1, Mat(), 0, reduced, GEMM_2_T);
+	for(int i = 0; i < l; i++) {
+		for(int j = i + 1; j < l; j++) {
+			double v = 0.5*(reduced.at<double>(i,j) + reduced.at<double>(j,i));
+			reduced.at<double>(i,j) = v;
+			reduced.at<double>(j,i) = v;
+		}
+	}
+
+	Mat reducedVectors;
+	eigen(reduced, eigenvalues, reducedVectors);
+	gemm(reducedVectors, basis, 1, Mat(), 0, eigenvectors);
+}
+
+PrincipalComponentAnalysis::PrincipalComponentAnalysis(bool standardize):
+	_standardize(standardize), _dim(0), _nSamples(0), _totalVariance(0)
+{
 
-	float percentage = (pca.eigenvalues.at<float>(0) + pca.eigenvalues.at<float>(1))/cv::sum(pca2.eigenvalues)[0];
-	LOG(INFO) << "Percentage of variability retained in first two dimensions: " << percentage*100 << "%";
 }
 
-void PrincipalComponentAnalysis::savePCAFile(const string pcaFilename)
+void PrincipalComponentAnalysis::add(const FeatureCollection &fset)
 {
+	TRACE_SCOPE("pca_add");
+
+	if(fset.empty()) return;
+	initialize(fset[0].size());
+
+	Mat block(BLOCK_SAMPLES, _dim, CV_64F);
+	for(int first = 0; first < fset.size(); first += BLOCK_SAMPLES) {
+		int n = std::min(BLOCK_SAMPLES, (int)fset.size() - first);
+		for(int i = 0; i < n; i++) {
+			if(fset[first + i].size() != _dim)
+				throw std::runtime_error("ERROR: Features of different sizes added to the principal component analysis");
+			standardizeSample(&fset[first + i][0], _dim, _standardize, block.ptr<double>(i));
+		}
+		accumulate(block.rowRange(0, n));
+	}
+}
+
+void PrincipalComponentAnalysis::add(const FeatureStore &store)
+{
+	TRACE_SCOPE("pca_add");
+
+	if(store.getSize() == 0) return;
+	initialize(store.getDimension());
+
+	// The pages of every block are dropped once added, the store is read in one pass
+	Mat block(BLOCK_SAMPLES, _dim, CV_64F);
+	for(int first = 0; first < store.getSize(); first += BLOCK_SAMPLES) {
+		int n = std::min(BLOCK_SAMPLES, store.getSize() - first);
+		for(int i = 0; i < n; i++)
+			standardizeSample(store.getFeature(first + i), _dim, _standardize, block.ptr<double>(i));
+		accumulate(block.rowRange(0, n));
+		store.release(first, first + n);
+	}
+}
+
+void PrincipalComponentAnalysis::initialize(int dim)
+{
+	if(_dim == 0) {
+		_dim = dim;
+		_sum = Mat::zeros(1, _dim, CV_64F);
+		_products = Mat::zeros(_dim, _dim, CV_64F);
+	} else if(dim != _dim) {
+		throw std::runtime_error("ERROR: Features of different sizes added to the principal component analysis");
+	}
+}
+
+void PrincipalComponentAnalysis::accumulate(const Mat &samples)
+{
+	double *sum = _sum.ptr<double>(0);
+	for(int i = 0; i < samples.rows; i++) {
+		const double *row = samples.ptr<double>(i);
+		for(int k = 0; k < _dim; k++)
+			sum[k] += row[k];
+	}
+
+	int nStripes = (_dim + STRIPE_ROWS - 1) / STRIPE_ROWS;
+	cv::parallel_for_(cv::Range(0, nStripes), OuterProductAccumulator(samples, _products));
+
+	_nSamples += samples.rows;
+}
+
+void PrincipalComponentAnalysis::compute(int nComponents)
+{
+	TRACE_SCOPE("pca_compute");
+
+	if(_nSamples == 0)
+		throw std::runtime_error("ERROR: No samples added to the principal component analysis");
+
+	nComponents = std::max(std::min(nComponents, _dim), 1);
+
+	// Covariance from the accumulated sums, the lower triangle mirrors the upper one
+	Mat mean = _sum * (1.0/_nSamples);
+	const double *mu = mean.ptr<double>(0);
+	Mat cov(_dim, _dim, CV_64F);
+	_totalVariance = 0;
+	for(int i = 0; i < _dim; i++) {
+		const double *products = _products.ptr<double>(i);
+		for(int j = i; j < _dim; j++) {
+			double c = products[j]/_nSamples - mu[i]*mu[j];
+			cov.at<double>(i,j) = c;
+			cov.at<double>(j,i) = c;
+		}
+		_totalVariance += cov.at<double>(i,i);
+	}
+
+	Mat eigenvalues, eigenvectors;
+	randomizedEigen(cov, nComponents, eigenvalues, eigenvectors);
+
+	mean.convertTo(_mean, CV_32F);
+	eigenvalues.rowRange(0, nComponents).convertTo(_eigenvalues, CV_32F);
+	eigenvectors.rowRange(0, nComponents).convertTo(_components, CV_32F);
+	gemm(_mean, _components, 1, Mat(), 0, _offset, GEMM_2_T);
+
+	LOG(INFO) << "Computed " << nComponents << " principal components of " << _nSamples << " samples of dimension " << _dim;
+}
+
+double PrincipalComponentAnalysis::getRetainedVariance() const
+{
+	if(_totalVariance <= 0) return 0;
+	return cv::sum(_eigenvalues)[0]/_totalVariance;
+}
+
+void PrincipalComponentAnalysis::project(const Feature &feat, Feature &proj) const
+{
+	if(feat.size() != _dim)
+		throw std::runtime_error("ERROR: Feature size doesn't match the principal component analysis");
+
+	vector<float> centered(_dim);
+	standardizeSample(&feat[0], _dim, _standardize, &centered[0]);
+	const float *mu = _mean.ptr<float>(0);
+	for(int k = 0; k < _dim; k++)
+		centered[k] -= mu[k];
+
+	proj.resize(_components.rows);
+	for(int c = 0; c < _components.rows; c++) {
+		const float *component = _components.ptr<float>(c);
+		float d = 0;
+		for(int k = 0; k < _dim; k++)
+			d += centered[k]*component[k];
+		proj[c] = d;
+	}
+}
+
+void PrincipalComponentAnalysis::project(const FeatureCollection &fset, FeatureCollection &proj) const
+{
+	proj.resize(fset.size());
+
+	// Blocks of samples are projected with one product each
+	Mat block(BLOCK_SAMPLES, _dim, CV_32F), projected;
+	for(int first = 0; first < fset.size(); first += BLOCK_SAMPLES) {
+		int n = std::min(BLOCK_SAMPLES, (int)fset.size() - first);
+		for(int i = 0; i < n; i++) {
+			if(fset[first + i].size() != _dim)
+				throw std::runtime_error("ERROR: Feature size doesn't match the principal component analysis");
+			standardizeSample(&fset[first + i][0], _dim, _standardize, block.ptr<float>(i));
+		}
+
+		project(block.rowRange(0, n), projected);
+		for(int i = 0; i < n; i++) {
+			const float *row = projected.ptr<float>(i);
+			proj[first + i].assign(row, row + _components.rows);
+		}
+	}
+}
+
+void PrincipalComponentAnalysis::project(const Mat &samples, Mat &projected) const
+{
+	if(samples.cols != _dim)
+		throw std::runtime_error("ERROR: Feature size doesn't match the principal component analysis");
+
+	Mat source = samples;
+	if(_standardize) {
+		source = Mat(samples.rows, _dim, CV_32F);
+		for(int i = 0; i < samples.rows; i++)
+			standardizeSample(samples.ptr<float>(i), _dim, true, source.ptr<float>(i));
+	}
+
+	// (x - mean) * components^T, the projected mean is subtracted after the product
+	gemm(source, _components, 1, Mat(), 0, projected, GEMM_2_T);
+	const float *offset = _offset.ptr<float>(0);
+	for(int i = 0; i < projected.rows; i++) {
+		float *row = projected.ptr<float>(i);
+		for(int c = 0; c < projected.cols; c++)
+			row[c] -= offset[c];
+	}
+}
+
+vector<float> PrincipalComponentAnalysis::foldDetector(const vector<float> &detector) const
+{
+	if(_standardize)
+		throw std::runtime_error("ERROR: A projection of standardized samples can't be folded into a linear detector");
+	if(detector.empty() || detector.size() - 1 > _components.rows)
+		throw std::runtime_error("ERROR: Detector size doesn't match the number of principal components");
+
+	// Trailing components with no weight are dropped by SupportVectorMachine::getDetector
+	int nWeights = detector.size() - 1;
+	vector<float> folded(_dim + 1, 0.0f);
+	for(int c = 0; c < nWeights; c++) {
+		const float *component = _components.ptr<float>(c);
+		for(int k = 0; k < _dim; k++)
+			folded[k] += detector[c]*component[k];
+	}
+
+	double bias = detector.back();
+	const float *mu = _mean.ptr<float>(0);
+	for(int k = 0; k < _dim; k++)
+		bias -= folded[k]*mu[k];
+	folded[_dim] = bias;
+
+	return folded;
+}
+
+void PrincipalComponentAnalysis::save(const string &filename) const
+{
+	FileStorage fs(filename, FileStorage::WRITE);
+	if(!fs.isOpened())
+		throw std::runtime_error("ERROR: Could not open file " + filename + " for writing");
+
+	fs << "standardize" << (int)_standardize;
+	fs << "samples" << _nSamples;
+	fs << "total_variance" << _totalVariance;
+	fs << "mean" << _mean;
+	fs << "components" << _components;
+	fs << "eigenvalues" << _eigenvalues;
+	fs.release();
+
+	LOG(INFO) << "Projection saved in: " << filename;
+}
+
+void PrincipalComponentAnalysis::load(const string &filename)
+{
+	FileStorage fs(filename, FileStorage::READ);
+	if(!fs.isOpened())
+		throw std::runtime_error("ERROR: Could not open file " + filename + " for reading");
+
+	int standardize;
+	fs["standardize"] >> standardize;
+	fs["samples"] >> _nSamples;
+	fs["total_variance"] >> _totalVariance;
+	fs["mean"] >> _mean;
+	fs["components"] >> _components;
+	fs["eigenvalues"] >> _eigenvalues;
+	fs.release();
+
+	if(_components.empty() || _mean.cols != _components.cols)
+		throw std::runtime_error("ERROR: Invalid projection file " + filename);
+
+	_standardize = standardize != 0;
+	_dim = _components.cols;
+	gemm(_mean, _components, 1, Mat(), 0, _offset, GEMM_2_T);
+
+	// The covariance is not saved, more samples can't be added to a loaded projection
+	_sum.release();
+	_products.release();
+}
+
+void PrincipalComponentAnalysis::savePCAFile(const string &pcaFilename, const FeatureCollection &fset, const vector<float> &labels) const
+{
+	if(_components.rows < 2)
+		throw std::runtime_error("ERROR: At least 2 principal components are needed to save the projected points");
+
+	ofstream f(pcaFilename.c_str());
+	if(!f.is_open())
+		throw std::runtime_error("ERROR: Could not open file " + pcaFilename + " for writing");
+
+	Feature proj;
+	for (int i = 0; i < fset.size(); ++i) {
+		project(fset[i], proj);
+		f << (int)labels[i] << " " << proj[0] << " " << proj[1] << "\n";
+	}
+	f.close();
+
+	LOG(INFO) << "Output generated in file: " << pcaFilename;
+}
+
+void PrincipalComponentAnalysis::savePCAFile(const string &pcaFilename, const FeatureStore &store) const
+{
+	if(_components.rows < 2)
+		throw std::runtime_error("ERROR: At least 2 principal components are needed to save the projected points");
+	if(store.getDimension() != _dim)
+		throw std::runtime_error("ERROR: Feature size doesn't match the principal component analysis");
+
 	ofstream f(pcaFilename.c_str());
-    for (int i = 0; i < _projectedPoints.size(); ++i) {
-        f << _labels[i] << " " << _projectedPoints[i].at<float>(0,0) << " " << _projectedPoints[i].at<float>(0,1) << "\n";
-    }
-    f.close();
+	if(!f.is_open())
+		throw std::runtime_error("ERROR: Could not open file " + pcaFilename + " for writing");
 
-    LOG(INFO) << "Output generated in file: " << pcaFilename;
-}
\ No newline at end of file
+	// Blocks are projected from the mapped store, project(Mat) standardizes them
+	Mat projected;
+	for(int first = 0; first < store.getSize(); first += BLOCK_SAMPLES) {
+		int n = std::min(BLOCK_SAMPLES, store.getSize() - first);
+		Mat block(n, _dim, CV_32F, (void*)store.getFeature(first));
+		project(block, projected);
+		for(int i = 0; i < n; i++)
+			f << (int)store.getLabel(first + i) << " " << projected.at<float>(i, 0) << " " << projected.at<float>(i, 1) << "\n";
+		store.release(first, first + n);
+	}
+	f.close();
+
+	LOG(INFO) << "Output generated in file: " << pcaFilename;
+}
@@ -3,46 +3,114 @@
 
 #include "Common.h"
 #include "Feature.h"
-#include "PascalImageDatabase.h"
+
+class FeatureStore;
 
 //! Principal Component Analysis Class
 /*!
-    This class reads an image database and extract the hog features for each images,
-    then it performs a principal component analysis and projects the data points to the 
-    2 principal eigenvectors and generates a file to be plotted.
+    This class accumulates the covariance of a set of features in one streaming pass and
+    extracts its principal components, which can then be used to project features or to
+    generate a file with the 2 principal coordinates of every sample to be plotted.
+
+    Samples are added in blocks: every block is multiplied by itself with a blocked product
+    split across threads, so the memory used only depends on the feature dimension and the
+    samples can be streamed from a FeatureStore. The top components are obtained with
+    randomized subspace iteration on the covariance, the total variance is its trace.
 */
 
-class PrincipalComponentAnalysis 
+class PrincipalComponentAnalysis
 {
 public:
 	//! Constructor
-	PrincipalComponentAnalysis();
+	/*!
+		\param standardize Normalize every sample to mean = 0 and std = 1 over its entries
+		       before adding and projecting it.
+	*/
+	PrincipalComponentAnalysis(bool standardize = false);
 
-	//! Create the normalized data matrix
+	//! Add samples to the covariance
 	/*!
+		Can be called several times with consecutive chunks of the data.
 		\param fset a vector of features extracted from the database.
-		\param data normalized matrix with mean = 0 and std = 1 for each sample.
 	*/
-	void pre_process(const FeatureCollection fset, Mat& data);
+	void add(const FeatureCollection &fset);
+
+	//! Add every sample of a feature store, reading it block by block
+	void add(const FeatureStore &store);
+
+	//! Perform PCA Analysis on the samples added so far
+	/*!
+		\param nComponents number of principal components to keep.
+	*/
+	void compute(int nComponents);
+
+	//! Project features on the principal components
+	void project(const Feature &feat, Feature &proj) const;
+	void project(const FeatureCollection &fset, FeatureCollection &proj) const;
+
+	//! Project a batch of samples with one matrix product
+	/*!
+		\param samples one sample per row (CV_32F).
+		\param projected one projected sample per row.
+	*/
+	void project(const Mat &samples, Mat &projected) const;
 
-	//! Perform PCA Analysis on the normalized data matrix
+	//! Linear detector over the original features equivalent to one over the projected features
 	/*!
-		\param data normalized matrix with mean = 0 and std = 1 for each sample.
-		\param image database.
+		\param detector weights over the components followed by the bias term (see SupportVectorMachine::getDetector).
+		\return weights over the original features followed by the bias term.
 	*/
-	void compute(const Mat data, const PascalImageDatabase db);
+	vector<float> foldDetector(const vector<float> &detector) const;
+
+	//! Save the projection to file
+	void save(const string &filename) const;
 
-	//! Save the projected points into a text file
+	//! Load a projection saved with save
+	void load(const string &filename);
+
+	//! Save the points projected on the first 2 components into a text file
 	/*!
 		\param pcaFilename path were the pca file will be created.
+		\param fset features to project.
+		\param labels label of every feature (positive or negative sample).
 	*/
-	void savePCAFile(const string pcaFilename);
+	void savePCAFile(const string &pcaFilename, const FeatureCollection &fset, const vector<float> &labels) const;
+
+	//! Save the points of every sample of a feature store projected on the first 2 components
+	void savePCAFile(const string &pcaFilename, const FeatureStore &store) const;
+
+	// Accessors
+	int getSampleCount() const { return _nSamples; }
+	int getDimension() const { return _dim; }
+	int getComponentCount() const { return _components.rows; }
+	bool isStandardized() const { return _standardize; }
+	const Mat &getMean() const { return _mean; }
+	const Mat &getComponents() const { return _components; }
+	const Mat &getEigenvalues() const { return _eigenvalues; }
+
+	//! Sum of the variances of every dimension
+	double getTotalVariance() const { return _totalVariance; }
+
+	//! Fraction of the total variance retained by the components
+	double getRetainedVariance() const;
 
 private:
 
-	vector<Mat> _projectedPoints; //! List of projected points
-	vector<int> _labels; //! Labels of the projected points (positive or negative sample)
+	bool _standardize;
+
+	int _dim;
+	int _nSamples;
+	Mat _sum;              //! Sum of the samples (1 x dim, double)
+	Mat _products;         //! Sum of the outer products, upper triangle only (dim x dim, double)
+
+	Mat _mean;             //! Mean of the samples (1 x dim, float)
+	Mat _components;       //! One principal component per row (nComponents x dim, float)
+	Mat _eigenvalues;      //! Variance along every component (nComponents x 1, float)
+	Mat _offset;           //! Projection of the mean (1 x nComponents, float)
+	double _totalVariance;
 
+	void initialize(int dim);
+	void accumulate(const Mat &samples);
 };
 
-#endif // PRINCIPLA_COMPONENT_ANALYSIS_H
\ No newline at end of file
+#endif // PRINCIPLA_COMPONENT_ANALYSIS_H
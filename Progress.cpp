@@ -0,0 +1,141 @@
+#include "Progress.h"
+#include "Trace.h"
+
+#include <boost/thread.hpp>
+
+using namespace std;
+
+struct ProgressTotals
+{
+    ProgressTotals(): items(0), ticks(0) {}
+
+    int64_t items;
+    int64_t ticks;      // Time the tasks of the name were running
+};
+
+// Guards the running tasks, the totals of the finished ones and the reporter state
+static boost::mutex _mutex;
+static boost::condition_variable _wakeUp;
+static vector<ProgressTask *> _tasks;
+static map<string, ProgressTotals> _finished;
+static boost::thread *_reporter = NULL;
+static bool _stopReporter = false;
+
+// Stops the reporter before the state above is destroyed
+static struct ReporterGuard
+{
+    ~ReporterGuard() { Progress::stopReporter(); }
+} _reporterGuard;
+
+static void reportTasks(int intervalMs)
+{
+    boost::unique_lock<boost::mutex> lock(_mutex);
+    boost::system_time next = boost::get_system_time();
+    while(true) {
+        next += boost::posix_time::milliseconds(intervalMs);
+        while(!_stopReporter && _wakeUp.timed_wait(lock, next)) {}
+        if(_stopReporter) return;
+
+        int64_t now = cv::getTickCount();
+        for(int i = 0; i < _tasks.size(); i++) {
+            const ProgressTask &task = *_tasks[i];
+            int64_t done = task.getDone();
+            double seconds = (now - task.getStart()) / cv::getTickFrequency();
+            LOG(INFO) << task.getName() << ": " << done << "/" << task.getTotal()
+                      << " (" << 100 * done / std::max(task.getTotal(), (int64_t)1) << "%, "
+                      << cvRound(done / seconds) << " items/s)";
+
+            if(Trace::isEnabled())
+                Trace::recordCounter(task.getName(), done);
+        }
+    }
+}
+
+void Progress::startReporter(int intervalMs)
+{
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    if(_reporter != NULL) return;
+
+    _stopReporter = false;
+    _reporter = new boost::thread(reportTasks, std::max(intervalMs, 1));
+}
+
+void Progress::stopReporter()
+{
+    boost::thread *reporter;
+    {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        reporter = _reporter;
+        _reporter = NULL;
+        _stopReporter = true;
+    }
+    _wakeUp.notify_all();
+
+    if(reporter != NULL) {
+        reporter->join();
+        delete reporter;
+    }
+}
+
+std::map<std::string, int64_t> Progress::getCounters()
+{
+    boost::lock_guard<boost::mutex> lock(_mutex);
+
+    map<string, int64_t> counters;
+    for(map<string, ProgressTotals>::const_iterator it = _finished.begin(); it != _finished.end(); ++it)
+        counters[it->first] = it->second.items;
+    for(int i = 0; i < _tasks.size(); i++)
+        counters[_tasks[i]->getName()] += _tasks[i]->getDone();
+    return counters;
+}
+
+void Progress::printSummary(std::ostream &s)
+{
+    map<string, ProgressTotals> totals;
+    {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        totals = _finished;
+        int64_t now = cv::getTickCount();
+        for(int i = 0; i < _tasks.size(); i++) {
+            ProgressTotals &t = totals[_tasks[i]->getName()];
+            t.items += _tasks[i]->getDone();
+            t.ticks += now - _tasks[i]->getStart();
+        }
+    }
+
+    ios::fmtflags flags = s.flags();
+    s << left << setw(24) << "Counter" << right << setw(14) << "Items" << setw(14) << "Items/s" << endl;
+    for(map<string, ProgressTotals>::const_iterator it = totals.begin(); it != totals.end(); ++it) {
+        double seconds = it->second.ticks / cv::getTickFrequency();
+        s << left << setw(24) << it->first << right << setw(14) << it->second.items << fixed << setprecision(1)
+          << setw(14) << (seconds > 0 ? it->second.items / seconds : 0.0) << endl;
+    }
+    s.flags(flags);
+}
+
+void Progress::addTask(ProgressTask *task)
+{
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    _tasks.push_back(task);
+}
+
+void Progress::removeTask(ProgressTask *task)
+{
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    _tasks.erase(std::remove(_tasks.begin(), _tasks.end(), task), _tasks.end());
+
+    ProgressTotals &t = _finished[task->getName()];
+    t.items += task->getDone();
+    t.ticks += cv::getTickCount() - task->getStart();
+}
+
+ProgressTask::ProgressTask(const char *name, int64_t total):
+    _name(name), _total(total), _start(cv::getTickCount()), _done(0)
+{
+    Progress::addTask(this);
+}
+
+ProgressTask::~ProgressTask()
+{
+    Progress::removeTask(this);
+}
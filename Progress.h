@@ -0,0 +1,78 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include "Common.h"
+
+#include <boost/atomic.hpp>
+
+class ProgressTask;
+
+//! Progress Class
+/*!
+    This class reports the progress of long loops without slowing them down. A loop declares a
+    ProgressTask with its number of items and counts them with ProgressTask::add, a relaxed atomic
+    increment that any worker thread can make. A single reporter thread logs the progress and the
+    rate of the running tasks at a fixed interval, so the loops never write to the terminal.
+
+    The items of every task name are also counted for the whole run. The reporter samples them
+    into the trace as counters when tracing is enabled and they can be read back with getCounters.
+*/
+class Progress
+{
+public:
+    //! Start the reporter thread
+    /*!
+        \param intervalMs Time between two reports of the running tasks
+    */
+    static void startReporter(int intervalMs = 1000);
+
+    //! Stop the reporter thread, it is also stopped at exit
+    static void stopReporter();
+
+    //! Items counted so far under every task name, running tasks included
+    static std::map<std::string, int64_t> getCounters();
+
+    //! Print the items and the rate of every task name
+    static void printSummary(std::ostream &s);
+
+private:
+    friend class ProgressTask;
+
+    static void addTask(ProgressTask *task);
+    static void removeTask(ProgressTask *task);
+};
+
+//! Counts the items of one loop, see Progress
+class ProgressTask
+{
+public:
+    //! Constructor
+    /*!
+        \param name Task name, it must be a string literal or outlive the task
+        \param total Number of items the loop will process
+    */
+    ProgressTask(const char *name, int64_t total);
+
+    ~ProgressTask();
+
+    //! Count processed items, can be called from any thread
+    void add(int64_t n = 1) { _done.fetch_add(n, boost::memory_order_relaxed); }
+
+    const char *getName() const { return _name; }
+    int64_t getTotal() const { return _total; }
+    int64_t getDone() const { return _done.load(boost::memory_order_relaxed); }
+
+    //! Tick count when the task started (cv::getTickCount)
+    int64_t getStart() const { return _start; }
+
+private:
+    const char *_name;
+    int64_t _total;
+    int64_t _start;
+    boost::atomic<int64_t> _done;
+
+    ProgressTask(const ProgressTask &);
+    ProgressTask &operator=(const ProgressTask &);
+};
+
+#endif // PROGRESS_H
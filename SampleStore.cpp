@@ -0,0 +1,205 @@
+#include "SampleStore.h"
+#include "Feature.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace cv;
+using namespace std;
+
+static const char STORE_MAGIC[8] = "ODSMPLS";
+static const uint32_t STORE_VERSION = 1;
+
+// On disk layout: header, labels, filename offsets, filenames, then the windows starting on a page
+// boundary so that each one is a contiguous run of the mapping. The header is written last.
+struct StoreHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t nSamples;
+    uint32_t width;
+    uint32_t height;
+    char category[32];
+    uint64_t labelsPos;
+    uint64_t filenameOffsetsPos;
+    uint64_t stringsPos;
+    uint64_t samplesPos;
+};
+
+static const int STORE_CHANNELS = 3;
+static const uint64_t SAMPLES_ALIGNMENT = 4096;
+
+// Whether size bytes starting at pos lie inside a file of the given length
+static bool sectionFits(uint64_t pos, uint64_t size, uint64_t length)
+{
+    return pos <= length && size <= length - pos;
+}
+
+SampleStore::SampleStore(const std::string &filename):
+    _fd(-1), _length(0), _data(NULL)
+{
+    _fd = open(filename.c_str(), O_RDONLY);
+    if(_fd < 0)
+        throw std::runtime_error("ERROR: Could not open sample store " + filename + " for reading");
+
+    struct stat st;
+    if(fstat(_fd, &st) != 0 || st.st_size < (off_t)sizeof(StoreHeader)) {
+        close(_fd);
+        throw std::runtime_error("ERROR: Invalid sample store " + filename);
+    }
+
+    _length = st.st_size;
+    void *mapped = mmap(NULL, _length, PROT_READ, MAP_SHARED, _fd, 0);
+    if(mapped == MAP_FAILED) {
+        close(_fd);
+        throw std::runtime_error("ERROR: Could not map sample store " + filename);
+    }
+    _data = (const char *)mapped;
+
+    const StoreHeader *header = (const StoreHeader *)_data;
+    if(memcmp(header->magic, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0 || header->version != STORE_VERSION) {
+        munmap((void *)_data, _length);
+        close(_fd);
+        throw std::runtime_error("ERROR: " + filename + " is not a sample store");
+    }
+
+    // The filenames run up to the windows, whose total size is checked without overflowing
+    uint64_t n = header->nSamples;
+    if(!sectionFits(header->labelsPos, n * sizeof(float), _length) ||
+       !sectionFits(header->filenameOffsetsPos, n * sizeof(uint64_t), _length) ||
+       header->stringsPos < header->filenameOffsetsPos + n * sizeof(uint64_t) ||
+       header->samplesPos < header->stringsPos || header->samplesPos > _length ||
+       (n > 0 && (uint64_t)header->width * header->height > (_length - header->samplesPos) / (n * STORE_CHANNELS))) {
+        munmap((void *)_data, _length);
+        close(_fd);
+        throw std::runtime_error("ERROR: " + filename + " is not a complete sample store");
+    }
+
+    // Windows are read once, front to back
+    madvise((void *)_data, _length, MADV_SEQUENTIAL);
+
+    _size = header->nSamples;
+    _winSize = Size(header->width, header->height);
+    _category = string(header->category, strnlen(header->category, sizeof(header->category)));
+    _labels = (const float *)(_data + header->labelsPos);
+    _filenameOffsets = (const uint64_t *)(_data + header->filenameOffsetsPos);
+    _strings = _data + header->stringsPos;
+    _samples = (const unsigned char *)(_data + header->samplesPos);
+}
+
+SampleStore::~SampleStore()
+{
+    if(_data != NULL) munmap((void *)_data, _length);
+    if(_fd >= 0) close(_fd);
+}
+
+const Mat SampleStore::getSample(int idx) const
+{
+    size_t sampleSize = (size_t)_winSize.area() * STORE_CHANNELS;
+    return Mat(_winSize, CV_8UC3, (void *)(_samples + idx * sampleSize));
+}
+
+std::string SampleStore::getFilename(int idx) const
+{
+    return string(_strings + _filenameOffsets[idx]);
+}
+
+std::vector<std::string> SampleStore::getFilenames() const
+{
+    vector<string> filenames(_size);
+    for(int i = 0; i < _size; i++)
+        filenames[i] = getFilename(i);
+    return filenames;
+}
+
+bool SampleStore::isSampleStore(const std::string &filename)
+{
+    ifstream f(filename.c_str(), ios::binary);
+    char magic[sizeof(STORE_MAGIC)];
+    if(!f.read(magic, sizeof(magic))) return false;
+    return memcmp(magic, STORE_MAGIC, sizeof(STORE_MAGIC)) == 0;
+}
+
+void SampleStore::build(const PascalImageDatabase &db, const std::string &category, const std::string &filename,
+                        Size winSize, const ParametersMap &sourceParams)
+{
+    int n = db.getSize();
+
+    // Filenames are shared by the consecutive samples of an image
+    vector<uint64_t> filenameOffsets(n);
+    string strings;
+    for(int i = 0; i < n; i++) {
+        if(i == 0 || db.getFilename(i) != db.getFilename(i - 1)) {
+            filenameOffsets[i] = strings.size();
+            strings += db.getFilename(i);
+            strings.push_back('\0');
+        } else {
+            filenameOffsets[i] = filenameOffsets[i - 1];
+        }
+    }
+
+    StoreHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+    header.version = STORE_VERSION;
+    header.nSamples = n;
+    header.width = winSize.width;
+    header.height = winSize.height;
+    strncpy(header.category, category.c_str(), sizeof(header.category) - 1);
+    header.labelsPos = sizeof(StoreHeader);
+    header.filenameOffsetsPos = (header.labelsPos + n * sizeof(float) + 7) & ~(uint64_t)7;
+    header.stringsPos = header.filenameOffsetsPos + n * sizeof(uint64_t);
+    header.samplesPos = (header.stringsPos + strings.size() + SAMPLES_ALIGNMENT - 1) & ~(SAMPLES_ALIGNMENT - 1);
+
+    ofstream f(filename.c_str(), ios::binary);
+    if(!f.is_open())
+        throw std::runtime_error("ERROR: Could not open file " + filename + " for writing");
+
+    // Written again once every window is packed, a partial store has no magic
+    StoreHeader placeholder;
+    memset(&placeholder, 0, sizeof(placeholder));
+    vector<char> padding(SAMPLES_ALIGNMENT, 0);
+    f.write((const char *)&placeholder, sizeof(placeholder));
+    for(int i = 0; i < n; i++) {
+        float label = db.getLabel(i);
+        f.write((const char *)&label, sizeof(float));
+    }
+    f.write(&padding[0], header.filenameOffsetsPos - (header.labelsPos + n * sizeof(float)));
+    if(n > 0)
+        f.write((const char *)&filenameOffsets[0], n * sizeof(uint64_t));
+    f.write(strings.data(), strings.size());
+    f.write(&padding[0], header.samplesPos - (header.stringsPos + strings.size()));
+
+    vector<int> firsts, reductions;
+    vector<string> images;
+    FeatureExtractor::imageRuns(db, firsts, images, reductions);
+    ImageSource source(images, reductions, sourceParams);
+
+    for(int r = 0; r + 1 < firsts.size(); r++) {
+        Mat img;
+        source.next(img);
+
+        for(int k = firsts[r]; k < firsts[r + 1]; k++) {
+            Mat window;
+            resize(FeatureExtractor::cropSample(db, k, img, reductions[r]), window, winSize);
+            if(window.channels() == 1)
+                cvtColor(window, window, CV_GRAY2BGR);
+            if(!window.isContinuous())
+                window = window.clone();
+            f.write((const char *)window.data, window.total() * window.elemSize());
+        }
+
+        if(firsts[r + 1] / 1000 != firsts[r] / 1000 || firsts[r + 1] == n)
+            LOG(INFO) << "Packed " << firsts[r + 1] << " of " << n << " samples";
+    }
+
+    f.seekp(0);
+    f.write((const char *)&header, sizeof(header));
+    f.close();
+
+    if(!f.good())
+        throw std::runtime_error("ERROR: Could not write sample store " + filename);
+}
@@ -0,0 +1,79 @@
+#ifndef SAMPLE_STORE_H
+#define SAMPLE_STORE_H
+
+#include "Common.h"
+#include "PascalImageDatabase.h"
+#include "ImageSource.h"
+
+//! Sample Store Class
+/*!
+    This class stores every training sample of a PascalImageDatabase (positives, their flipped copies
+    and the random negatives) already cropped and resized to the detection window, together with its
+    label and source image, in one packed file. The file is memory mapped so extracting features is a
+    single sequential scan instead of decoding one JPEG per image.
+
+    Samples are stored as fixed size 8 bit BGR images, one after the other.
+*/
+class SampleStore
+{
+public:
+    //! Constructor
+    /*!
+        \param filename Path of a store created with SampleStore::build
+    */
+    SampleStore(const std::string &filename);
+
+    //! Destructor
+    ~SampleStore();
+
+    //! Number of samples
+    int getSize() const { return _size; }
+
+    //! Size of the stored windows
+    cv::Size getWindowSize() const { return _winSize; }
+
+    //! Category the store was created for
+    std::string getCategory() const { return _category; }
+
+    //! Read only window of a sample, a view of the mapped file
+    const cv::Mat getSample(int idx) const;
+
+    //! Label of a sample
+    float getLabel(int idx) const { return _labels[idx]; }
+
+    //! Labels of all the samples
+    std::vector<float> getLabels() const { return std::vector<float>(_labels, _labels + _size); }
+
+    //! Image a sample was cropped from
+    std::string getFilename(int idx) const;
+
+    //! Images of all the samples
+    std::vector<std::string> getFilenames() const;
+
+    //! Crop every sample of a database and write the store
+    static void build(const PascalImageDatabase &db, const std::string &category, const std::string &filename,
+                      cv::Size winSize = cv::Size(64,128),
+                      const ParametersMap &sourceParams = ImageSource::getDefaultParameters());
+
+    //! True if the file starts like a sample store
+    static bool isSampleStore(const std::string &filename);
+
+private:
+    int _fd;
+    size_t _length;
+    const char *_data;
+
+    int _size;
+    cv::Size _winSize;
+    std::string _category;
+    const float *_labels;
+    const uint64_t *_filenameOffsets;
+    const char *_strings;
+    const unsigned char *_samples;
+
+    // Non copyable, the mapping is released by the destructor
+    SampleStore(const SampleStore &);
+    SampleStore &operator=(const SampleStore &);
+};
+
+#endif // SAMPLE_STORE_H
@@ -1,4 +1,7 @@
 #include "SupportVectorMachine.h"
+#include "Trace.h"
+#include "Progress.h"
+#include "FeatureStore.h"
 
 #define Malloc(type,n) (type *)malloc((n)*sizeof(type))
 
@@ -17,7 +20,9 @@ const char *PROBABILITY     = "probability";
 
 SupportVectorMachine::SupportVectorMachine():
     _model(NULL),
-    _data(NULL)
+    _data(NULL),
+    _warmStart(NULL),
+    _bounded(NULL)
 {
     _param.nr_weight = 0;
     _param.weight_label = NULL;
@@ -26,7 +31,9 @@ SupportVectorMachine::SupportVectorMachine():
 
 SupportVectorMachine::SupportVectorMachine(const ParametersMap &params):
     _model(NULL),
-    _data(NULL)
+    _data(NULL),
+    _warmStart(NULL),
+    _bounded(NULL)
 {
     string svm_type = params.getStr(SVM_TYPE);
     string kernel_type = params.getStr(KERNEL_TYPE);
@@ -73,16 +80,37 @@ SupportVectorMachine::SupportVectorMachine(const ParametersMap &params):
 
 SupportVectorMachine::SupportVectorMachine(const std::string &modelFName):
     _model(NULL),
-    _data(NULL)
+    _data(NULL),
+    _warmStart(NULL),
+    _bounded(NULL)
 {
     LOG(INFO) << "Loading svm model: " << modelFName;
     _model = load(modelFName);
+    if(_model == NULL)
+        throw std::runtime_error("ERROR: Could not load svm model from: " + modelFName);
     _param = _model->param;
+    _initBoundedPredictor();
+
+}
 
+double SupportVectorMachine::_decisionSign() const
+{
+    // libsvm reports decision values with respect to the first label seen during training
+    return (_model->nr_class == 2 && _model->label != NULL && _model->label[0] < 0) ? -1.0 : 1.0;
+}
+
+void SupportVectorMachine::_initBoundedPredictor()
+{
+    delete _bounded;
+    _bounded = NULL;
+    if(BoundedKernelPredictor::supports(_model))
+        _bounded = new BoundedKernelPredictor(_model, _decisionSign());
 }
 
 void SupportVectorMachine::_deinit()
 {
+    delete _bounded;
+    _bounded = NULL;
     if(_model != NULL) svm_free_and_destroy_model(&_model);
     _model = NULL;
 }
@@ -90,6 +118,8 @@ void SupportVectorMachine::_deinit()
 SupportVectorMachine::~SupportVectorMachine()
 {
     _deinit();
+    svm_warm_start_destroy(&_warmStart);
+    delete [] _data;
 }
 
 ParametersMap SupportVectorMachine::getDefaultParameters()
@@ -110,11 +140,15 @@ ParametersMap SupportVectorMachine::getDefaultParameters()
     return params;
 }
 
-ParametersMap SupportVectorMachine::getParameters()
+ParametersMap SupportVectorMachine::getParameters() const
 {
+    // Same names as the constructor parses, so the parameters can configure another svm
+    static const char *svmTypes[] = { "C_SVC", "NU_SVC", "ONE_CLASS", "EPSILON_SVR", "NU_SVR" };
+    static const char *kernelTypes[] = { "LINEAR", "POLY", "RBF", "SIGMOID", "PRECOMPUTED" };
+
     ParametersMap params;
-    params.set(SVM_TYPE, _param.svm_type);
-    params.set(KERNEL_TYPE, _param.kernel_type);
+    params.set(SVM_TYPE, svmTypes[_param.svm_type]);
+    params.set(KERNEL_TYPE, kernelTypes[_param.kernel_type]);
     params.set(DEGREE, _param.degree);
     params.set(GAMMA, _param.gamma);
     params.set(COEF0, _param.coef0);
@@ -146,6 +180,8 @@ void SupportVectorMachine::printSVMParameters()
 
 void SupportVectorMachine::train(const std::vector<float> &labels, FeatureCollection &features, std::string svmModelFName)
 {
+    TRACE_SCOPE("svm_train");
+
      if(labels.size() != features.size()) throw std::runtime_error("ERROR: Database size is different from feature set size!");
 
     printSVMParameters();
@@ -189,6 +225,9 @@ void SupportVectorMachine::train(const std::vector<float> &labels, FeatureCollec
     // Train the model
     if(_model != NULL) svm_free_and_destroy_model(&_model);
     _model = svm_train(&problem, &_param);
+    _initBoundedPredictor();
+    _trainIndices.clear();
+    svm_warm_start_destroy(&_warmStart);
 
     LOG(INFO) << "Saving model file to: " << svmModelFName;
     save(svmModelFName);
@@ -198,6 +237,143 @@ void SupportVectorMachine::train(const std::vector<float> &labels, FeatureCollec
     delete [] problem.x;
 }
 
+void SupportVectorMachine::train(const FeatureStore &store, const std::vector<int> &indices)
+{
+    TRACE_SCOPE("svm_train");
+
+    int nVecs = indices.size();
+    int dim = store.getDimension();
+
+    svm_problem problem;
+    problem.l = nVecs;
+    problem.y = new double[nVecs];
+    problem.x = new svm_node*[nVecs];
+
+    // The nodes of the previous problem are only referenced by the previous model
+    if(_model != NULL) svm_free_and_destroy_model(&_model);
+    if(_data) delete [] _data;
+    _data = new svm_node[(size_t)nVecs * (dim + 1)];
+
+    vector<float> scaled(dim);
+    for(int k = 0; k < nVecs; k++) {
+        problem.y[k] = store.getLabel(indices[k]);
+        problem.x[k] = &_data[(size_t)k * (dim + 1)];
+
+        store.getScaledFeature(indices[k], &scaled[0]);
+        for(int i = 0; i < dim; i++) {
+            problem.x[k][i].index = i;
+            problem.x[k][i].value = scaled[i];
+        }
+        problem.x[k][dim].index = -1;
+    }
+
+    _model = svm_train(&problem, &_param);
+    _initBoundedPredictor();
+    _trainIndices = indices;
+    svm_warm_start_destroy(&_warmStart);
+
+    delete [] problem.y;
+    delete [] problem.x;
+}
+
+void SupportVectorMachine::trainPath(const std::vector<float> &labels, const FeatureCollection &features, double c)
+{
+    TRACE_SCOPE("svm_train_path");
+
+    if(labels.size() != features.size()) throw std::runtime_error("ERROR: Database size is different from feature set size!");
+
+    int nVecs = labels.size();
+    int dim = features[0].size();
+
+    svm_problem problem;
+    problem.l = nVecs;
+    problem.y = new double[nVecs];
+    problem.x = new svm_node*[nVecs];
+
+    // The nodes are copied on the first call only, the previous model and the kernel cache point into them
+    _deinit();
+    if(_warmStart == NULL) {
+        if(_data) delete [] _data;
+        _data = new svm_node[(size_t)nVecs * (dim + 1)];
+        for(int k = 0; k < nVecs; k++) {
+            svm_node *x = &_data[(size_t)k * (dim + 1)];
+            for(int i = 0; i < dim; i++) {
+                x[i].index = i;
+                x[i].value = features[k][i];
+            }
+            x[dim].index = -1;
+        }
+
+        _warmStart = svm_warm_start_create();
+    }
+
+    for(int k = 0; k < nVecs; k++) {
+        problem.y[k] = labels[k];
+        problem.x[k] = &_data[(size_t)k * (dim + 1)];
+    }
+
+    _param.C = c;
+    _model = svm_train_warm(&problem, &_param, _warmStart);
+    _initBoundedPredictor();
+    _trainIndices.clear();
+
+    delete [] problem.y;
+    delete [] problem.x;
+}
+
+std::vector<int> SupportVectorMachine::getSupportVectorIndices() const
+{
+    if(_model == NULL || _model->sv_indices == NULL)
+        throw std::runtime_error("ERROR: Support vector positions are only known for a model trained in this run");
+
+    vector<int> indices(_model->l);
+    for(int i = 0; i < _model->l; i++) {
+        int k = _model->sv_indices[i] - 1;
+        indices[i] = _trainIndices.empty() ? k : _trainIndices[k];
+    }
+    return indices;
+}
+
+void SupportVectorMachine::setLinearModel(const std::vector<float> &detector)
+{
+    if(_param.kernel_type != LINEAR)
+        throw std::runtime_error("ERROR: A linear model can only replace the model of a linear svm");
+
+    _deinit();
+
+    // A single support vector equal to the weights, allocated like svm_load_model does so it is freed with the model
+    int dim = detector.size() - 1;
+    _model = Malloc(svm_model, 1);
+    _model->param = _param;
+    _model->nr_class = 2;
+    _model->l = 1;
+    _model->SV = Malloc(svm_node *, 1);
+    _model->SV[0] = Malloc(svm_node, dim + 1);
+    for(int i = 0; i < dim; i++) {
+        _model->SV[0][i].index = i;
+        _model->SV[0][i].value = detector[i];
+    }
+    _model->SV[0][dim].index = -1;
+    _model->sv_coef = Malloc(double *, 1);
+    _model->sv_coef[0] = Malloc(double, 1);
+    _model->sv_coef[0][0] = 1;
+    _model->rho = Malloc(double, 1);
+    _model->rho[0] = -detector[dim];
+    _model->probA = NULL;
+    _model->probB = NULL;
+    _model->sv_indices = NULL;
+    _model->label = Malloc(int, 2);
+    _model->label[0] = 1;
+    _model->label[1] = -1;
+    _model->nSV = Malloc(int, 2);
+    _model->nSV[0] = 1;
+    _model->nSV[1] = 0;
+    _model->free_sv = 1;
+
+    _initBoundedPredictor();
+    _trainIndices.clear();
+}
+
 float SupportVectorMachine::predict(const Feature &feature) const
 {
     int dim = feature.size();
@@ -218,7 +394,7 @@ float SupportVectorMachine::predict(const Feature &feature) const
 
     delete [] svmNode;
 
-    return decisionValue;
+    return decisionValue * _decisionSign();
 }
 
 float SupportVectorMachine::predictLabel(const Feature &feature) const
@@ -260,57 +436,54 @@ float SupportVectorMachine::predictLabel(const Feature &feature, double& decisio
     svmNodeIter->index = -1;
 
     float label = svm_predict_values(_model, svmNode, &decisionValue);
+    decisionValue *= _decisionSign();
 
     delete [] svmNode;
 
     return label;
 }
 
+bool SupportVectorMachine::predictAbove(const float *feature, int dim, double threshold, double &decisionValue) const
+{
+    if(_bounded != NULL && _bounded->getDimension() <= dim)
+    {
+        int kernelEvaluations;
+        return _bounded->predictAbove(feature, threshold, decisionValue, kernelEvaluations);
+    }
+
+    decisionValue = predict(Feature(feature, feature + dim));
+    return decisionValue > threshold;
+}
+
 std::vector<float> SupportVectorMachine::predict(const FeatureCollection &fset)
 {
+    TRACE_SCOPE("svm_predict");
+
     //printSVMParameters();
 
     int n = fset.size();
     std::vector<float> preds(n);
+    ProgressTask progress("svm_predict", n);
     for(int i = 0; i < n; i++) {
-        float percent;
-        printf("\033[s");
-        // Print progress string
-        if((i+1)%1000 == 0 || (i+1) == n)
-        {
-            percent = ((i+1)*100)/n;
-            cout << percent << "% ... ";
-            fflush(stdout);
-            printf("\033[u");
-        }
-
         preds[i] = predict(fset[i]);
+        progress.add();
     }
-    printf("\n");
 
     return preds;
 }
 
 std::vector<float> SupportVectorMachine::predictLabel(const FeatureCollection &fset) const
 {
+    TRACE_SCOPE("svm_predict");
+
     int n = fset.size();
     std::vector<float> preds(n);
+    ProgressTask progress("svm_predict", n);
     for(int i = 0; i < n; i++) {
-        float percent;
-        printf("\033[s");
-        // Print progress string
-        if((i+1)%1000 == 0 || (i+1) == n)
-        {
-            percent = ((i+1)*100)/n;
-            cout << percent << "% ... ";
-            fflush(stdout);
-            printf("\033[u");
-        }
-
         double decisionValue;
         preds[i] = predictLabel(fset[i], decisionValue);
+        progress.add();
     }
-    printf("\n");
     return preds;
 }
 
@@ -324,29 +497,29 @@ std::vector<float> SupportVectorMachine::getDetector() const
     const double * const * sv_coef = _model->sv_coef;
     const svm_node * const *SV = _model->SV;
     int l = _model->l;
-    //_model->label;
 
-    const svm_node* p_tmp = SV[0];
+    // Features are stored with zero based indices, see train
     int len = 0;
-    while(p_tmp->index != -1)
+    for(int i = 0; i < l; i++)
     {
-        len++;
-        p_tmp++;
+        for(const svm_node* p = SV[i]; p->index != -1; p++)
+            len = std::max(len, p->index + 1);
     }
 
     weights.resize(len+1);
 
+    double sign = _decisionSign();
     for(int i = 0; i < l; i++)
     {
-        double svcoef = sv_coef[0][i];
+        double svcoef = sign * sv_coef[0][i];
         const svm_node* p = SV[i];
         while( p->index != -1)
         {
-            weights[p->index-1] += float(svcoef * p->value);
+            weights[p->index] += float(svcoef * p->value);
             p++;
         }
     }
-    weights[len] = float(-_model->rho[0]);
+    weights[len] = float(-sign * _model->rho[0]);
     return weights;
 }
 
@@ -357,6 +530,103 @@ double SupportVectorMachine::getBiasTerm() const
     return _model->rho[0];
 }
 
+// Gram matrix of the RBF kernel between the rows of a and the rows of b
+static Mat rbfKernel(const Mat &a, const Mat &b, double gamma)
+{
+    Mat cross;
+    gemm(a, b, 1, Mat(), 0, cross, GEMM_2_T);
+
+    vector<double> a2(a.rows), b2(b.rows);
+    for(int i = 0; i < a.rows; i++) a2[i] = a.row(i).dot(a.row(i));
+    for(int j = 0; j < b.rows; j++) b2[j] = b.row(j).dot(b.row(j));
+
+    Mat k(a.rows, b.rows, CV_64F);
+    for(int i = 0; i < a.rows; i++)
+        for(int j = 0; j < b.rows; j++)
+            k.at<double>(i,j) = exp(-gamma * std::max(a2[i] + b2[j] - 2 * cross.at<float>(i,j), 0.0));
+    return k;
+}
+
+void SupportVectorMachine::compress(int nVectors, const std::string &filename) const
+{
+    if(_model == NULL)
+        throw std::runtime_error("ERROR: Asking to compress the SVM but there is no model. Either load one from file or train one before.");
+    if(_model->param.kernel_type != RBF || _model->nr_class != 2)
+        throw std::runtime_error("ERROR: Only two class RBF models can be compressed");
+
+    int l = _model->l;
+    if(nVectors <= 0 || nVectors >= l)
+        throw std::runtime_error("ERROR: The compressed model must keep less vectors than the original one");
+
+    // Dense copy of the support vectors, features are stored with zero based indices
+    int dim = 0;
+    for(int i = 0; i < l; i++)
+        for(const svm_node *p = _model->SV[i]; p->index != -1; p++)
+            dim = std::max(dim, p->index + 1);
+
+    Mat sv(l, dim, CV_32F, Scalar(0));
+    Mat alpha(l, 1, CV_64F);
+    for(int i = 0; i < l; i++)
+    {
+        for(const svm_node *p = _model->SV[i]; p->index != -1; p++)
+            sv.at<float>(i, p->index) = p->value;
+        alpha.at<double>(i) = _model->sv_coef[0][i];
+    }
+
+    LOG(INFO) << "Clustering " << l << " support vectors into " << nVectors << " centers";
+    Mat labels, centers;
+    kmeans(sv, nVectors, labels, TermCriteria(TermCriteria::COUNT + TermCriteria::EPS, 100, 1e-4), 3, KMEANS_PP_CENTERS, centers);
+
+    // Refit: minimize |sum_i alpha_i phi(x_i) - sum_j beta_j phi(z_j)|, i.e. Kzz beta = Kzx alpha
+    LOG(INFO) << "Refitting the coefficients of the reduced set";
+    double gamma = _model->param.gamma;
+    Mat kzz = rbfKernel(centers, centers, gamma);
+    Mat kzx = rbfKernel(centers, sv, gamma);
+    kzz += Mat::eye(nVectors, nVectors, CV_64F) * 1e-8;
+
+    Mat beta;
+    Mat target = kzx * alpha;
+    solve(kzz, target, beta, DECOMP_SVD);
+
+    // Build the compressed model, vectors with positive coefficients first
+    vector<int> order;
+    for(int j = 0; j < nVectors; j++) if(beta.at<double>(j) > 0) order.push_back(j);
+    int nPositive = order.size();
+    for(int j = 0; j < nVectors; j++) if(beta.at<double>(j) <= 0) order.push_back(j);
+
+    vector<svm_node> nodes(nVectors * (dim + 1));
+    vector<svm_node *> vectors(nVectors);
+    vector<double> coef(nVectors);
+    for(int k = 0; k < nVectors; k++)
+    {
+        int j = order[k];
+        vectors[k] = &nodes[k * (dim + 1)];
+        for(int i = 0; i < dim; i++)
+        {
+            vectors[k][i].index = i;
+            vectors[k][i].value = centers.at<float>(j, i);
+        }
+        vectors[k][dim].index = -1;
+        coef[k] = beta.at<double>(j);
+    }
+
+    double *svCoef[1] = { &coef[0] };
+    int nSV[2] = { nPositive, nVectors - nPositive };
+
+    svm_model model = *_model;
+    model.l = nVectors;
+    model.SV = &vectors[0];
+    model.sv_coef = svCoef;
+    model.nSV = nSV;
+    model.probA = NULL;
+    model.probB = NULL;
+    model.sv_indices = NULL;
+    model.free_sv = 0;
+
+    if(svm_save_model(filename.c_str(), &model) != 0)
+        throw std::runtime_error("ERROR: Could not save the compressed model in: " + filename);
+}
+
 svm_model * SupportVectorMachine::load(const std::string &filename)
 {
     _deinit();
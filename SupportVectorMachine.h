@@ -4,6 +4,9 @@
 #include "Common.h"
 #include "Feature.h"
 #include "PascalImageDatabase.h"
+#include "BoundedKernelPredictor.h"
+
+class FeatureStore;
 
 //! Support Vector Machine Class
 /*!
@@ -20,11 +23,21 @@ private:
     struct svm_node *_x_space;
 
     svm_node *_data;
+    std::vector<int> _trainIndices;  // Store samples of the last training problem, see getSupportVectorIndices
+    struct svm_warm_start *_warmStart; // Solver state of the last trainPath call, kept with _data
+
+    BoundedKernelPredictor *_bounded; // Set for two class kernel models
 
 private:
     //! De allocate memory
     void _deinit();
 
+    //! Sign that orients the libsvm decision values towards the positive class
+    double _decisionSign() const;
+
+    //! Prepare the bounded predictor once a model is available
+    void _initBoundedPredictor();
+
 public:
     //! Constructor
     SupportVectorMachine();
@@ -47,6 +60,36 @@ public:
     //! Train the SVM model
     void train(const std::vector<float> &labels, FeatureCollection &features, std::string svmModelFName);
 
+    //! Train the SVM model on some samples of a feature store
+    /*!
+        Only the scaled features of the given samples are copied in memory.
+        \param store Features and labels of the samples
+        \param indices Samples of the store in the training problem
+    */
+    void train(const FeatureStore &store, const std::vector<int> &indices);
+
+    //! Train the SVM model with another value of C, warm started from the solution of the last call
+    /*!
+        Every call must pass the same samples, the first one starts from scratch. The alphas of the
+        previous solution are scaled, or clipped, to the box of the new C and the solver starts from
+        their gradient and the kernel cache of the last solve, so a sweep over the values of C costs
+        little more than solving the hardest one. Only two class C_SVC problems are warm started.
+        \param c Value of the C parameter, it is kept for the next trainings
+    */
+    void trainPath(const std::vector<float> &labels, const FeatureCollection &features, double c);
+
+    //! Samples of the last training problem that became support vectors
+    /*!
+        Positions in the feature store, or in the feature collection, the model was trained on.
+    */
+    std::vector<int> getSupportVectorIndices() const;
+
+    //! Replace the model by a linear one
+    /*!
+        \param detector Weights followed by the bias term, in the format returned by getDetector
+    */
+    void setLinearModel(const std::vector<float> &detector);
+
     //! Predict the decision value of a feature
     /*! 
         Run classifier on feature, size of feature must match one used for model training.
@@ -74,11 +117,24 @@ public:
     */
     float predictLabel(const vector<float> &feature, double& decisionValue) const;
 
+    //! Decide if the decision value of a feature is above a threshold
+    /*!
+        Kernel models stop summing over the support vectors as soon as the answer is certain
+        (see BoundedKernelPredictor), other models fall back to the full decision value.
+        \param feature Pointer to dim HOG values
+        \param threshold Features scoring at or below this value are rejected
+        \param decisionValue Exact decision value when the result is true, upper bound of it otherwise
+    */
+    bool predictAbove(const float *feature, int dim, double threshold, double &decisionValue) const;
+
     //! Gets a collection of predictions given a collection of features
     std::vector<float> predict(const FeatureCollection &fset);
     std::vector<float> predictLabel(const FeatureCollection &fset) const;
 
     //! Get the primal form for the svm
+    /*!
+        Weights followed by the bias term, oriented so that positive scores belong to the positive class.
+    */
     std::vector<float> getDetector() const;
 
     //! Print the parameters chosen for the SVM
@@ -90,7 +146,7 @@ public:
 
     //! Get default parameters
     static ParametersMap getDefaultParameters();
-    ParametersMap getParameters();
+    ParametersMap getParameters() const;
 
     //Mat renderSVMWeights(const FeatureExtractor *featExtractor);
 
@@ -106,6 +162,23 @@ public:
     */
     void save(const std::string &filename) const;
 
+    //! Kernel used by the model (LINEAR, POLY, RBF, SIGMOID or PRECOMPUTED)
+    int getKernelType() const { return _param.kernel_type; }
+
+    //! Compress a RBF model with the reduced set method
+    /*!
+        The support vectors are clustered with k-means and the decision function is approximated
+        by the nVectors centers, whose coefficients are refit so that the weight vector in feature
+        space stays as close as possible to the original one. The result is written as a regular
+        libsvm model, so it loads through the model file constructor.
+        \param nVectors Number of vectors kept in the compressed model
+        \param filename Path where the compressed model will be located.
+    */
+    void compress(int nVectors, const std::string &filename) const;
+
+    //! Number of support vectors of the model
+    int getSupportVectorCount() const { return _model != NULL ? _model->l : 0; }
+
     //! Verify if the svm is initiallized
     bool initialized() const { return _model != NULL; }
 };
@@ -0,0 +1,280 @@
+#include "SyntheticDataset.h"
+#include "ImageList.h"
+#include "VocEvaluator.h"
+
+#define SYNTH_IMAGES_KEY          "synth_images"
+#define SYNTH_WIDTH_KEY           "synth_width"
+#define SYNTH_HEIGHT_KEY          "synth_height"
+#define SYNTH_MAX_OBJECTS_KEY     "synth_max_objects"
+#define SYNTH_SEED_KEY            "synth_seed"
+#define SYNTH_JPEG_QUALITY_KEY    "synth_jpeg_quality"
+#define SYNTH_TEST_FRACTION_KEY   "synth_test_fraction"
+
+using namespace cv;
+using namespace std;
+
+namespace fs = boost::filesystem;
+
+// Writes the image and the annotation of a range of images, every image fills its own slot
+class SyntheticImageWriter : public cv::ParallelLoopBody
+{
+public:
+    SyntheticImageWriter(const SyntheticDataset &dataset, const VocPaths &paths,
+                         vector<SyntheticDataset::ImageObjects> &objects, vector<string> &errors):
+        _dataset(dataset), _paths(paths), _objects(objects), _errors(errors)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        vector<int> jpegParams;
+        jpegParams.push_back(CV_IMWRITE_JPEG_QUALITY);
+        jpegParams.push_back(_dataset._jpegQuality);
+
+        for(int k = range.start; k < range.end; k++) {
+            // Exceptions can't cross the worker threads, they are raised again once all are done
+            try {
+                string imageId = SyntheticDataset::getImageId(k);
+                Mat img;
+                _dataset.render(imageId, img, _objects[k]);
+
+                string imageFName = _paths.getImageFilename(imageId);
+                if(!imwrite(imageFName, img, jpegParams))
+                    throw std::runtime_error("ERROR: Could not write image " + imageFName);
+
+                _dataset.saveAnnotation(_paths.getAnnotationFilename(imageId), imageId, _objects[k]);
+            } catch(std::exception &err) {
+                _errors[k] = err.what();
+            }
+        }
+    }
+
+private:
+    const SyntheticDataset &_dataset;
+    const VocPaths &_paths;
+    vector<SyntheticDataset::ImageObjects> &_objects;
+    vector<string> &_errors;
+};
+
+SyntheticDataset::SyntheticDataset(const ParametersMap &params)
+{
+    _nImages = params.getInt(SYNTH_IMAGES_KEY);
+    _width = params.getInt(SYNTH_WIDTH_KEY);
+    _height = params.getInt(SYNTH_HEIGHT_KEY);
+    _maxObjects = params.getInt(SYNTH_MAX_OBJECTS_KEY);
+    _seed = params.getInt(SYNTH_SEED_KEY);
+    _jpegQuality = params.getInt(SYNTH_JPEG_QUALITY_KEY);
+    _testFraction = params.getFloat(SYNTH_TEST_FRACTION_KEY);
+
+    if(_nImages < 1 || _maxObjects < 1)
+        throw std::runtime_error("ERROR: A synthetic dataset needs at least one image and one object per image");
+    if(_width < 128 || _height < 128)
+        throw std::runtime_error("ERROR: Synthetic images must be at least 128x128 pixels");
+    if(_testFraction < 0 || _testFraction >= 1)
+        throw std::runtime_error("ERROR: The test fraction must be in [0, 1)");
+}
+
+ParametersMap SyntheticDataset::getDefaultParameters()
+{
+    // Image size and split of VOC2007
+    ParametersMap params;
+    params.set(SYNTH_IMAGES_KEY, 1000);
+    params.set(SYNTH_WIDTH_KEY, 500);
+    params.set(SYNTH_HEIGHT_KEY, 375);
+    params.set(SYNTH_MAX_OBJECTS_KEY, 4);
+    params.set(SYNTH_SEED_KEY, 0);
+    params.set(SYNTH_JPEG_QUALITY_KEY, 90);
+    params.set(SYNTH_TEST_FRACTION_KEY, 0.5);
+    return params;
+}
+
+std::string SyntheticDataset::getImageId(int idx)
+{
+    char id[16];
+    sprintf(id, "%06d", idx + 1);
+    return id;
+}
+
+void SyntheticDataset::render(const std::string &imageId, cv::Mat &img, ImageObjects &objects) const
+{
+    RNG rng(imageSeed(imageId) ^ (uint64)_seed);
+
+    // Smooth blotches with some grain, so that backgrounds also produce gradients
+    Mat background(_height / 8, _width / 8, CV_8UC3);
+    rng.fill(background, RNG::UNIFORM, Scalar::all(40), Scalar::all(215));
+    resize(background, img, Size(_width, _height), 0, 0, INTER_CUBIC);
+    Mat grain(_height, _width, CV_8UC3);
+    rng.fill(grain, RNG::UNIFORM, Scalar::all(0), Scalar::all(12));
+    img += grain;
+    img -= Scalar::all(6);
+
+    Rect frame(0, 0, _width, _height);
+    int nObjects = rng.uniform(1, _maxObjects + 1);
+    for(int i = 0; i < nObjects; i++) {
+        int category = rng.uniform(0, VocEvaluator::getCategoryCount());
+
+        // Height over width from 0.5 to 2.1, persons are the tallest
+        double aspect = (0.5 + (category % 5) * 0.4) * rng.uniform(0.85, 1.15);
+        int height = rng.uniform(std::max(40, _height * 3 / 20), _height * 4 / 5 + 1);
+        int width = std::min(std::max(cvRound(height / aspect), 16), _width * 9 / 10);
+
+        // Up to a quarter of the object may lay outside of the image
+        Rect box(rng.uniform(-width / 4, _width - width * 3 / 4),
+                 rng.uniform(-height / 4, _height - height * 3 / 4), width, height);
+        Rect visible = box & frame;
+
+        // Color from the hue wheel, the shape and the stripes tell apart classes with close hues
+        Mat hsv(1, 1, CV_8UC3, Scalar(category * 9, 200, 220)), bgr;
+        cvtColor(hsv, bgr, CV_HSV2BGR);
+        Vec3b c = bgr.at<Vec3b>(0, 0);
+        Scalar color(c[0], c[1], c[2]);
+        Scalar dark = color * 0.4;
+
+        Point center(box.x + box.width / 2, box.y + box.height / 2);
+        switch(category % 4) {
+        case 0:
+            rectangle(img, box, color, CV_FILLED);
+            break;
+        case 1:
+            ellipse(img, center, Size(box.width / 2, box.height / 2), 0, 0, 360, color, CV_FILLED);
+            break;
+        case 2: {
+            Point triangle[3] = { Point(center.x, box.y), Point(box.x, box.br().y - 1), Point(box.br().x - 1, box.br().y - 1) };
+            fillConvexPoly(img, triangle, 3, color);
+            break;
+        }
+        default:
+            rectangle(img, box, color, CV_FILLED);
+            line(img, box.tl(), box.br(), dark, std::max(box.width / 10, 2));
+            line(img, Point(box.x, box.br().y), Point(box.br().x, box.y), dark, std::max(box.width / 10, 2));
+            break;
+        }
+
+        int nStripes = category / 4;
+        for(int s = 1; s <= nStripes; s++) {
+            int y = box.y + box.height * s / (nStripes + 1);
+            line(img, Point(box.x + box.width / 4, y), Point(box.br().x - box.width / 4, y), dark, std::max(box.height / 24, 2));
+        }
+        rectangle(img, box, dark, 2);
+
+        objects.categories.push_back(category);
+        objects.boxes.push_back(visible);
+        objects.truncated.push_back(visible != box);
+        objects.difficult.push_back(visible.area() * 2 < box.area());
+    }
+}
+
+void SyntheticDataset::saveAnnotation(const std::string &filename, const std::string &imageId, const ImageObjects &objects) const
+{
+    ofstream f(filename.c_str());
+    if(!f.is_open())
+        throw std::runtime_error("ERROR: Could not open file " + filename + " for writing");
+
+    // Every field read by pascal_annotation, the boxes use the 1 based inclusive coordinates of VOC
+    f << "<annotation>\n"
+      << "\t<folder>VOC2007</folder>\n"
+      << "\t<filename>" << imageId << ".jpg</filename>\n"
+      << "\t<source>\n"
+      << "\t\t<database>Synthetic VOC</database>\n"
+      << "\t\t<annotation>SYNTH</annotation>\n"
+      << "\t\t<image>synthetic</image>\n"
+      << "\t\t<flickrid>0</flickrid>\n"
+      << "\t</source>\n"
+      << "\t<owner>\n"
+      << "\t\t<flickrid>0</flickrid>\n"
+      << "\t\t<name>SYNTH</name>\n"
+      << "\t</owner>\n"
+      << "\t<size>\n"
+      << "\t\t<width>" << _width << "</width>\n"
+      << "\t\t<height>" << _height << "</height>\n"
+      << "\t\t<depth>3</depth>\n"
+      << "\t</size>\n"
+      << "\t<segmented>0</segmented>\n";
+
+    for(int i = 0; i < objects.categories.size(); i++) {
+        const Rect &box = objects.boxes[i];
+        f << "\t<object>\n"
+          << "\t\t<name>" << VocEvaluator::getCategoryName(objects.categories[i]) << "</name>\n"
+          << "\t\t<pose>Unspecified</pose>\n"
+          << "\t\t<truncated>" << (objects.truncated[i] ? 1 : 0) << "</truncated>\n"
+          << "\t\t<difficult>" << (objects.difficult[i] ? 1 : 0) << "</difficult>\n"
+          << "\t\t<bndbox>\n"
+          << "\t\t\t<xmin>" << box.x + 1 << "</xmin>\n"
+          << "\t\t\t<ymin>" << box.y + 1 << "</ymin>\n"
+          << "\t\t\t<xmax>" << box.br().x << "</xmax>\n"
+          << "\t\t\t<ymax>" << box.br().y << "</ymax>\n"
+          << "\t\t</bndbox>\n"
+          << "\t</object>\n";
+    }
+    f << "</annotation>\n";
+
+    if(!f.good())
+        throw std::runtime_error("ERROR: Could not write annotation " + filename);
+}
+
+void SyntheticDataset::saveImageSets(const VocPaths &paths, const std::vector<ImageObjects> &objects) const
+{
+    // The first images form trainval, split in alternating train and val images, the rest is test
+    int nTrainval = cvRound(_nImages * (1 - _testFraction));
+    const char *setNames[] = { "train", "val", "trainval", "test" };
+    vector<vector<int> > sets(4);
+    for(int k = 0; k < _nImages; k++) {
+        if(k < nTrainval) {
+            sets[k % 2].push_back(k);
+            sets[2].push_back(k);
+        } else {
+            sets[3].push_back(k);
+        }
+    }
+
+    // 1 when the image shows the class, 0 when all its instances are difficult, -1 otherwise
+    int nCategories = VocEvaluator::getCategoryCount();
+    vector<vector<int> > labels(_nImages, vector<int>(nCategories, -1));
+    for(int k = 0; k < _nImages; k++) {
+        for(int i = 0; i < objects[k].categories.size(); i++) {
+            int &label = labels[k][objects[k].categories[i]];
+            label = std::max(label, objects[k].difficult[i] ? 0 : 1);
+        }
+    }
+
+    for(int s = 0; s < sets.size(); s++) {
+        string setFName = (fs::path(paths.getImageSetsDir()) / (string(setNames[s]) + ".txt")).string();
+        ofstream f(setFName.c_str());
+        for(int i = 0; i < sets[s].size(); i++)
+            f << getImageId(sets[s][i]) << "\n";
+        if(!f.good())
+            throw std::runtime_error("ERROR: Could not write image set " + setFName);
+
+        for(int c = 0; c < nCategories; c++) {
+            string categoryFName = (fs::path(paths.getImageSetsDir()) /
+                                    (VocEvaluator::getCategoryName(c) + "_" + setNames[s] + ".txt")).string();
+            ofstream cf(categoryFName.c_str());
+            for(int i = 0; i < sets[s].size(); i++)
+                cf << getImageId(sets[s][i]) << " " << setw(2) << labels[sets[s][i]][c] << "\n";
+            if(!cf.good())
+                throw std::runtime_error("ERROR: Could not write image set " + categoryFName);
+        }
+    }
+}
+
+void SyntheticDataset::generate(const VocPaths &paths) const
+{
+    fs::create_directories(paths.getImagesDir());
+    fs::create_directories(paths.getAnnotationsDir());
+    fs::create_directories(paths.getImageSetsDir());
+
+    vector<ImageObjects> objects(_nImages);
+    vector<string> errors(_nImages);
+    parallel_for_(Range(0, _nImages), SyntheticImageWriter(*this, paths, objects, errors));
+
+    int nObjects = 0;
+    for(int k = 0; k < _nImages; k++) {
+        if(!errors[k].empty())
+            throw std::runtime_error(errors[k]);
+        nObjects += objects[k].categories.size();
+    }
+
+    saveImageSets(paths, objects);
+
+    LOG(INFO) << "Generated " << _nImages << " images with " << nObjects << " objects in: " << paths.getRoot();
+}
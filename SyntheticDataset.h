@@ -0,0 +1,68 @@
+#ifndef SYNTHETIC_DATASET_H
+#define SYNTHETIC_DATASET_H
+
+#include "Common.h"
+#include "ParametersMap.h"
+#include "VocPaths.h"
+
+//! Synthetic Dataset Class
+/*!
+    This class writes a dataset in the VOC devkit layout with any number of images, so the
+    training and detection pipelines can be timed at scales the real dataset doesn't reach.
+    Every image shows a textured background with a few objects of the 20 VOC classes, each
+    class is drawn with its own color, shape, stripe pattern and aspect ratio so that a
+    detector can actually learn it.
+
+    The images, annotations and image sets are complete enough for every mode of the program:
+    JPEGImages/<id>.jpg, Annotations/<id>.xml and ImageSets/Main/{train,val,trainval,test}.txt
+    along with the per class <class>_<set>.txt lists labelled 1, -1 or 0 (difficult only).
+
+    The content of an image only depends on its id and on the seed, so the images are generated
+    in parallel and a dataset can be regenerated, or grown, identically.
+*/
+class SyntheticDataset
+{
+public:
+    //! Constructor
+    /*!
+        \param params Size of the dataset and of its images, see getDefaultParameters
+    */
+    SyntheticDataset(const ParametersMap &params = getDefaultParameters());
+
+    static ParametersMap getDefaultParameters();
+
+    //! Generate the dataset, existing files with the same names are overwritten
+    /*!
+        \param paths Root of the dataset, the directories are created when missing
+    */
+    void generate(const VocPaths &paths) const;
+
+    //! Id of the image at a position of the dataset, e.g. 000001 for the first one
+    static std::string getImageId(int idx);
+
+private:
+    // Objects of one generated image
+    struct ImageObjects
+    {
+        std::vector<int> categories;
+        std::vector<cv::Rect> boxes;
+        std::vector<bool> truncated;
+        std::vector<bool> difficult;
+    };
+
+    void render(const std::string &imageId, cv::Mat &img, ImageObjects &objects) const;
+    void saveAnnotation(const std::string &filename, const std::string &imageId, const ImageObjects &objects) const;
+    void saveImageSets(const VocPaths &paths, const std::vector<ImageObjects> &objects) const;
+
+    int _nImages;
+    int _width;
+    int _height;
+    int _maxObjects;
+    int _seed;
+    int _jpegQuality;
+    double _testFraction;
+
+    friend class SyntheticImageWriter;
+};
+
+#endif // SYNTHETIC_DATASET_H
@@ -0,0 +1,179 @@
+#include "Trace.h"
+
+#include <boost/thread.hpp>
+
+using namespace std;
+
+struct TraceEvent
+{
+    const char *name;
+    int64_t start;
+    int64_t end;        // -1 for counter samples
+    int64_t value;
+};
+
+struct TraceTotals
+{
+    TraceTotals(): calls(0), total(0), max(0) {}
+
+    int64_t calls;
+    int64_t total;      // Ticks
+    int64_t max;
+};
+
+// Events of one thread, only written by that thread
+struct ThreadBuffer
+{
+    int tid;
+    vector<TraceEvent> events;
+    int64_t recorded;                       // Events recorded, the ring holds the last ones
+    map<const char *, TraceTotals> totals;  // Keyed by the name pointer, merged by value on output
+};
+
+bool Trace::_enabled = false;
+
+static int _eventsPerThread = 0;
+static int64_t _origin = 0;
+
+// Buffers are owned by the registry so that the events of finished threads are kept
+static boost::mutex _registryMutex;
+static vector<ThreadBuffer *> _buffers;
+
+static void keepBuffer(ThreadBuffer *)
+{
+}
+
+static boost::thread_specific_ptr<ThreadBuffer> _threadBuffer(keepBuffer);
+
+static ThreadBuffer *threadBuffer()
+{
+    ThreadBuffer *buffer = _threadBuffer.get();
+    if(buffer == NULL) {
+        buffer = new ThreadBuffer();
+        buffer->events.resize(_eventsPerThread);
+        buffer->recorded = 0;
+
+        boost::lock_guard<boost::mutex> lock(_registryMutex);
+        buffer->tid = _buffers.size();
+        _buffers.push_back(buffer);
+        _threadBuffer.reset(buffer);
+    }
+    return buffer;
+}
+
+static map<string, TraceTotals> mergeTotals()
+{
+    map<string, TraceTotals> merged;
+    for(int i = 0; i < _buffers.size(); i++) {
+        map<const char *, TraceTotals> &totals = _buffers[i]->totals;
+        for(map<const char *, TraceTotals>::const_iterator it = totals.begin(); it != totals.end(); ++it) {
+            TraceTotals &t = merged[it->first];
+            t.calls += it->second.calls;
+            t.total += it->second.total;
+            t.max = std::max(t.max, it->second.max);
+        }
+    }
+    return merged;
+}
+
+void Trace::enable(int eventsPerThread)
+{
+    _eventsPerThread = std::max(eventsPerThread, 1);
+    _origin = cv::getTickCount();
+    _enabled = true;
+}
+
+void Trace::record(const char *name, int64_t start, int64_t end)
+{
+    ThreadBuffer *buffer = threadBuffer();
+
+    TraceEvent &event = buffer->events[buffer->recorded % buffer->events.size()];
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    event.value = 0;
+    buffer->recorded++;
+
+    TraceTotals &totals = buffer->totals[name];
+    totals.calls++;
+    totals.total += end - start;
+    totals.max = std::max(totals.max, end - start);
+}
+
+void Trace::recordCounter(const char *name, int64_t value)
+{
+    ThreadBuffer *buffer = threadBuffer();
+
+    TraceEvent &event = buffer->events[buffer->recorded % buffer->events.size()];
+    event.name = name;
+    event.start = cv::getTickCount();
+    event.end = -1;
+    event.value = value;
+    buffer->recorded++;
+}
+
+void Trace::saveChromeTrace(const std::string &filename)
+{
+    ofstream f(filename.c_str());
+    if(!f.is_open())
+        throw std::runtime_error("ERROR: Could not open file " + filename + " for writing");
+
+    // Complete events ("ph":"X") and counters ("ph":"C") with microsecond timestamps relative to enable()
+    double usPerTick = 1e6 / cv::getTickFrequency();
+    int64_t dropped = 0;
+
+    boost::lock_guard<boost::mutex> lock(_registryMutex);
+    f << "{\"traceEvents\":[";
+    bool first = true;
+    for(int i = 0; i < _buffers.size(); i++) {
+        const ThreadBuffer &buffer = *_buffers[i];
+        int64_t capacity = buffer.events.size();
+        int64_t begin = std::max(buffer.recorded - capacity, (int64_t)0);
+        dropped += begin;
+
+        for(int64_t e = begin; e < buffer.recorded; e++) {
+            const TraceEvent &event = buffer.events[e % capacity];
+            f << (first ? "\n" : ",\n") << fixed << setprecision(3)
+              << "{\"name\":\"" << event.name << "\",\"ph\":\"" << (event.end < 0 ? "C" : "X")
+              << "\",\"pid\":1,\"tid\":" << buffer.tid << ",\"ts\":" << (event.start - _origin) * usPerTick;
+            if(event.end < 0)
+                f << ",\"args\":{\"items\":" << event.value << "}}";
+            else
+                f << ",\"dur\":" << (event.end - event.start) * usPerTick << "}";
+            first = false;
+        }
+    }
+    f << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    if(!f.good())
+        throw std::runtime_error("ERROR: Could not write trace " + filename);
+
+    LOG(INFO) << "Trace of " << _buffers.size() << " threads saved in: " << filename;
+    if(dropped > 0)
+        LOG(WARNING) << dropped << " older events overwritten in the trace ring buffers";
+}
+
+void Trace::printSummary(std::ostream &s)
+{
+    boost::lock_guard<boost::mutex> lock(_registryMutex);
+    map<string, TraceTotals> merged = mergeTotals();
+
+    // Stages sorted by total time, nested stages are also counted in their parents
+    vector<pair<int64_t, string> > order;
+    for(map<string, TraceTotals>::const_iterator it = merged.begin(); it != merged.end(); ++it)
+        order.push_back(make_pair(-it->second.total, it->first));
+    sort(order.begin(), order.end());
+
+    double msPerTick = 1e3 / cv::getTickFrequency();
+    ios::fmtflags flags = s.flags();
+    s << left << setw(24) << "Stage" << right << setw(12) << "Calls" << setw(14) << "Total (ms)"
+      << setw(14) << "Mean (ms)" << setw(14) << "Max (ms)" << endl;
+    for(int i = 0; i < order.size(); i++) {
+        const TraceTotals &t = merged[order[i].second];
+        s << left << setw(24) << order[i].second << right << setw(12) << t.calls << fixed << setprecision(3)
+          << setw(14) << t.total * msPerTick
+          << setw(14) << t.total * msPerTick / t.calls
+          << setw(14) << t.max * msPerTick << endl;
+    }
+    s.flags(flags);
+}
@@ -0,0 +1,78 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "Common.h"
+
+//! Trace Class
+/*!
+    This class records how long the stages of a run take. Stages are timed with the
+    TRACE_SCOPE macro, every thread appends its events to its own ring buffer, so recording
+    never takes a lock, and keeps running totals per stage for the summary. When tracing is
+    disabled a scope only checks a flag.
+
+    The events can be exported in the Chrome trace format (chrome://tracing or Perfetto) and
+    summarized in a table. Both must be called once the traced threads are done.
+*/
+class Trace
+{
+public:
+    //! Start recording
+    /*!
+        \param eventsPerThread Capacity of the ring buffer of every thread, older events are overwritten
+    */
+    static void enable(int eventsPerThread = 1 << 16);
+
+    //! Tracing state, scopes are only timed when enabled
+    static bool isEnabled() { return _enabled; }
+
+    //! Record an event of the calling thread
+    /*!
+        \param name Stage name, it must be a string literal or outlive the trace
+        \param start Tick count when the stage started (cv::getTickCount)
+        \param end Tick count when the stage finished
+    */
+    static void record(const char *name, int64_t start, int64_t end);
+
+    //! Record the value of a counter at the current time, shown as a graph in the trace
+    /*!
+        \param name Counter name, it must be a string literal or outlive the trace
+        \param value Counter value, e.g. the items processed so far (see Progress)
+    */
+    static void recordCounter(const char *name, int64_t value);
+
+    //! Write the buffered events in the Chrome trace JSON format
+    static void saveChromeTrace(const std::string &filename);
+
+    //! Print the number of calls, total, mean and maximum time of every stage
+    static void printSummary(std::ostream &s);
+
+private:
+    static bool _enabled;
+};
+
+//! Times the enclosing scope, see TRACE_SCOPE
+class TraceScope
+{
+public:
+    TraceScope(const char *name):
+        _name(name), _start(Trace::isEnabled() ? cv::getTickCount() : 0)
+    {
+    }
+
+    ~TraceScope()
+    {
+        if(_start != 0) Trace::record(_name, _start, cv::getTickCount());
+    }
+
+private:
+    const char *_name;
+    int64_t _start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+//! Record the time spent until the end of the current scope under name
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#endif // TRACE_H
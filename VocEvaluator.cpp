@@ -0,0 +1,293 @@
+#include "VocEvaluator.h"
+#include "ImageList.h"
+
+using namespace std;
+
+static const char *VOC_CATEGORIES[] = {
+    "aeroplane", "bicycle", "bird", "boat", "bottle", "bus", "car", "cat", "chair", "cow",
+    "diningtable", "dog", "horse", "motorbike", "person", "pottedplant", "sheep", "sofa", "train", "tvmonitor"
+};
+
+static const int N_VOC_CATEGORIES = sizeof(VOC_CATEGORIES) / sizeof(VOC_CATEGORIES[0]);
+
+static bool sortByDecreasingScore(const VocDetection &a, const VocDetection &b)
+{
+    return a.score > b.score;
+}
+
+// Reads the annotation of a range of images, every image writes its own slot
+class AnnotationLoader : public cv::ParallelLoopBody
+{
+public:
+    AnnotationLoader(const vector<string> &imageIds, const AnnotationIndex *index, const string &annotationsDir,
+                     vector<pascal_annotation> &annotations, vector<string> &errors):
+        _imageIds(imageIds), _index(index), _annotationsDir(annotationsDir), _annotations(annotations), _errors(errors)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        for(int k = range.start; k < range.end; k++) {
+            // Exceptions can't cross the worker threads, they are raised again once all are done
+            try {
+                if(_index != NULL) {
+                    if(!_index->find(_imageIds[k], _annotations[k]))
+                        _errors[k] = "ERROR: Image " + _imageIds[k] + " is not in the annotation index";
+                } else {
+                    _annotations[k].load(_annotationsDir + "/" + _imageIds[k] + ".xml");
+                }
+            } catch(std::exception &err) {
+                _errors[k] = err.what();
+            }
+        }
+    }
+
+private:
+    const vector<string> &_imageIds;
+    const AnnotationIndex *_index;
+    const string &_annotationsDir;
+    vector<pascal_annotation> &_annotations;
+    vector<string> &_errors;
+};
+
+// Evaluates one class per iteration
+class CategoryEvaluator : public cv::ParallelLoopBody
+{
+public:
+    CategoryEvaluator(const VocEvaluator &evaluator, const vector<int> &categories,
+                      const vector<vector<VocDetection> > &detections, vector<VocClassResult> &results):
+        _evaluator(evaluator), _categories(categories), _detections(detections), _results(results)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        for(int k = range.start; k < range.end; k++)
+            _results[k] = _evaluator.evaluate(_categories[k], _detections[k]);
+    }
+
+private:
+    const VocEvaluator &_evaluator;
+    const vector<int> &_categories;
+    const vector<vector<VocDetection> > &_detections;
+    vector<VocClassResult> &_results;
+};
+
+VocEvaluator::VocEvaluator(const std::string &imageSetFilename, const AnnotationIndex *index, const std::string &annotationsDir,
+                           double minOverlap):
+    _minOverlap(minOverlap)
+{
+    ImageList list(imageSetFilename);
+    for(int i = 0; i < list.getSize(); i++) {
+        string id = list.getName(i);
+        if(_imageIndex.count(id) == 0) {
+            _imageIndex[id] = _imageIds.size();
+            _imageIds.push_back(id);
+        }
+    }
+
+    vector<pascal_annotation> annotations(_imageIds.size());
+    vector<string> errors(_imageIds.size());
+    cv::parallel_for_(cv::Range(0, _imageIds.size()), AnnotationLoader(_imageIds, index, annotationsDir, annotations, errors));
+
+    for(int i = 0; i < errors.size(); i++) {
+        if(!errors[i].empty())
+            throw std::runtime_error(errors[i]);
+    }
+
+    _objects.assign(N_VOC_CATEGORIES, vector<vector<Object> >(_imageIds.size()));
+    _nPositives.assign(N_VOC_CATEGORIES, 0);
+    for(int i = 0; i < annotations.size(); i++) {
+        for(int j = 0; j < annotations[i].objects.size(); j++) {
+            const object_annotation &o = annotations[i].objects[j];
+            int category = getCategoryIndex(o.name);
+            if(category < 0) continue;
+
+            Object object;
+            object.xmin = o.bndbox.xmin;
+            object.ymin = o.bndbox.ymin;
+            object.xmax = o.bndbox.xmax;
+            object.ymax = o.bndbox.ymax;
+            object.difficult = o.difficult;
+            _objects[category][i].push_back(object);
+
+            if(!object.difficult) _nPositives[category]++;
+        }
+    }
+}
+
+int VocEvaluator::getImageIndex(const std::string &imageId) const
+{
+    map<string, int>::const_iterator it = _imageIndex.find(imageId);
+    return (it == _imageIndex.end()) ? -1 : it->second;
+}
+
+int VocEvaluator::loadDetections(const std::string &filename, std::vector<VocDetection> &detections) const
+{
+    ifstream f(filename.c_str());
+    if(!f.is_open()) {
+        throw std::runtime_error("ERROR: Could not open file " + filename + " for reading");
+    }
+
+    int skipped = 0;
+    string id;
+    VocDetection det;
+    while(f >> id >> det.score >> det.xmin >> det.ymin >> det.xmax >> det.ymax) {
+        det.image = getImageIndex(id);
+        if(det.image < 0) {
+            skipped++;
+            continue;
+        }
+        detections.push_back(det);
+    }
+
+    return skipped;
+}
+
+VocClassResult VocEvaluator::evaluate(int category, const std::vector<VocDetection> &detections) const
+{
+    const vector<vector<Object> > &objects = _objects[category];
+
+    vector<VocDetection> sorted(detections);
+    stable_sort(sorted.begin(), sorted.end(), sortByDecreasingScore);
+
+    // Objects already matched by a higher scoring detection
+    vector<vector<bool> > matched(objects.size());
+    for(int i = 0; i < objects.size(); i++)
+        matched[i].assign(objects[i].size(), false);
+
+    vector<int> tp(sorted.size(), 0), fp(sorted.size(), 0);
+    for(int d = 0; d < sorted.size(); d++) {
+        const VocDetection &det = sorted[d];
+        const vector<Object> &candidates = objects[det.image];
+
+        double bestOverlap = -1;
+        int best = -1;
+        for(int j = 0; j < candidates.size(); j++) {
+            const Object &o = candidates[j];
+            float iw = std::min(det.xmax, o.xmax) - std::max(det.xmin, o.xmin) + 1;
+            float ih = std::min(det.ymax, o.ymax) - std::max(det.ymin, o.ymin) + 1;
+            if(iw <= 0 || ih <= 0) continue;
+
+            double unionArea = (det.xmax - det.xmin + 1) * (det.ymax - det.ymin + 1) +
+                               (o.xmax - o.xmin + 1) * (o.ymax - o.ymin + 1) - iw * ih;
+            double overlap = iw * ih / unionArea;
+            if(overlap > bestOverlap) {
+                bestOverlap = overlap;
+                best = j;
+            }
+        }
+
+        if(bestOverlap >= _minOverlap) {
+            if(candidates[best].difficult) continue;
+
+            if(!matched[det.image][best]) {
+                tp[d] = 1;
+                matched[det.image][best] = true;
+            } else {
+                fp[d] = 1;
+            }
+        } else {
+            fp[d] = 1;
+        }
+    }
+
+    VocClassResult result;
+    result.category = getCategoryName(category);
+    result.nGroundTruth = _nPositives[category];
+    result.nDetections = sorted.size();
+
+    vector<double> precision(sorted.size()), recall(sorted.size());
+    int cumTp = 0, cumFp = 0;
+    for(int d = 0; d < sorted.size(); d++) {
+        cumTp += tp[d];
+        cumFp += fp[d];
+        recall[d] = (result.nGroundTruth > 0) ? (double)cumTp / result.nGroundTruth : 0;
+        precision[d] = (cumTp + cumFp > 0) ? (double)cumTp / (cumTp + cumFp) : 0;
+    }
+    result.nTruePositives = cumTp;
+
+    // 11 point interpolation: mean of the best precision reached at recall 0, 0.1, ..., 1
+    result.averagePrecision11 = 0;
+    for(int t = 0; t <= 10; t++) {
+        double p = 0;
+        for(int d = 0; d < sorted.size(); d++) {
+            if(recall[d] >= t / 10.0) p = std::max(p, precision[d]);
+        }
+        result.averagePrecision11 += p / 11;
+    }
+
+    // Area under the curve made monotonically decreasing, sampled where the recall changes
+    vector<double> mrec(1, 0.0), mpre(1, 0.0);
+    mrec.insert(mrec.end(), recall.begin(), recall.end());
+    mpre.insert(mpre.end(), precision.begin(), precision.end());
+    mrec.push_back(1);
+    mpre.push_back(0);
+    for(int i = mpre.size() - 2; i >= 0; i--)
+        mpre[i] = std::max(mpre[i], mpre[i + 1]);
+
+    result.averagePrecisionArea = 0;
+    for(int i = 1; i < mrec.size(); i++) {
+        if(mrec[i] != mrec[i - 1])
+            result.averagePrecisionArea += (mrec[i] - mrec[i - 1]) * mpre[i];
+    }
+
+    return result;
+}
+
+void VocEvaluator::evaluate(const std::vector<int> &categories, const std::vector<std::vector<VocDetection> > &detections,
+                            std::vector<VocClassResult> &results) const
+{
+    if(categories.size() != detections.size())
+        throw std::runtime_error("ERROR: One detection list is needed per evaluated class");
+
+    results.resize(categories.size());
+    cv::parallel_for_(cv::Range(0, categories.size()), CategoryEvaluator(*this, categories, detections, results));
+}
+
+int VocEvaluator::getCategoryCount()
+{
+    return N_VOC_CATEGORIES;
+}
+
+std::string VocEvaluator::getCategoryName(int category)
+{
+    return VOC_CATEGORIES[category];
+}
+
+int VocEvaluator::getCategoryIndex(const std::string &name)
+{
+    for(int i = 0; i < N_VOC_CATEGORIES; i++) {
+        if(boost::iequals(name, VOC_CATEGORIES[i])) return i;
+    }
+    return -1;
+}
+
+ostream &operator<<(ostream &s, const vector<VocClassResult> &results)
+{
+    streamsize precision = s.precision();
+
+    s << "VOC EVALUATION\n"
+      << setw(14) << left << "Class" << right << setw(8) << "Objects" << setw(8) << "Dets" << setw(8) << "TP"
+      << setw(10) << "AP 11pt" << setw(10) << "AP area" << "\n";
+
+    double mean11 = 0, meanArea = 0;
+    for(int i = 0; i < results.size(); i++) {
+        const VocClassResult &r = results[i];
+        s << setw(14) << left << r.category << right << setw(8) << r.nGroundTruth << setw(8) << r.nDetections
+          << setw(8) << r.nTruePositives << fixed << setprecision(4) << setw(10) << r.averagePrecision11
+          << setw(10) << r.averagePrecisionArea << "\n";
+        s.unsetf(ios::fixed);
+        mean11 += r.averagePrecision11;
+        meanArea += r.averagePrecisionArea;
+    }
+
+    if(!results.empty()) {
+        s << setw(14) << left << "mean" << right << setw(24) << "" << fixed << setprecision(4)
+          << setw(10) << mean11 / results.size() << setw(10) << meanArea / results.size() << "\n";
+        s.unsetf(ios::fixed);
+    }
+
+    s.precision(precision);
+    return s;
+}
@@ -0,0 +1,99 @@
+#ifndef VOC_EVALUATOR_H
+#define VOC_EVALUATOR_H
+
+#include "Common.h"
+#include "AnnotationIndex.h"
+
+//! Detection of one class in VOC results format
+struct VocDetection
+{
+    int image;                            // Position of the image in the image set
+    float score;
+    float xmin, ymin, xmax, ymax;
+};
+
+//! Evaluation of one class
+struct VocClassResult
+{
+    std::string category;
+    int nGroundTruth;                     // Objects not marked as difficult
+    int nDetections;
+    int nTruePositives;
+    double averagePrecision11;            // VOC2007 11 point interpolated average precision
+    double averagePrecisionArea;          // VOC2010 onwards, area under the monotone curve
+};
+
+//! VOC Evaluator Class
+/*!
+    This class evaluates the detections of every PASCAL VOC class on an image set in one pass.
+    The ground truth of all the classes is loaded once, from an AnnotationIndex when available or
+    from the XML annotations otherwise, and the classes are evaluated in parallel following the
+    VOC development kit: detections are matched in decreasing score order to the unmatched object
+    with the largest overlap (at least minOverlap, boxes in inclusive pixel coordinates), matches
+    to objects marked as difficult are ignored and difficult objects don't count as positives.
+*/
+class VocEvaluator
+{
+public:
+    //! Constructor
+    /*!
+        \param imageSetFilename Image set file, one image id per line
+        \param index Annotation index, NULL to read the XML files of annotationsDir
+        \param annotationsDir Annotations directory of the dataset
+        \param minOverlap Minimum intersection over union of a match
+    */
+    VocEvaluator(const std::string &imageSetFilename, const AnnotationIndex *index, const std::string &annotationsDir,
+                 double minOverlap = 0.5);
+
+    //! Number of images in the image set
+    int getImageCount() const { return _imageIds.size(); }
+
+    //! Position of an image in the image set, -1 if the image is not part of it
+    int getImageIndex(const std::string &imageId) const;
+
+    //! Read a results file with one "<image id> <score> <xmin> <ymin> <xmax> <ymax>" detection per line
+    /*!
+        Coordinates follow the devkit: 1-based and inclusive, like the annotations they are matched to.
+        \return Number of detections skipped because their image is not in the image set
+    */
+    int loadDetections(const std::string &filename, std::vector<VocDetection> &detections) const;
+
+    //! Evaluate the detections of one class
+    VocClassResult evaluate(int category, const std::vector<VocDetection> &detections) const;
+
+    //! Evaluate several classes in parallel
+    /*!
+        \param categories Class of every detection list, see getCategoryIndex
+        \param detections Detections of every class
+        \param results Evaluation of every class, in the same order
+    */
+    void evaluate(const std::vector<int> &categories, const std::vector<std::vector<VocDetection> > &detections,
+                  std::vector<VocClassResult> &results) const;
+
+    //! Number of VOC classes
+    static int getCategoryCount();
+
+    //! Name of a VOC class
+    static std::string getCategoryName(int category);
+
+    //! Position of a class name, -1 if it isn't a VOC class
+    static int getCategoryIndex(const std::string &name);
+
+private:
+    struct Object
+    {
+        float xmin, ymin, xmax, ymax;
+        bool difficult;
+    };
+
+    double _minOverlap;
+    std::vector<std::string> _imageIds;
+    std::map<std::string, int> _imageIndex;
+    std::vector<std::vector<std::vector<Object> > > _objects;   // Objects by class and image
+    std::vector<int> _nPositives;                               // Objects not marked difficult by class
+};
+
+//! Prints the per class and mean average precision
+std::ostream &operator<<(std::ostream &s, const std::vector<VocClassResult> &results);
+
+#endif // VOC_EVALUATOR_H
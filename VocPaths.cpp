@@ -0,0 +1,42 @@
+#include "VocPaths.h"
+
+using namespace std;
+
+namespace fs = boost::filesystem;
+
+VocPaths::VocPaths(const std::string &root):
+    _root(root)
+{
+}
+
+std::string VocPaths::getAnnotationsDir() const
+{
+    return (fs::path(_root) / "Annotations").string();
+}
+
+std::string VocPaths::getImagesDir() const
+{
+    return (fs::path(_root) / "JPEGImages").string();
+}
+
+std::string VocPaths::getImageSetsDir() const
+{
+    return (fs::path(_root) / "ImageSets" / "Main").string();
+}
+
+std::string VocPaths::getAnnotationFilename(const std::string &imageId) const
+{
+    return (fs::path(_root) / "Annotations" / (imageId + ".xml")).string();
+}
+
+std::string VocPaths::getImageFilename(const std::string &imageId) const
+{
+    return (fs::path(_root) / "JPEGImages" / (imageId + ".jpg")).string();
+}
+
+std::string VocPaths::getDefaultRoot()
+{
+    const char *root = getenv("VOC_ROOT");
+    if(root != NULL && root[0] != '\0') return root;
+    return "VOCdevkit/VOC2007";
+}
@@ -0,0 +1,38 @@
+#ifndef VOC_PATHS_H
+#define VOC_PATHS_H
+
+#include "Common.h"
+
+//! VOC Paths Class
+/*!
+    This class locates the files of a dataset laid out like the VOC devkit: the Annotations,
+    JPEGImages and ImageSets/Main directories under one root directory.
+*/
+class VocPaths
+{
+public:
+    //! Constructor
+    /*!
+        \param root Directory containing Annotations, JPEGImages and ImageSets
+    */
+    VocPaths(const std::string &root = getDefaultRoot());
+
+    const std::string &getRoot() const { return _root; }
+    std::string getAnnotationsDir() const;
+    std::string getImagesDir() const;
+    std::string getImageSetsDir() const;
+
+    //! Annotation file of an image, e.g. <root>/Annotations/000005.xml
+    std::string getAnnotationFilename(const std::string &imageId) const;
+
+    //! Image file of an image, e.g. <root>/JPEGImages/000005.jpg
+    std::string getImageFilename(const std::string &imageId) const;
+
+    //! The VOC_ROOT environment variable, or VOCdevkit/VOC2007 in the working directory
+    static std::string getDefaultRoot();
+
+private:
+    std::string _root;
+};
+
+#endif // VOC_PATHS_H
@@ -0,0 +1,549 @@
+#include "Common.h"
+#include "Detection.h"
+#include "Feature.h"
+#include "ImageSource.h"
+#include "NonMaximaSuppression.h"
+#include "ObjectDetector.h"
+#include "PrecisionRecall.h"
+#include "Progress.h"
+#include "SupportVectorMachine.h"
+
+#include <boost/thread.hpp>
+#include <boost/lexical_cast.hpp>
+
+using namespace std;
+
+// Every benchmark builds its inputs from these seeds, so runs are comparable across machines
+#define BENCH_SEED        0x0b7ec7
+#define HOG_DIM           3780
+#define IMAGE_WIDTH       640
+#define IMAGE_HEIGHT      480
+
+// Synthetic data
+// ============================================================================
+
+// Textured background with a few filled shapes, enough gradients for HOG to do real work
+Mat syntheticImage(cv::RNG &rng, int width, int height)
+{
+    // Drawn from the seeded generator, cv::randu would use the global one shared with OpenCV
+    Mat img(height, width, CV_8UC3);
+    rng.fill(img, cv::RNG::UNIFORM, Scalar(0, 0, 0), Scalar(255, 255, 255));
+    GaussianBlur(img, img, Size(7, 7), 3);
+
+    for(int k = 0; k < 12; k++) {
+        Point center(rng.uniform(0, width), rng.uniform(0, height));
+        Scalar color(rng.uniform(0, 255), rng.uniform(0, 255), rng.uniform(0, 255));
+        if(k % 2 == 0) {
+            Size half(rng.uniform(10, width / 6), rng.uniform(20, height / 3));
+            rectangle(img, Point(center.x - half.width, center.y - half.height),
+                      Point(center.x + half.width, center.y + half.height), color, -1);
+        } else {
+            ellipse(img, center, Size(rng.uniform(10, 80), rng.uniform(20, 120)), rng.uniform(0, 180), 0, 360, color, -1);
+        }
+    }
+    return img;
+}
+
+// Normalized HOG-like features in [0, 1]
+void syntheticFeatures(cv::RNG &rng, int n, int dim, FeatureCollection &features)
+{
+    features.resize(n);
+    for(int i = 0; i < n; i++) {
+        features[i].resize(dim);
+        for(int k = 0; k < dim; k++)
+            features[i][k] = rng.uniform(0.f, 1.f);
+    }
+}
+
+// Writes a two class libsvm model with nSV random support vectors of dimension dim
+void writeSyntheticModel(cv::RNG &rng, const string &filename, const string &kernel, int nSV, int dim)
+{
+    ofstream f(filename.c_str());
+    if(!f.is_open())
+        throw std::runtime_error("ERROR: Could not open file " + filename + " for writing");
+
+    int nPositives = nSV / 2;
+    f << "svm_type c_svc\n" << "kernel_type " << kernel << "\n";
+    if(kernel == "polynomial") f << "degree 3\n";
+    if(kernel != "linear") f << "gamma " << 1.0 / dim << "\n";
+    if(kernel == "polynomial" || kernel == "sigmoid") f << "coef0 0\n";
+    f << "nr_class 2\n" << "total_sv " << nSV << "\n" << "rho " << rng.uniform(-1.0, 1.0) << "\n"
+      << "label 1 -1\n" << "nr_sv " << nPositives << " " << nSV - nPositives << "\n" << "SV\n";
+
+    f << setprecision(4);
+    for(int i = 0; i < nSV; i++) {
+        double coef = rng.uniform(0.01, 1.0);
+        f << (i < nPositives ? coef : -coef);
+        // Features are stored with zero based indices, see SupportVectorMachine::train
+        for(int k = 0; k < dim; k++)
+            f << " " << k << ":" << rng.uniform(0.f, 1.f);
+        f << "\n";
+    }
+
+    if(!f.good())
+        throw std::runtime_error("ERROR: Could not write model " + filename);
+}
+
+void syntheticDetections(cv::RNG &rng, int n, vector<Detection> &dets)
+{
+    dets.clear();
+    for(int i = 0; i < n; i++) {
+        // Clusters of overlapping windows, like the raw output of the detector
+        int scale = rng.uniform(1, 3);
+        Rect r(rng.uniform(0, IMAGE_WIDTH - 64 * scale), rng.uniform(0, IMAGE_HEIGHT - 128 * scale), 64 * scale, 128 * scale);
+        dets.push_back(Detection(r, rng.uniform(-1.f, 2.f)));
+    }
+}
+
+// Benchmarks
+// ============================================================================
+
+class Benchmark
+{
+public:
+    Benchmark(const string &name, int items): _name(name), _items(items) {}
+    virtual ~Benchmark() {}
+
+    //! One timed repetition
+    virtual void run() = 0;
+
+    const string &getName() const { return _name; }
+
+    //! Work items processed by one repetition (windows, samples, images...)
+    int getItems() const { return _items; }
+
+private:
+    string _name;
+    int _items;
+};
+
+class HogWindowBenchmark : public Benchmark
+{
+public:
+    HogWindowBenchmark(cv::RNG &rng, int n): Benchmark("hog_window_64x128", n)
+    {
+        for(int i = 0; i < n; i++)
+            _windows.push_back(syntheticImage(rng, 64, 128));
+    }
+
+    void run()
+    {
+        Feature feat;
+        for(int i = 0; i < _windows.size(); i++)
+            _extractor(_windows[i], feat);
+    }
+
+private:
+    HOGFeatureExtractor _extractor;
+    vector<Mat> _windows;
+};
+
+class HogImageBenchmark : public Benchmark
+{
+public:
+    HogImageBenchmark(cv::RNG &rng): Benchmark("hog_image_640x480", 1), _img(syntheticImage(rng, IMAGE_WIDTH, IMAGE_HEIGHT))
+    {
+        // Same dense grid as the first level of ObjectDetector
+        for(int i = 0; i < _img.cols - 64; i += 16)
+            for(int j = 0; j < _img.rows - 128; j += 16)
+                _locations.push_back(Point(i, j));
+    }
+
+    void run()
+    {
+        HOGDescriptor hog(Size(64,128),Size(16,16),Size(8,8),Size(8,8),9);
+        vector<float> descriptors;
+        hog.compute(_img, descriptors, Size(8,8), Size(0,0), _locations);
+    }
+
+private:
+    Mat _img;
+    vector<Point> _locations;
+};
+
+class PredictBenchmark : public Benchmark
+{
+public:
+    PredictBenchmark(const string &name, const string &modelFName, const FeatureCollection &features):
+        Benchmark(name, features.size()), _svm(modelFName), _features(features)
+    {
+    }
+
+    void run()
+    {
+        _svm.predict(_features);
+    }
+
+private:
+    SupportVectorMachine _svm;
+    const FeatureCollection &_features;
+};
+
+class DetectBenchmark : public Benchmark
+{
+public:
+    DetectBenchmark(const string &name, const vector<Mat> &images, const ObjectDetector &detector):
+        Benchmark(name, images.size()), _images(images), _detector(detector)
+    {
+    }
+
+    void run()
+    {
+        vector<Detection> found;
+        for(int i = 0; i < _images.size(); i++)
+            _detector.getDetections(_images[i], found);
+    }
+
+private:
+    const vector<Mat> &_images;
+    const ObjectDetector &_detector;
+};
+
+class NmsBenchmark : public Benchmark
+{
+public:
+    NmsBenchmark(cv::RNG &rng, const string &method, int n):
+        Benchmark("nms_" + method + "_" + boost::lexical_cast<string>(n), n), _nms(nmsParameters(method))
+    {
+        syntheticDetections(rng, n, _dets);
+    }
+
+    void run()
+    {
+        vector<Detection> dets(_dets);
+        _nms(dets);
+    }
+
+private:
+    NonMaximaSuppression _nms;
+    vector<Detection> _dets;
+
+    static ParametersMap nmsParameters(const string &method)
+    {
+        ParametersMap params = NonMaximaSuppression::getDefaultParameters();
+        params.set("nms_method", method);
+        return params;
+    }
+};
+
+class PrecisionRecallBenchmark : public Benchmark
+{
+public:
+    PrecisionRecallBenchmark(cv::RNG &rng, int n): Benchmark("precision_recall_" + boost::lexical_cast<string>(n), n)
+    {
+        for(int i = 0; i < n; i++) {
+            _gt.push_back(rng.uniform(0, 10) == 0 ? 1 : -1);
+            _preds.push_back(rng.uniform(-2.f, 2.f));
+        }
+    }
+
+    void run()
+    {
+        PrecisionRecall pr(_gt, _preds);
+    }
+
+private:
+    vector<float> _gt, _preds;
+};
+
+class ScaleBenchmark : public Benchmark
+{
+public:
+    ScaleBenchmark(const FeatureCollection &features): Benchmark("scale_features", features.size()), _features(features)
+    {
+    }
+
+    void run()
+    {
+        FeatureCollection features(_features), scaled;
+        _extractor.scale(features, scaled);
+    }
+
+private:
+    HOGFeatureExtractor _extractor;
+    const FeatureCollection &_features;
+};
+
+// Decoding with ImageSource and detection on worker threads, like TEST
+class EndToEndBenchmark : public Benchmark
+{
+public:
+    EndToEndBenchmark(const vector<string> &filenames, const ObjectDetector &detector, int nWorkers):
+        Benchmark("end_to_end_" + boost::lexical_cast<string>(nWorkers) + "_threads", filenames.size()),
+        _filenames(filenames), _detector(detector), _nWorkers(nWorkers), _images(NULL)
+    {
+    }
+
+    void run()
+    {
+        ImageSource images(_filenames, CV_LOAD_IMAGE_COLOR);
+        _images = &images;
+        _next = 0;
+        _error.clear();
+
+        boost::thread_group workers;
+        for(int w = 0; w < _nWorkers; w++)
+            workers.create_thread(boost::bind(&EndToEndBenchmark::worker, this));
+        workers.join_all();
+
+        _images = NULL;
+        if(!_error.empty())
+            throw std::runtime_error(_error);
+    }
+
+private:
+    const vector<string> &_filenames;
+    const ObjectDetector &_detector;
+    int _nWorkers;
+
+    ImageSource *_images;
+    boost::mutex _mutex;    // Guards _images, _next and _error
+    int _next;
+    string _error;
+
+    void worker()
+    {
+        while(true) {
+            Mat img;
+            try {
+                boost::lock_guard<boost::mutex> lock(_mutex);
+                if(!_error.empty() || _next >= _filenames.size()) return;
+                _next++;
+                _images->next(img);
+            } catch(std::exception &err) {
+                boost::lock_guard<boost::mutex> lock(_mutex);
+                _error = err.what();
+                return;
+            }
+
+            vector<Detection> found;
+            _detector.getDetections(img, found);
+        }
+    }
+};
+
+// Runner
+// ============================================================================
+
+struct BenchmarkResult
+{
+    string name;
+    int items;
+    double median;      // Seconds per repetition
+    double best;
+};
+
+BenchmarkResult runBenchmark(Benchmark &bench, int repetitions)
+{
+    // The first run warms up caches and lazily initialized state
+    bench.run();
+
+    vector<double> times(repetitions);
+    for(int r = 0; r < repetitions; r++) {
+        double t = (double)getTickCount();
+        bench.run();
+        times[r] = ((double)getTickCount() - t) / getTickFrequency();
+    }
+    sort(times.begin(), times.end());
+
+    BenchmarkResult result;
+    result.name = bench.getName();
+    result.items = bench.getItems();
+    result.median = times[repetitions / 2];
+    result.best = times[0];
+    return result;
+}
+
+ostream &operator<<(ostream &s, const BenchmarkResult &r)
+{
+    ios::fmtflags flags = s.flags();
+    s << left << setw(32) << r.name << right << setw(10) << r.items << fixed << setprecision(3)
+      << setw(14) << r.median * 1e3 << setw(14) << r.best * 1e3
+      << setw(16) << setprecision(1) << r.items / r.median;
+    s.flags(flags);
+    return s;
+}
+
+// Median seconds per repetition of every benchmark of a results file written with -o
+map<string, double> loadBaseline(const string &filename)
+{
+    ifstream f(filename.c_str());
+    if(!f.is_open())
+        throw std::runtime_error("ERROR: Could not open file " + filename + " for reading");
+
+    map<string, double> medians;
+    string line;
+    getline(f, line);    // Header
+    while(getline(f, line)) {
+        vector<string> fields;
+        boost::split(fields, line, boost::is_any_of(","));
+        if(fields.size() < 3)
+            throw std::runtime_error("ERROR: Invalid line in baseline " + filename + ": " + line);
+        medians[fields[0]] = atof(fields[2].c_str());
+    }
+    return medians;
+}
+
+// Compares the medians with the baseline, returns the number of benchmarks slower than allowed
+int compareBaseline(const vector<BenchmarkResult> &results, const map<string, double> &baseline, double tolerance)
+{
+    int regressions = 0;
+    cout << endl << left << setw(32) << "Benchmark" << right << setw(14) << "Baseline (ms)" << setw(14) << "Median (ms)"
+         << setw(10) << "Change" << endl;
+    for(int i = 0; i < results.size(); i++) {
+        map<string, double>::const_iterator it = baseline.find(results[i].name);
+        if(it == baseline.end() || it->second <= 0) {
+            LOG(WARNING) << "No baseline for " << results[i].name;
+            continue;
+        }
+
+        double change = results[i].median / it->second - 1;
+        bool regressed = change > tolerance;
+        ios::fmtflags flags = cout.flags();
+        cout << left << setw(32) << results[i].name << right << fixed << setprecision(3) << setw(14) << it->second * 1e3
+             << setw(14) << results[i].median * 1e3 << setw(9) << setprecision(1) << showpos << change * 100 << "%"
+             << noshowpos << (regressed ? "  REGRESSION" : "") << endl;
+        cout.flags(flags);
+
+        if(regressed) regressions++;
+    }
+    return regressions;
+}
+
+void printUsage(const std::string &execName)
+{
+    printf("Usage:\n");
+    printf("\t%s [-f <name filter>] [-r <repetitions>] [-o <out:results.csv>] [-b <in:baseline.csv> [-t <tolerance>]]\n\n", execName.c_str());
+    printf("Runs the benchmarks whose name contains the filter on synthetic images and models and reports\n");
+    printf("the median and best time of a repetition and the throughput in items (windows, samples,\n");
+    printf("boxes or images) per second.\n");
+    printf("With -b the medians are compared to a results file written by -o and the run fails when one of\n");
+    printf("them is slower than the baseline by more than the tolerance (default 0.1, i.e. 10%%).\n\n");
+}
+
+int main(int argc, char **argv)
+{
+    FLAGS_logtostderr = true;
+    FLAGS_stderrthreshold = 1;
+    google::InitGoogleLogging(argv[0]);
+
+    map<string, string> opts;
+    for(int i = 1; i < argc; i++) {
+        if(argv[i][0] == '-' && i + 1 < argc) {
+            opts[argv[i]] = argv[i + 1];
+            i++;
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    string filter = opts.count("-f") ? opts["-f"] : "";
+    int repetitions = opts.count("-r") ? std::max(atoi(opts["-r"].c_str()), 1) : 5;
+    double tolerance = opts.count("-t") ? atof(opts["-t"].c_str()) : 0.1;
+
+    namespace fs = boost::filesystem;
+    fs::path workDir = fs::temp_directory_path() / fs::unique_path("objdet_bench_%%%%%%%%");
+
+    int regressions = 0;
+    try {
+        // Read first so a bad baseline fails before the benchmarks run
+        map<string, double> baseline;
+        if(opts.count("-b"))
+            baseline = loadBaseline(opts["-b"]);
+
+        fs::create_directories(workDir);
+        cv::RNG rng(BENCH_SEED);
+
+        LOG(INFO) << "Generating synthetic data in " << workDir.string();
+
+        FeatureCollection features;
+        syntheticFeatures(rng, 2000, HOG_DIM, features);
+        FeatureCollection predictFeatures(features.begin(), features.begin() + 200);
+
+        // Models of every kernel type, the support vector count drives the kernel cost
+        const char *kernels[] = { "linear", "rbf", "polynomial", "sigmoid" };
+        const int svCounts[] = { 100, 1000 };
+        vector<pair<string, string> > models;
+        for(int k = 0; k < 4; k++) {
+            for(int c = 0; c < 2; c++) {
+                if(k != 1 && svCounts[c] != 1000) continue;
+                string name = string("predict_") + kernels[k] + "_" + boost::lexical_cast<string>(svCounts[c]) + "sv";
+                string modelFName = (workDir / (name + ".model")).string();
+                writeSyntheticModel(rng, modelFName, kernels[k], svCounts[c], HOG_DIM);
+                models.push_back(make_pair(name, modelFName));
+            }
+        }
+
+        vector<Mat> images;
+        vector<string> imageFilenames;
+        for(int i = 0; i < 16; i++) {
+            images.push_back(syntheticImage(rng, IMAGE_WIDTH, IMAGE_HEIGHT));
+            string filename = (workDir / ("image" + boost::lexical_cast<string>(i) + ".jpg")).string();
+            imwrite(filename, images.back());
+            imageFilenames.push_back(filename);
+        }
+
+        SupportVectorMachine linear((workDir / "predict_linear_1000sv.model").string());
+        SupportVectorMachine rbf((workDir / "predict_rbf_100sv.model").string());
+        ObjectDetector linearDetector(linear);
+        ObjectDetector rbfDetector(rbf);
+        vector<Mat> fewImages(images.begin(), images.begin() + 2);
+
+        vector<Benchmark *> benchmarks;
+        benchmarks.push_back(new HogWindowBenchmark(rng, 500));
+        benchmarks.push_back(new HogImageBenchmark(rng));
+        for(int i = 0; i < models.size(); i++)
+            benchmarks.push_back(new PredictBenchmark(models[i].first, models[i].second, predictFeatures));
+        benchmarks.push_back(new DetectBenchmark("detect_dense_linear", images, linearDetector));
+        benchmarks.push_back(new DetectBenchmark("detect_dense_rbf_100sv", fewImages, rbfDetector));
+        benchmarks.push_back(new NmsBenchmark(rng, "greedy", 1000));
+        benchmarks.push_back(new NmsBenchmark(rng, "soft", 1000));
+        benchmarks.push_back(new NmsBenchmark(rng, "meanshift", 1000));
+        benchmarks.push_back(new PrecisionRecallBenchmark(rng, 1000000));
+        benchmarks.push_back(new ScaleBenchmark(features));
+        benchmarks.push_back(new EndToEndBenchmark(imageFilenames, linearDetector, 1));
+        int nThreads = std::max((int)boost::thread::hardware_concurrency(), 1);
+        if(nThreads > 1)
+            benchmarks.push_back(new EndToEndBenchmark(imageFilenames, linearDetector, nThreads));
+
+        vector<BenchmarkResult> results;
+        cout << left << setw(32) << "Benchmark" << right << setw(10) << "Items" << setw(14) << "Median (ms)"
+             << setw(14) << "Best (ms)" << setw(16) << "Items/s" << endl;
+        for(int i = 0; i < benchmarks.size(); i++) {
+            if(benchmarks[i]->getName().find(filter) != string::npos) {
+                results.push_back(runBenchmark(*benchmarks[i], repetitions));
+                cout << results.back() << endl;
+            }
+            delete benchmarks[i];
+        }
+
+        // Items counted by the instrumented loops over all the repetitions
+        cout << endl;
+        Progress::printSummary(cout);
+
+        if(opts.count("-o")) {
+            ofstream f(opts["-o"].c_str());
+            if(!f.is_open())
+                throw std::runtime_error("ERROR: Could not open file " + opts["-o"] + " for writing");
+            f << "benchmark,items,median_s,best_s,items_per_s\n";
+            for(int i = 0; i < results.size(); i++)
+                f << results[i].name << "," << results[i].items << "," << results[i].median << ","
+                  << results[i].best << "," << results[i].items / results[i].median << "\n";
+        }
+
+        if(opts.count("-b")) {
+            regressions = compareBaseline(results, baseline, tolerance);
+            if(regressions > 0)
+                LOG(ERROR) << regressions << " benchmarks slower than the baseline by more than " << tolerance * 100 << "%";
+        }
+
+    } catch(std::exception& err) {
+        LOG(ERROR) << err.what();
+        fs::remove_all(workDir);
+        return EXIT_FAILURE;
+    }
+
+    fs::remove_all(workDir);
+    return regressions > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
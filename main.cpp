@@ -1,5 +1,11 @@
 #include "Common.h"
 #include "PascalAnnotation.h"
+#include "AnnotationIndex.h"
+#include "ImageList.h"
+#include "SampleStore.h"
+#include "ImageSource.h"
+#include "DetectionEvaluator.h"
+#include "VocEvaluator.h"
 #include "PascalImageDatabase.h"
 #include "ImageDatabase.h"
 #include "Feature.h"
@@ -8,6 +14,14 @@
 #include "ObjectDetector.h"
 #include "FileIO.h"
 #include "PrincipalComponentAnalysis.h"
+#include "Trace.h"
+#include "Progress.h"
+#include "VocPaths.h"
+#include "SyntheticDataset.h"
+#include "DetectionServer.h"
+#include "FeatureStore.h"
+#include "OutOfCoreTrainer.h"
+#include "CascadeTrainer.h"
 
 
 using namespace std;
@@ -16,11 +30,37 @@ void printUsage(const std::string &execName)
 {
     printf("Usage:\n");
     printf("\t%s -h\n", execName.c_str());
-    printf("\t%s TRAIN      -c <category name> [-p <svm C param>] <in:database> <out:svm model>\n", execName.c_str());
-    printf("\t%s VAL        -c <category name> <in:database> <in:svm model> [<out:prcurve.pr>] [<out:database.preds>]\n", execName.c_str());
-    printf("\t%s TEST       -c <category name> <in:database> <in:svm model> [<out:prcurve.pr>] [<out:database.preds>]\n", execName.c_str());
-    printf("\t%s PCA        -c <category name> <in:database> [<out:pca_data.dat>]\n", execName.c_str());
-    printf("\t%s DEMO       -c <category name> <in:database> <in:svm model>\n\n", execName.c_str());
+    printf("\t%s TRAIN      -c <category name> [-p <svm C param>] [-k <pca components>] <in:database|samples.pack> <out:svm model>\n", execName.c_str());
+    printf("\t%s TRAIN      -c <category name> [-p <svm C param>] [-m <memory budget MB> | -w <cascade threads> | -f <cascade processes>] [-i <cascade passes>] <in:features.feats> <out:svm model>\n", execName.c_str());
+    printf("\t%s PATH       -c <category name> -v <in:validation database|samples.pack> [-p <svm config>] <in:database|samples.pack> <out:svm model prefix> <C> [...]\n", execName.c_str());
+    printf("\t%s VAL        -c <category name> [-d <detector config>] [-o <out:calibrated detector config>] [-b <in:baseline svm model>] <in:database|samples.pack> <in:svm model> [<out:prcurve.pr>] [<out:database.preds>]\n", execName.c_str());
+    printf("\t%s TEST       -c <category name> [-d <detector config>] [-w <detection threads>] [-s <score resolution>] <in:database> <in:svm model> [<out:prcurve.pr>] [<out:database.preds>]\n", execName.c_str());
+    printf("\t%s MULTI      [-d <detector config>] [-w <detection threads>] <in:image set> <out:results dir> <in:category>:<in:svm model> [...]\n", execName.c_str());
+    printf("\t%s SERVE      [-d <detector config>] [-w <detection threads>] [-u <socket path>] <in:category>:<in:svm model> [...]\n", execName.c_str());
+    printf("\t%s PCA        -c <category name> <in:database|features.feats> <out:pca_data.dat>\n", execName.c_str());
+    printf("\t%s COMPRESS   -k <vectors> [-c <category name> -v <in:validation database|samples.pack>] <in:svm model> <out:svm model>\n", execName.c_str());
+    printf("\t%s DEMO       -c <category name> [-d <detector config>] <in:database> <in:svm model>\n", execName.c_str());
+    printf("\t%s PACK       -c <category name> <in:database> <out:samples.pack>\n", execName.c_str());
+    printf("\t%s EXTRACT    -c <category name> <in:database|samples.pack> <out:features.feats>\n", execName.c_str());
+    printf("\t%s EVAL       [-o <out:report>] <in:image set> <in:results dir>\n", execName.c_str());
+    printf("\t%s INDEX      <in:annotations dir> <out:annotation index>\n", execName.c_str());
+    printf("\t%s SYNTH      [-n <images>] [-s <seed>] <out:voc root>\n\n", execName.c_str());
+    printf("Every mode reading a database accepts -a <in:annotation index> to skip the XML annotations\n");
+    printf("and -r <in:voc root> to locate the images and annotations (default $VOC_ROOT or VOCdevkit/VOC2007),\n");
+    printf("and -j <threads> to set the number of image decoding threads (0 decodes on the main thread).\n");
+    printf("Every mode accepts -t <out:trace.json> to time its stages, the trace opens in chrome://tracing.\n");
+    printf("SERVE reads image paths, or @<bytes> followed by an encoded image, one per line from stdin or the\n");
+    printf("socket and answers a JSON line per request, STATS returns the latency percentiles, SHUTDOWN stops it.\n");
+    printf("Set GLOG_v=3 to log every raw detection of the detector.\n");
+    printf("TRAIN -k saves the projection in <svm model>.pca, the other modes apply it when it exists.\n");
+    printf("TRAIN on a feature store created by EXTRACT streams it from disk, keeping the solver under -m MB,\n");
+    printf("or trains a Cascade SVM whose sub-problems are solved by -w threads or -f local worker processes,\n");
+    printf("feeding the support vectors back at most -i times (default 5) until they settle.\n");
+    printf("VAL -o saves the cascade threshold of the class as cascade_threshold_<category>, calibrating every class\n");
+    printf("into the same configuration (-d and -o on one file) lets MULTI and SERVE run the cascade scan.\n");
+    printf("The calibration crops the positives of a database (not a sample store) at the offsets of the coarse grid.\n");
+    printf("TEST bins the scores of the precision recall curve by -s (default %g, 0 keeps every score).\n", DetectionEvaluator::DEFAULT_SCORE_RESOLUTION);
+    printf("PATH trains one model per C, saved in <svm model prefix>_c<C>, each warm started from the previous one.\n\n");
 }
 
 void parseCommandLineOptions(int argc, char **argv, vector<std::string> &args, map<std::string, string> &opts)
@@ -40,24 +80,108 @@ void parseCommandLineOptions(int argc, char **argv, vector<std::string> &args, m
     }
 }
 
-int mainSVMTrain(const vector<string> &args, const map<string, string> &opts)
+ParametersMap getDetectorParameters(const map<string, string> &opts)
 {
-    if(args.size() != 4) {
-        throw std::runtime_error("ERROR: Incorrect number of arguments. Run command with flag -h for help.");
+    // Entries missing from the configuration file keep their default value
+    ParametersMap params = ObjectDetector::getDefaultParameters();
+
+    if(opts.count("-d") == 1) {
+        string paramsFName = opts.at("-d");
+        if(!boost::filesystem::exists(paramsFName)) {
+            throw std::runtime_error("ERROR: Detector configuration file doesn't exist in: " + paramsFName);
+        }
+
+        map<string, ParametersMap> allParams;
+        loadFromFile(paramsFName, allParams);
+        if(allParams.count(OBJECT_DETECTOR_KEY) == 0) {
+            throw std::runtime_error("ERROR: Problem obtaining the parameters from file: " + paramsFName);
+        }
+
+        LOG(INFO) << "Using detector parameters from file: " << paramsFName;
+        const ParametersMap &fileParams = allParams[OBJECT_DETECTOR_KEY];
+        for(ParametersMap::const_iterator p = fileParams.begin(); p != fileParams.end(); p++) {
+            params[p->first] = p->second;
+        }
+    } else {
+        LOG(INFO) << "Using default detector parameters";
     }
 
-    double t = (double)getTickCount();
+    return params;
+}
 
-    string dbFName = args[2];
-    string svmModelFName = args[3];
-    string category;
-    if(opts.count("-c") == 1) {
-        category = opts.at("-c");
+VocPaths getVocPaths(const map<string, string> &opts)
+{
+    VocPaths paths(opts.count("-r") == 1 ? opts.at("-r") : VocPaths::getDefaultRoot());
+    if(!boost::filesystem::is_directory(paths.getRoot())) {
+        throw std::runtime_error("ERROR: VOC root directory doesn't exist in: " + paths.getRoot());
+    }
+    return paths;
+}
+
+AnnotationIndex *getAnnotationIndex(const map<string, string> &opts)
+{
+    if(opts.count("-a") == 0) return NULL;
+
+    string indexFName = opts.at("-a");
+    if(!boost::filesystem::exists(indexFName)) {
+        throw std::runtime_error("ERROR: Annotation index doesn't exist in: " + indexFName);
+    }
+
+    LOG(INFO) << "Using annotation index: " << indexFName;
+    return new AnnotationIndex(indexFName);
+}
+
+ParametersMap getImageSourceParameters(const map<string, string> &opts)
+{
+    ParametersMap params = ImageSource::getDefaultParameters();
+    if(opts.count("-j") == 1) {
+        params.set("prefetch_threads", atoi(opts.at("-j").c_str()));
+    }
+    return params;
+}
+
+// Projection written by TRAIN -k next to the model, NULL when the model uses the full features
+PrincipalComponentAnalysis *loadProjection(const string &svmModelFName)
+{
+    string projectionFName = svmModelFName + ".pca";
+    if(!boost::filesystem::exists(projectionFName)) return NULL;
+
+    PrincipalComponentAnalysis *projection = new PrincipalComponentAnalysis();
+    projection->load(projectionFName);
+    LOG(INFO) << "Using the " << projection->getComponentCount() << " component projection from: " << projectionFName;
+    return projection;
+}
+
+// Extracts the features of a training database, either an image list or a store created by PACK
+void extractDatabaseFeatures(const string &dbFName, const string &category, const map<string, string> &opts,
+                             const FeatureExtractor &featExtractor, FeatureCollection &features,
+                             vector<float> &labels, vector<string> &filenames)
+{
+    if(SampleStore::isSampleStore(dbFName)) {
+        SampleStore store(dbFName);
+        if(!boost::iequals(store.getCategory(), category)) {
+            throw std::runtime_error("ERROR: Sample store " + dbFName + " was packed for category " + store.getCategory());
+        }
+        LOG(INFO) << "Using " << store.getSize() << " packed samples";
+
+        featExtractor(store, features);
+        labels = store.getLabels();
+        filenames = store.getFilenames();
     } else {
-        throw std::runtime_error("ERROR: Category not specified. Run command with flag -h for help.");
+        AnnotationIndex *index = getAnnotationIndex(opts);
+        PascalImageDatabase db(dbFName.c_str(), category, index, getVocPaths(opts));
+        cout << db << endl;
+
+        featExtractor(db, features, getImageSourceParameters(opts));
+        labels = db.getLabels();
+        filenames = db.getFilenames();
+
+        delete index;
     }
+}
 
-    LOG(INFO) << "Obtaining svm parameters";
+ParametersMap getSVMParameters(const map<string, string> &opts)
+{
     ParametersMap svmParams;
     if(opts.count("-p") == 1){
         string paramsSVMFName = opts.at("-p");
@@ -78,14 +202,75 @@ int mainSVMTrain(const vector<string> &args, const map<string, string> &opts)
         LOG(INFO) << "Using default svm parameters";
         svmParams = SupportVectorMachine::getDefaultParameters();
     }
+    return svmParams;
+}
+
+int mainSVMTrain(const vector<string> &args, const map<string, string> &opts)
+{
+    if(args.size() != 4) {
+        throw std::runtime_error("ERROR: Incorrect number of arguments. Run command with flag -h for help.");
+    }
+
+    double t = (double)getTickCount();
+
+    string dbFName = args[2];
+    string svmModelFName = args[3];
+    string category;
+    if(opts.count("-c") == 1) {
+        category = opts.at("-c");
+    } else {
+        throw std::runtime_error("ERROR: Category not specified. Run command with flag -h for help.");
+    }
+
+    LOG(INFO) << "Obtaining svm parameters";
+    ParametersMap svmParams = getSVMParameters(opts);
+
+    if(FeatureStore::isFeatureStore(dbFName)) {
+        if(opts.count("-k") == 1) {
+            throw std::runtime_error("ERROR: PCA projection (-k) is not supported when training from a feature store");
+        }
+
+        FeatureStore store(dbFName);
+        if(!boost::iequals(store.getCategory(), category)) {
+            throw std::runtime_error("ERROR: Feature store " + dbFName + " was extracted for category " + store.getCategory());
+        }
+
+        ParametersMap trainerParams = OutOfCoreTrainer::getDefaultParameters();
+        if(opts.count("-m") == 1) {
+            trainerParams.set("memory_budget_mb", atoi(opts.at("-m").c_str()));
+        }
+
+        SupportVectorMachine svm(svmParams);
+        if(opts.count("-w") == 1 || opts.count("-f") == 1) {
+            ParametersMap cascadeParams = CascadeTrainer::getDefaultParameters();
+            if(opts.count("-f") == 1) {
+                cascadeParams.set("cascade_workers", atoi(opts.at("-f").c_str()));
+                cascadeParams.set("cascade_processes", 1);
+            } else {
+                cascadeParams.set("cascade_workers", atoi(opts.at("-w").c_str()));
+            }
+            if(opts.count("-i") == 1) {
+                cascadeParams.set("cascade_iterations", atoi(opts.at("-i").c_str()));
+            }
+
+            LOG(INFO) << "Training Cascade SVM";
+            CascadeTrainer(cascadeParams).train(svm, store);
+        } else {
+            LOG(INFO) << "Training SVM out of core";
+            OutOfCoreTrainer(trainerParams).train(svm, store);
+        }
+        svm.save(svmModelFName);
+        LOG(INFO) << "SVM Model saved in: " << svmModelFName;
+
+        t = (double)getTickCount() - t;
+        LOG(INFO) << "Training completed in " << t/getTickFrequency() << " seconds.";
+
+        return EXIT_SUCCESS;
+    }
 
-    
     LOG(INFO) << "Creating the image database";
     if(boost::filesystem::exists(dbFName)) {
 
-        PascalImageDatabase db(dbFName.c_str(), category);
-        cout << db << endl;
-
         LOG(INFO) << "Creating feature extractor";
         ParametersMap featParams;
         featParams = FeatureExtractor::getDefaultParameters("hog");
@@ -95,7 +280,9 @@ int mainSVMTrain(const vector<string> &args, const map<string, string> &opts)
 
         LOG(INFO) << "Extracting features";
         FeatureCollection features;
-        (*featExtractor)(db, features);
+        vector<float> labels;
+        vector<string> filenames;
+        extractDatabaseFeatures(dbFName, category, opts, *featExtractor, features, labels, filenames);
 
         LOG(INFO) << "Scaling the feature vector";
         FeatureCollection scaledFeatures;
@@ -104,9 +291,24 @@ int mainSVMTrain(const vector<string> &args, const map<string, string> &opts)
         // Remove features from memory
         FeatureCollection().swap(features);
 
+        if(opts.count("-k") == 1) {
+            int nComponents = atoi(opts.at("-k").c_str());
+            LOG(INFO) << "Projecting the features on " << nComponents << " principal components";
+
+            PrincipalComponentAnalysis pca;
+            pca.add(scaledFeatures);
+            pca.compute(nComponents);
+            LOG(INFO) << "Percentage of variability retained: " << pca.getRetainedVariance()*100 << "%";
+
+            FeatureCollection projectedFeatures;
+            pca.project(scaledFeatures, projectedFeatures);
+            scaledFeatures.swap(projectedFeatures);
+            pca.save(svmModelFName + ".pca");
+        }
+
         LOG(INFO) << "Training SVM";
         SupportVectorMachine svm(svmParams);
-        svm.train(db.getLabels(), scaledFeatures, svmModelFName);
+        svm.train(labels, scaledFeatures, svmModelFName);
 
         //saveToFile(svmModelFName, svm);
         LOG(INFO) << "SVM Model saved in: " << svmModelFName;
@@ -123,6 +325,100 @@ int mainSVMTrain(const vector<string> &args, const map<string, string> &opts)
     return EXIT_SUCCESS;
 }
 
+int mainPath(const vector<string> &args, const map<string, string> &opts)
+{
+    if(args.size() < 5) {
+        throw std::runtime_error("ERROR: Incorrect number of arguments. Run command with flag -h for help.");
+    }
+
+    double t = (double)getTickCount();
+
+    string dbFName = args[2];
+    string modelPrefix = args[3];
+    string category;
+    if(opts.count("-c") == 1) {
+        category = opts.at("-c");
+    } else {
+        throw std::runtime_error("ERROR: Category not specified. Run command with flag -h for help.");
+    }
+    if(opts.count("-v") == 0) {
+        throw std::runtime_error("ERROR: Validation database not specified. Run command with flag -h for help.");
+    }
+    string valFName = opts.at("-v");
+
+    // Every solve is warm started from the previous one, which only helps when C grows
+    vector<double> cs;
+    for(int i = 4; i < args.size(); i++) cs.push_back(atof(args[i].c_str()));
+    std::sort(cs.begin(), cs.end());
+    if(cs.front() <= 0) {
+        throw std::runtime_error("ERROR: The values of C must be positive");
+    }
+
+    if(!boost::filesystem::exists(dbFName)) {
+        throw std::runtime_error("ERROR: Pascal database training file doesn't exist in: " + dbFName);
+    }
+    if(!boost::filesystem::exists(valFName)) {
+        throw std::runtime_error("ERROR: Pascal cross validation database file doesn't exist in: " + valFName);
+    }
+
+    LOG(INFO) << "Obtaining svm parameters";
+    ParametersMap svmParams = getSVMParameters(opts);
+
+    LOG(INFO) << "Creating feature extractor";
+    FeatureExtractor *featExtractor = FeatureExtractor::create(FeatureExtractor::getDefaultParameters("hog"));
+
+    LOG(INFO) << "Extracting training features";
+    FeatureCollection features, scaledFeatures;
+    vector<float> labels;
+    vector<string> filenames;
+    extractDatabaseFeatures(dbFName, category, opts, *featExtractor, features, labels, filenames);
+    featExtractor->scale(features, scaledFeatures);
+    FeatureCollection().swap(features);
+
+    LOG(INFO) << "Extracting validation features";
+    FeatureCollection valFeatures, scaledValFeatures;
+    vector<float> valLabels;
+    vector<string> valFilenames;
+    extractDatabaseFeatures(valFName, category, opts, *featExtractor, valFeatures, valLabels, valFilenames);
+    featExtractor->scale(valFeatures, scaledValFeatures);
+    FeatureCollection().swap(valFeatures);
+
+    SupportVectorMachine svm(svmParams);
+    vector<int> nSupportVectors(cs.size());
+    vector<double> averagePrecisions(cs.size()), seconds(cs.size());
+    for(int i = 0; i < cs.size(); i++) {
+        LOG(INFO) << "Training SVM with C = " << cs[i];
+        double tc = (double)getTickCount();
+        svm.trainPath(labels, scaledFeatures, cs[i]);
+        seconds[i] = ((double)getTickCount() - tc)/getTickFrequency();
+        nSupportVectors[i] = svm.getSupportVectorIndices().size();
+
+        ostringstream modelFName;
+        modelFName << modelPrefix << "_c" << cs[i];
+        svm.save(modelFName.str());
+        LOG(INFO) << "SVM Model saved in: " << modelFName.str();
+
+        vector<float> preds = svm.predict(scaledValFeatures);
+        PrecisionRecall pr(valLabels, preds);
+        averagePrecisions[i] = pr.getAveragePrecision();
+        LOG(INFO) << "Average precision with C = " << cs[i] << ": " << averagePrecisions[i];
+    }
+
+    cout << left << setw(14) << "C" << right << setw(12) << "SVs" << setw(14) << "AP" << setw(14) << "Train (s)" << endl;
+    for(int i = 0; i < cs.size(); i++) {
+        cout << left << setw(14) << cs[i] << right << setw(12) << nSupportVectors[i] << fixed << setprecision(4)
+             << setw(14) << averagePrecisions[i] << setprecision(3) << setw(14) << seconds[i] << endl;
+        cout.unsetf(ios::fixed);
+    }
+
+    delete featExtractor;
+
+    t = (double)getTickCount() - t;
+    LOG(INFO) << "Regularization path completed in " << t/getTickFrequency() << " seconds.";
+
+    return EXIT_SUCCESS;
+}
+
 int mainSVMVal(const vector<string> &args, const map<string, string> &opts)
 {
     if(args.size() != 6) {
@@ -150,18 +446,37 @@ int mainSVMVal(const vector<string> &args, const map<string, string> &opts)
         if(boost::filesystem::exists(svmModelFName))
         {
 
-            LOG(INFO) << "Creating the image database";
-            PascalImageDatabase db(dbFName.c_str(), category);
-            cout << db << endl;
-
             LOG(INFO) << "Loading SVM model and feature extractor from file";
             SupportVectorMachine svm(svmModelFName);
+            PrincipalComponentAnalysis *projection = loadProjection(svmModelFName);
             FeatureExtractor *featExtractor = FeatureExtractor::create(FeatureExtractor::getDefaultParameters("hog"));
             //loadFromFile(svmModelFName, svm);
 
-            LOG(INFO) << "Extracting features";
+            LOG(INFO) << "Creating the image database and extracting features";
             FeatureCollection features;
-            (*featExtractor)(db, features);
+            vector<float> labels;
+            vector<string> filenames;
+            extractDatabaseFeatures(dbFName, category, opts, *featExtractor, features, labels, filenames);
+
+            if(opts.count("-o") == 1) {
+                // The positives are cropped again at the offsets of the coarse grid of the scan
+                if(SampleStore::isSampleStore(dbFName)) {
+                    throw std::runtime_error("ERROR: Calibrating the cascade needs the images of a database, not a sample store");
+                }
+
+                LOG(INFO) << "Calibrating the cascade rejection threshold";
+                AnnotationIndex *index = getAnnotationIndex(opts);
+                PascalImageDatabase db(dbFName.c_str(), category, index, getVocPaths(opts));
+
+                ObjectDetector obdet(svm, getDetectorParameters(opts), projection, category);
+                obdet.calibrateCascade(db, 0, getImageSourceParameters(opts));
+                delete index;
+
+                map<string, ParametersMap> detectorParams;
+                detectorParams[OBJECT_DETECTOR_KEY] = obdet.getParameters();
+                saveToFile(opts.at("-o"), detectorParams);
+                LOG(INFO) << "Calibrated detector configuration saved in: " << opts.at("-o");
+            }
 
             LOG(INFO) << "Scaling the feature vector";
             FeatureCollection scaledFeatures;
@@ -170,17 +485,43 @@ int mainSVMVal(const vector<string> &args, const map<string, string> &opts)
             // Remove features from memory
             FeatureCollection().swap(features);
 
+            // A baseline model trained on the full features gives the cost of the projection
+            vector<float> baselinePreds;
+            if(opts.count("-b") == 1) {
+                string baselineFName = opts.at("-b");
+                if(!boost::filesystem::exists(baselineFName)) {
+                    throw std::runtime_error("ERROR: Baseline SVM Model file doesn't exist in: " + baselineFName);
+                }
+
+                LOG(INFO) << "Predicting with the baseline model";
+                SupportVectorMachine baseline(baselineFName);
+                baselinePreds = baseline.predict(scaledFeatures);
+            }
+
+            if(projection != NULL) {
+                LOG(INFO) << "Projecting the features on the principal components";
+                FeatureCollection projectedFeatures;
+                projection->project(scaledFeatures, projectedFeatures);
+                scaledFeatures.swap(projectedFeatures);
+            }
+
             LOG(INFO) << "Predicting";
             vector<float> preds = svm.predict(scaledFeatures);
             //vector<float> predLabels = svm.predictLabel(features);
 
             LOG(INFO) << "Computing Precision Recall Curve";
-            PrecisionRecall pr(db.getLabels(), preds);
+            PrecisionRecall pr(labels, preds);
             LOG(INFO) << "Average precision: " << pr.getAveragePrecision();
 
+            if(!baselinePreds.empty()) {
+                PrecisionRecall prBaseline(labels, baselinePreds);
+                LOG(INFO) << "Average precision baseline: " << prBaseline.getAveragePrecision();
+                LOG(INFO) << "Average precision drop: " << prBaseline.getAveragePrecision() - pr.getAveragePrecision();
+            }
+
             if(prFName.size() != 0) pr.save(prFName.c_str());
             if(predsFName.size() != 0) {
-                PascalImageDatabase predsDb(preds, db.getFilenames());
+                PascalImageDatabase predsDb(preds, filenames);
                 predsDb.save(predsFName.c_str());
                 // PascalImageDatabase targetDb(db.getLabels(), db.getFilenames());
                 // targetDb.save(predsFName_label.c_str());
@@ -189,6 +530,7 @@ int mainSVMVal(const vector<string> &args, const map<string, string> &opts)
             }
 
             delete featExtractor;
+            delete projection;
 
             t = (double)getTickCount() - t;
             LOG(INFO) << "Cross Validation completed in " << t/getTickFrequency() << " seconds.";
@@ -206,6 +548,64 @@ int mainSVMVal(const vector<string> &args, const map<string, string> &opts)
     }
 }
 
+int getDetectionThreads(const map<string, string> &opts)
+{
+    if(opts.count("-w") == 1) {
+        return std::max(atoi(opts.at("-w").c_str()), 1);
+    }
+    return std::max((int)boost::thread::hardware_concurrency(), 1);
+}
+
+// State shared by the detection threads of TEST
+struct DetectionContext
+{
+    DetectionContext(const ImageDatabase &db, const ObjectDetector &detector, ImageSource &images, DetectionWriter *writer):
+        db(db), detector(detector), images(images), writer(writer), nextImage(0)
+    {
+    }
+
+    const ImageDatabase &db;
+    const ObjectDetector &detector;
+    ImageSource &images;
+    DetectionWriter *writer;
+
+    boost::mutex mutex;    // Guards images, nextImage and error
+    int nextImage;
+    string error;
+};
+
+void detectionWorker(DetectionContext *context, DetectionEvaluator *evaluator)
+{
+    const ImageDatabase &db = context->db;
+
+    while(true) {
+        int i;
+        Mat img;
+        try {
+            boost::lock_guard<boost::mutex> lock(context->mutex);
+            if(!context->error.empty() || context->nextImage >= db.getSize()) return;
+
+            i = context->nextImage++;
+            context->images.next(img);
+        } catch(std::exception &err) {
+            boost::lock_guard<boost::mutex> lock(context->mutex);
+            context->error = err.what();
+            return;
+        }
+
+        LOG(INFO) << "Processing image " << setw(4) << (i + 1) << " of " << db.getSize();
+
+        // Extracting detections from the source image
+        vector<Detection> found;
+        context->detector.getDetections(img, found);
+        img.release();
+
+        // Only the match counts are kept, the detections are dropped once written
+        evaluator->add(db.getDetections()[i], found);
+        if(context->writer != NULL) context->writer->write(i, db.getFilenames()[i], found);
+    }
+}
+
 int mainSVMTest(const vector<string> &args, const map<string, string> &opts)
 {
     // Detection over multiple scales with non maxima suppression
@@ -231,52 +631,58 @@ int mainSVMTest(const vector<string> &args, const map<string, string> &opts)
         {
 
             LOG(INFO) << "Loading image database";
-            ImageDatabase db(dbFName, category);
+            AnnotationIndex *index = getAnnotationIndex(opts);
+            ImageDatabase db(dbFName, category, index, getVocPaths(opts));
             cout << db << endl;
 
             LOG(INFO) << "Loading SVM model and features extractor from file";
             SupportVectorMachine svm(svmModelFName);
+            PrincipalComponentAnalysis *projection = loadProjection(svmModelFName);
             FeatureExtractor *featExtractor = FeatureExtractor::create(FeatureExtractor::getDefaultParameters("hog"));
             //loadFromFile(svmModelFName, svm);
 
             LOG(INFO) << "Initializing object detector";
-            ObjectDetector obdet(svm);
+            ObjectDetector obdet(svm, getDetectorParameters(opts), projection, category);
 
-            vector<vector<Detection> > dets(db.getSize());
-
-            for(int i = 0; i < db.getSize(); i++) {
-                LOG(INFO) << "Processing image " << setw(4) << (i + 1) << " of " << db.getSize();
+            // Images are decoded ahead by the I/O threads
+            ImageSource images(db.getFilenames(), CV_LOAD_IMAGE_COLOR, getImageSourceParameters(opts));
 
-                string imgFName = db.getFilenames()[i];
-
-                // load image
-                Mat img = imread(imgFName,CV_LOAD_IMAGE_COLOR);
-
-                // Extracting detections from the source image
-                LOG(INFO) << " --> Extracting detections from the source image";
-                vector<Detection> found;
-                obdet.getDetections(img, found);
-                dets[i] = found;
+            DetectionWriter *writer = predsFName.size() ? new DetectionWriter(predsFName, db.getSize()) : NULL;
 
-                img.release();
-                
+            // Every detection thread matches its images against the ground truth with its own evaluator
+            int nWorkers = getDetectionThreads(opts);
+            DetectionContext context(db, obdet, images, writer);
+            double scoreResolution = DetectionEvaluator::DEFAULT_SCORE_RESOLUTION;
+            if(opts.count("-s") == 1) {
+                scoreResolution = atof(opts.at("-s").c_str());
+            }
+            vector<DetectionEvaluator> evaluators(nWorkers, DetectionEvaluator(scoreResolution));
+            boost::thread_group workers;
+            for(int w = 0; w < nWorkers; w++)
+                workers.create_thread(boost::bind(detectionWorker, &context, &evaluators[w]));
+            workers.join_all();
+
+            delete writer;
+            if(!context.error.empty()) {
+                throw std::runtime_error(context.error);
             }
-
-            ImageDatabase predsDb(dets, db.getFilenames());
 
             LOG(INFO) << "Computing Precision Recall Curve";
-            vector<float> labels, response;
-            int nGroundTruthDetections;
-            computeLabels(db.getDetections(), predsDb.getDetections(), labels, response, nGroundTruthDetections);
+            DetectionEvaluator evaluator(scoreResolution);
+            for(int w = 0; w < nWorkers; w++)
+                evaluator.merge(evaluators[w]);
 
-            LOG(INFO) << "Computing Precision Recall Curve";
-            PrecisionRecall pr(labels, response, nGroundTruthDetections);
+            LOG(INFO) << evaluator.getMatchedCount() << "/" << evaluator.getDetectionCount() << " detections matched "
+                      << evaluator.getGroundTruthCount() << " ground truth objects";
+
+            PrecisionRecall pr = evaluator.getPrecisionRecall();
             LOG(INFO) << "Average precision: " << pr.getAveragePrecision();
 
-            if(predsFName.size()) predsDb.save(predsFName.c_str());
             if(prFName.size()) pr.save(prFName.c_str());
 
             delete featExtractor;
+            delete projection;
+            delete index;
 
             return EXIT_SUCCESS;
         }
@@ -291,6 +697,195 @@ int mainSVMTest(const vector<string> &args, const map<string, string> &opts)
     }
 }
 
+// State shared by the detection threads of MULTI
+struct MultiDetectionContext
+{
+    MultiDetectionContext(const ObjectDetector &detector, ImageSource &images, vector<vector<vector<Detection> > > &results):
+        detector(detector), images(images), results(results), nextImage(0)
+    {
+    }
+
+    const ObjectDetector &detector;
+    ImageSource &images;
+    vector<vector<vector<Detection> > > &results;   // Detections of every image, one list per class
+
+    boost::mutex mutex;    // Guards images, nextImage and error
+    int nextImage;
+    string error;
+};
+
+void multiDetectionWorker(MultiDetectionContext *context)
+{
+    int nImages = context->results.size();
+
+    while(true) {
+        int i;
+        Mat img;
+        try {
+            boost::lock_guard<boost::mutex> lock(context->mutex);
+            if(!context->error.empty() || context->nextImage >= nImages) return;
+
+            i = context->nextImage++;
+            context->images.next(img);
+        } catch(std::exception &err) {
+            boost::lock_guard<boost::mutex> lock(context->mutex);
+            context->error = err.what();
+            return;
+        }
+
+        LOG(INFO) << "Processing image " << setw(4) << (i + 1) << " of " << nImages;
+
+        // Every class is scored on the same feature pyramid
+        context->detector.getDetections(img, context->results[i]);
+    }
+}
+
+// Loads the models given as <category>:<svm model> from args[first] on, along with their projections
+void loadCategoryModels(const vector<string> &args, int first, vector<string> &categories,
+                        vector<SupportVectorMachine*> &svms, vector<const PrincipalComponentAnalysis*> &projections)
+{
+    for(int i = first; i < args.size(); i++) {
+        size_t sep = args[i].find(':');
+        if(sep == string::npos || sep == 0) {
+            throw std::runtime_error("ERROR: Expected <category>:<svm model> instead of: " + args[i]);
+        }
+
+        string svmModelFName = args[i].substr(sep + 1);
+        if(!boost::filesystem::exists(svmModelFName)) {
+            throw std::runtime_error("ERROR: SVM Model file doesn't exist in: " + svmModelFName);
+        }
+
+        categories.push_back(args[i].substr(0, sep));
+        svms.push_back(new SupportVectorMachine(svmModelFName));
+        projections.push_back(loadProjection(svmModelFName));
+        LOG(INFO) << "Loaded model of class " << categories.back() << " from " << svmModelFName;
+    }
+}
+
+int mainMulti(const vector<string> &args, const map<string, string> &opts)
+{
+    if(args.size() < 5) {
+        throw std::runtime_error("ERROR: Incorrect number of arguments. Run command with flag -h for help.");
+    }
+
+    double t = (double)getTickCount();
+
+    string imageSetFName = args[2];
+    string resultsDir = args[3];
+
+    if(!boost::filesystem::exists(imageSetFName)) {
+        throw std::runtime_error("ERROR: Image set file doesn't exist in: " + imageSetFName);
+    }
+    if(!boost::filesystem::is_directory(resultsDir)) {
+        throw std::runtime_error("ERROR: Results directory doesn't exist in: " + resultsDir);
+    }
+
+    vector<string> categories;
+    vector<SupportVectorMachine*> svms;
+    vector<const PrincipalComponentAnalysis*> projections;
+    loadCategoryModels(args, 4, categories, svms, projections);
+
+    VocPaths paths = getVocPaths(opts);
+    ImageList list(imageSetFName);
+    vector<string> imageIds, filenames;
+    for(int i = 0; i < list.getSize(); i++) {
+        imageIds.push_back(list.getName(i));
+        filenames.push_back(paths.getImageFilename(imageIds.back()));
+    }
+
+    LOG(INFO) << "Initializing object detector with " << svms.size() << " classes";
+    ObjectDetector obdet(vector<const SupportVectorMachine*>(svms.begin(), svms.end()), getDetectorParameters(opts), projections, categories);
+
+    // Images are decoded ahead by the I/O threads
+    ImageSource images(filenames, CV_LOAD_IMAGE_COLOR, getImageSourceParameters(opts));
+
+    vector<vector<vector<Detection> > > results(filenames.size());
+    int nWorkers = getDetectionThreads(opts);
+    MultiDetectionContext context(obdet, images, results);
+    boost::thread_group workers;
+    for(int w = 0; w < nWorkers; w++)
+        workers.create_thread(boost::bind(multiDetectionWorker, &context));
+    workers.join_all();
+
+    if(!context.error.empty()) {
+        throw std::runtime_error(context.error);
+    }
+
+    // One results file per class in the format read by EVAL: <image id> <score> <xmin> <ymin> <xmax> <ymax>,
+    // with the 1-based inclusive pixel coordinates of the devkit annotations (as written by SYNTH)
+    for(int c = 0; c < categories.size(); c++) {
+        string resultsFName = (boost::filesystem::path(resultsDir) / (categories[c] + ".txt")).string();
+        ofstream f(resultsFName.c_str());
+        if(!f.is_open()) {
+            throw std::runtime_error("ERROR: Could not open file " + resultsFName + " for writing");
+        }
+
+        int nDets = 0;
+        for(int i = 0; i < results.size(); i++) {
+            const vector<Detection> &dets = results[i][c];
+            for(int j = 0; j < dets.size(); j++) {
+                // The last pixel of the box is r.x + r.width - 1 in 0-based coordinates
+                const Rect &r = dets[j].rect;
+                int xmin = r.x + 1, ymin = r.y + 1;
+                int xmax = r.x + r.width - 1 + 1, ymax = r.y + r.height - 1 + 1;
+                f << imageIds[i] << " " << dets[j].response << " " << xmin << " " << ymin << " "
+                  << xmax << " " << ymax << "\n";
+            }
+            nDets += dets.size();
+        }
+
+        LOG(INFO) << "Class " << categories[c] << ": " << nDets << " detections written to " << resultsFName;
+    }
+
+    for(int i = 0; i < svms.size(); i++) {
+        delete svms[i];
+        delete projections[i];
+    }
+
+    t = (double)getTickCount() - t;
+    LOG(INFO) << "Detection completed in " << t/getTickFrequency() << " seconds.";
+
+    return EXIT_SUCCESS;
+}
+
+int mainServe(const vector<string> &args, const map<string, string> &opts)
+{
+    if(args.size() < 3) {
+        throw std::runtime_error("ERROR: Incorrect number of arguments. Run command with flag -h for help.");
+    }
+
+    // The models are parsed and the detector built once for all the requests
+    vector<string> categories;
+    vector<SupportVectorMachine*> svms;
+    vector<const PrincipalComponentAnalysis*> projections;
+    loadCategoryModels(args, 2, categories, svms, projections);
+
+    LOG(INFO) << "Initializing object detector with " << svms.size() << " classes";
+    ObjectDetector obdet(vector<const SupportVectorMachine*>(svms.begin(), svms.end()), getDetectorParameters(opts), projections, categories);
+
+    int nWorkers = getDetectionThreads(opts);
+    LOG(INFO) << "Serving with " << nWorkers << " detection threads";
+    {
+        DetectionServer server(obdet, categories, nWorkers);
+        if(opts.count("-u") == 1) {
+            server.serveSocket(opts.at("-u"));
+        } else {
+            server.serveStream(STDIN_FILENO, STDOUT_FILENO);
+        }
+
+        DetectionServer::Stats stats = server.getStats();
+        LOG(INFO) << "Answered " << stats.requests << " requests (" << stats.errors << " errors), latency p50 "
+                  << stats.p50 << " ms, p99 " << stats.p99 << " ms, " << stats.throughput << " requests/s";
+    }
+
+    for(int i = 0; i < svms.size(); i++) {
+        delete svms[i];
+        delete projections[i];
+    }
+
+    return EXIT_SUCCESS;
+}
+
 int mainPCA(const vector<string> &args, const map<string, string> &opts)
 {
     if(args.size() < 4) {
@@ -316,26 +911,40 @@ int mainPCA(const vector<string> &args, const map<string, string> &opts)
 
     if(boost::filesystem::exists(dbFName))
     {
-        LOG(INFO) << "Creating the image database";
-        PascalImageDatabase db(dbFName.c_str(), category);
-        cout << db << endl;
+        LOG(INFO) << "Category: " << category;
 
-        FeatureExtractor *featExtractor = FeatureExtractor::create(featParams);
+        // The features are streamed through a feature store instead of being held in memory,
+        // a database is extracted into a temporary one next to the output
+        string featsFName = dbFName;
+        bool temporary = !FeatureStore::isFeatureStore(dbFName);
+        if(temporary) {
+            LOG(INFO) << "Creating the image database";
+            AnnotationIndex *index = getAnnotationIndex(opts);
+            PascalImageDatabase db(dbFName.c_str(), category, index, getVocPaths(opts));
+            cout << db << endl;
 
-        LOG(INFO) << "Category: " << category;
+            FeatureExtractor *featExtractor = FeatureExtractor::create(featParams);
 
-        LOG(INFO) << "Extracting HOG features";
-        FeatureCollection features;
-        (*featExtractor)(db, features);
+            LOG(INFO) << "Extracting HOG features to disk";
+            featsFName = pcaFName + ".feats";
+            FeatureStore::build(db, *featExtractor, category, featsFName, getImageSourceParameters(opts));
 
-        LOG(INFO) << "Performing PCA on the obtained HOG features";
-        int num_samples = features.size();
-        int num_features = features[0].size();
-        Mat data(num_features,num_samples,CV_32FC1,Scalar(0));
-        PrincipalComponentAnalysis pca;
-        pca.pre_process(features,data);
-        pca.compute(data,db);
-        pca.savePCAFile(pcaFName);
+            delete featExtractor;
+            delete index;
+        }
+
+        {
+            FeatureStore store(featsFName);
+
+            LOG(INFO) << "Performing PCA on the obtained HOG features";
+            PrincipalComponentAnalysis pca(true);
+            pca.add(store);
+            pca.compute(2);
+            LOG(INFO) << "Percentage of variability retained in first two dimensions: " << pca.getRetainedVariance()*100 << "%";
+            pca.savePCAFile(pcaFName, store);
+        }
+
+        if(temporary) boost::filesystem::remove(featsFName);
 
         t = (double)getTickCount() - t;
         LOG(INFO) << "PCA completed in " << t/getTickFrequency() << " seconds.";
@@ -348,6 +957,79 @@ int mainPCA(const vector<string> &args, const map<string, string> &opts)
     }
 }
 
+int mainCompress(const vector<string> &args, const map<string, string> &opts)
+{
+    if(args.size() != 4) {
+        throw std::runtime_error("ERROR: Incorrect number of arguments. Run command with flag -h for help.");
+    }
+
+    double t = (double)getTickCount();
+
+    string svmModelFName = args[2];
+    string compressedModelFName = args[3];
+
+    int nVectors;
+    if(opts.count("-k") == 1) {
+        nVectors = atoi(opts.at("-k").c_str());
+    } else {
+        throw std::runtime_error("ERROR: Number of vectors not specified. Run command with flag -h for help.");
+    }
+
+    if(!boost::filesystem::exists(svmModelFName)) {
+        throw std::runtime_error("ERROR: SVM Model file doesn't exist in: " + svmModelFName);
+    }
+
+    SupportVectorMachine svm(svmModelFName);
+    LOG(INFO) << "Compressing " << svm.getSupportVectorCount() << " support vectors into " << nVectors;
+    svm.compress(nVectors, compressedModelFName);
+    LOG(INFO) << "Compressed SVM Model saved in: " << compressedModelFName;
+
+    if(opts.count("-v") == 1) {
+        string dbFName = opts.at("-v");
+        string category;
+        if(opts.count("-c") == 1) {
+            category = opts.at("-c");
+        } else {
+            throw std::runtime_error("ERROR: Category not specified. Run command with flag -h for help.");
+        }
+
+        if(!boost::filesystem::exists(dbFName)) {
+            throw std::runtime_error("ERROR: Pascal cross validation database file doesn't exist in: " + dbFName);
+        }
+
+        SupportVectorMachine compressed(compressedModelFName);
+        FeatureExtractor *featExtractor = FeatureExtractor::create(FeatureExtractor::getDefaultParameters("hog"));
+
+        LOG(INFO) << "Creating the validation database and extracting features";
+        FeatureCollection features;
+        vector<float> labels;
+        vector<string> filenames;
+        extractDatabaseFeatures(dbFName, category, opts, *featExtractor, features, labels, filenames);
+
+        LOG(INFO) << "Scaling the feature vector";
+        FeatureCollection scaledFeatures;
+        featExtractor->scale(features,scaledFeatures);
+        FeatureCollection().swap(features);
+
+        LOG(INFO) << "Predicting with the original model";
+        PrecisionRecall prOriginal(labels, svm.predict(scaledFeatures));
+
+        LOG(INFO) << "Predicting with the compressed model";
+        PrecisionRecall prCompressed(labels, compressed.predict(scaledFeatures));
+
+        LOG(INFO) << "Average precision original: " << prOriginal.getAveragePrecision();
+        LOG(INFO) << "Average precision compressed: " << prCompressed.getAveragePrecision();
+        LOG(INFO) << "Average precision drop: " << prOriginal.getAveragePrecision() - prCompressed.getAveragePrecision();
+
+        delete featExtractor;
+    }
+
+    t = (double)getTickCount() - t;
+    LOG(INFO) << "Compression completed in " << t/getTickFrequency() << " seconds.";
+
+    return EXIT_SUCCESS;
+}
+
 int mainDEMO(const vector<string> &args, const map<string, string> &opts)
 {
     if(args.size() != 4) {
@@ -372,26 +1054,30 @@ int mainDEMO(const vector<string> &args, const map<string, string> &opts)
         {
 
             LOG(INFO) << "Loading image database";
-            ImageDatabase db(dbFName, category);
+            AnnotationIndex *index = getAnnotationIndex(opts);
+            ImageDatabase db(dbFName, category, index, getVocPaths(opts));
             cout << db << endl;
 
             LOG(INFO) << "Loading SVM model and features extractor from file";
             SupportVectorMachine svm(svmModelFName);
+            PrincipalComponentAnalysis *projection = loadProjection(svmModelFName);
             FeatureExtractor *featExtractor = FeatureExtractor::create(FeatureExtractor::getDefaultParameters("hog"));
             //loadFromFile(svmModelFName, svm);
 
             LOG(INFO) << "Initializing object detector";
-            ObjectDetector obdet(svm);
+            ObjectDetector obdet(svm, getDetectorParameters(opts), projection, category);
 
             vector<vector<Detection> > dets(db.getSize());
 
+            // Images are decoded ahead by the I/O threads
+            ImageSource images(db.getFilenames(), CV_LOAD_IMAGE_COLOR, getImageSourceParameters(opts));
+
             for(int i = 0; i < db.getSize(); i++) {
                 LOG(INFO) << "Processing image " << setw(4) << (i + 1) << " of " << db.getSize();
 
-                string imgFName = db.getFilenames()[i];
-
                 // load image
-                Mat img = imread(imgFName,CV_LOAD_IMAGE_COLOR);
+                Mat img;
+                images.next(img);
 
                 // Extracting detections from the source image
                 LOG(INFO) << " --> Extracting detections from the source image";
@@ -407,6 +1093,8 @@ int mainDEMO(const vector<string> &args, const map<string, string> &opts)
                 
             }
             delete featExtractor;
+            delete projection;
+            delete index;
             return EXIT_SUCCESS;
         }
         else
@@ -420,6 +1108,272 @@ int mainDEMO(const vector<string> &args, const map<string, string> &opts)
     }
 }
 
+int mainPack(const vector<string> &args, const map<string, string> &opts)
+{
+    if(args.size() != 4) {
+        throw std::runtime_error("ERROR: Incorrect number of arguments. Run command with flag -h for help.");
+    }
+
+    double t = (double)getTickCount();
+
+    string dbFName = args[2];
+    string storeFName = args[3];
+    string category;
+    if(opts.count("-c") == 1) {
+        category = opts.at("-c");
+    } else {
+        throw std::runtime_error("ERROR: Category not specified. Run command with flag -h for help.");
+    }
+
+    if(!boost::filesystem::exists(dbFName)) {
+        throw std::runtime_error("ERROR: Pascal database file doesn't exist in: " + dbFName);
+    }
+
+    LOG(INFO) << "Creating the image database";
+    AnnotationIndex *index = getAnnotationIndex(opts);
+    PascalImageDatabase db(dbFName.c_str(), category, index, getVocPaths(opts));
+    cout << db << endl;
+
+    LOG(INFO) << "Packing the samples";
+    SampleStore::build(db, category, storeFName, Size(64,128), getImageSourceParameters(opts));
+    LOG(INFO) << "Sample store saved in: " << storeFName;
+
+    delete index;
+
+    t = (double)getTickCount() - t;
+    LOG(INFO) << "Packing completed in " << t/getTickFrequency() << " seconds.";
+
+    return EXIT_SUCCESS;
+}
+
+int mainExtract(const vector<string> &args, const map<string, string> &opts)
+{
+    if(args.size() != 4) {
+        throw std::runtime_error("ERROR: Incorrect number of arguments. Run command with flag -h for help.");
+    }
+
+    double t = (double)getTickCount();
+
+    string dbFName = args[2];
+    string featsFName = args[3];
+    string category;
+    if(opts.count("-c") == 1) {
+        category = opts.at("-c");
+    } else {
+        throw std::runtime_error("ERROR: Category not specified. Run command with flag -h for help.");
+    }
+
+    if(!boost::filesystem::exists(dbFName)) {
+        throw std::runtime_error("ERROR: Pascal database file doesn't exist in: " + dbFName);
+    }
+
+    LOG(INFO) << "Creating feature extractor";
+    FeatureExtractor *featExtractor = FeatureExtractor::create(FeatureExtractor::getDefaultParameters("hog"));
+
+    LOG(INFO) << "Extracting features to disk";
+    if(SampleStore::isSampleStore(dbFName)) {
+        SampleStore store(dbFName);
+        if(!boost::iequals(store.getCategory(), category)) {
+            throw std::runtime_error("ERROR: Sample store " + dbFName + " was packed for category " + store.getCategory());
+        }
+        FeatureStore::build(store, *featExtractor, featsFName);
+    } else {
+        AnnotationIndex *index = getAnnotationIndex(opts);
+        PascalImageDatabase db(dbFName.c_str(), category, index, getVocPaths(opts));
+        cout << db << endl;
+
+        FeatureStore::build(db, *featExtractor, category, featsFName, getImageSourceParameters(opts));
+        delete index;
+    }
+    LOG(INFO) << "Feature store saved in: " << featsFName;
+
+    delete featExtractor;
+
+    t = (double)getTickCount() - t;
+    LOG(INFO) << "Extraction completed in " << t/getTickFrequency() << " seconds.";
+
+    return EXIT_SUCCESS;
+}
+
+// Started by CascadeTrainer for TRAIN -f, trains the problems read from descriptor 3 and answers on 4
+int mainCascadeWorker(const vector<string> &args, const map<string, string> &opts)
+{
+    if(args.size() < 3) {
+        throw std::runtime_error("ERROR: Incorrect number of arguments. Run command with flag -h for help.");
+    }
+
+    ParametersMap svmParams;
+    for(int i = 3; i < args.size(); i++) {
+        size_t eq = args[i].find('=');
+        if(eq == string::npos) {
+            throw std::runtime_error("ERROR: Expected <svm parameter>=<value> instead of " + args[i]);
+        }
+        svmParams.set(args[i].substr(0, eq), args[i].substr(eq + 1));
+    }
+
+    CascadeTrainer::runWorker(args[2], svmParams, 3, 4);
+    return EXIT_SUCCESS;
+}
+
+int mainEval(const vector<string> &args, const map<string, string> &opts)
+{
+    if(args.size() != 4) {
+        throw std::runtime_error("ERROR: Incorrect number of arguments. Run command with flag -h for help.");
+    }
+
+    double t = (double)getTickCount();
+
+    string imageSetFName = args[2];
+    string resultsDir = args[3];
+
+    if(!boost::filesystem::exists(imageSetFName)) {
+        throw std::runtime_error("ERROR: Image set file doesn't exist in: " + imageSetFName);
+    }
+    if(!boost::filesystem::is_directory(resultsDir)) {
+        throw std::runtime_error("ERROR: Results directory doesn't exist in: " + resultsDir);
+    }
+
+    LOG(INFO) << "Loading the ground truth of every class";
+    AnnotationIndex *index = getAnnotationIndex(opts);
+    VocEvaluator evaluator(imageSetFName, index, index == NULL ? getVocPaths(opts).getAnnotationsDir() : string());
+    LOG(INFO) << "Loaded " << evaluator.getImageCount() << " images";
+
+    // Results of a class are either in <class>.txt or in a devkit style file ending with _<class>.txt
+    vector<string> files;
+    for(boost::filesystem::directory_iterator it(resultsDir), end; it != end; ++it) {
+        files.push_back(it->path().string());
+    }
+    sort(files.begin(), files.end());
+
+    vector<int> categories;
+    vector<vector<VocDetection> > detections;
+    for(int c = 0; c < VocEvaluator::getCategoryCount(); c++) {
+        string name = VocEvaluator::getCategoryName(c);
+        for(int i = 0; i < files.size(); i++) {
+            string filename = boost::filesystem::path(files[i]).filename().string();
+            if(filename != name + ".txt" && !boost::ends_with(filename, "_" + name + ".txt")) continue;
+
+            categories.push_back(c);
+            detections.push_back(vector<VocDetection>());
+            int skipped = evaluator.loadDetections(files[i], detections.back());
+            LOG(INFO) << "Class " << name << ": " << detections.back().size() << " detections from " << files[i];
+            if(skipped > 0) {
+                LOG(WARNING) << skipped << " detections of images outside the image set skipped";
+            }
+            break;
+        }
+    }
+
+    if(categories.empty()) {
+        throw std::runtime_error("ERROR: No results file found in: " + resultsDir);
+    }
+
+    LOG(INFO) << "Evaluating " << categories.size() << " classes";
+    vector<VocClassResult> results;
+    evaluator.evaluate(categories, detections, results);
+    cout << results << endl;
+
+    if(opts.count("-o") == 1) {
+        ofstream f(opts.at("-o").c_str());
+        if(!f.is_open()) {
+            throw std::runtime_error("ERROR: Could not open file " + opts.at("-o") + " for writing");
+        }
+        f << results;
+    }
+
+    delete index;
+
+    t = (double)getTickCount() - t;
+    LOG(INFO) << "Evaluation completed in " << t/getTickFrequency() << " seconds.";
+
+    return EXIT_SUCCESS;
+}
+
+int mainIndex(const vector<string> &args, const map<string, string> &opts)
+{
+    if(args.size() != 4) {
+        throw std::runtime_error("ERROR: Incorrect number of arguments. Run command with flag -h for help.");
+    }
+
+    double t = (double)getTickCount();
+
+    string annotationsDir = args[2];
+    string indexFName = args[3];
+
+    LOG(INFO) << "Indexing the annotations in: " << annotationsDir;
+    AnnotationIndex::build(annotationsDir, indexFName);
+
+    t = (double)getTickCount() - t;
+    LOG(INFO) << "Indexing completed in " << t/getTickFrequency() << " seconds.";
+
+    return EXIT_SUCCESS;
+}
+
+int mainSynth(const vector<string> &args, const map<string, string> &opts)
+{
+    if(args.size() != 3) {
+        throw std::runtime_error("ERROR: Incorrect number of arguments. Run command with flag -h for help.");
+    }
+
+    double t = (double)getTickCount();
+
+    ParametersMap params = SyntheticDataset::getDefaultParameters();
+    if(opts.count("-n") == 1) {
+        params.set("synth_images", atoi(opts.at("-n").c_str()));
+    }
+    if(opts.count("-s") == 1) {
+        params.set("synth_seed", atoi(opts.at("-s").c_str()));
+    }
+
+    VocPaths paths(args[2]);
+    LOG(INFO) << "Generating a synthetic dataset in: " << paths.getRoot();
+    SyntheticDataset dataset(params);
+    dataset.generate(paths);
+
+    t = (double)getTickCount() - t;
+    LOG(INFO) << "Generation completed in " << t/getTickFrequency() << " seconds.";
+
+    return EXIT_SUCCESS;
+}
+
+int runMode(const vector<string> &args, const map<string, string> &opts)
+{
+    if (strcasecmp(args[1].c_str(), "TRAIN") == 0) {
+        return mainSVMTrain(args, opts);
+    } else if (strcasecmp(args[1].c_str(), "PATH") == 0) {
+        return mainPath(args, opts);
+    } else if (strcasecmp(args[1].c_str(), "VAL") == 0) {
+        return mainSVMVal(args, opts);
+    } else if (strcasecmp(args[1].c_str(), "TEST") == 0) {
+        return mainSVMTest(args, opts);
+    } else if (strcasecmp(args[1].c_str(), "MULTI") == 0) {
+        return mainMulti(args, opts);
+    } else if (strcasecmp(args[1].c_str(), "SERVE") == 0) {
+        return mainServe(args, opts);
+    } else if (strcasecmp(args[1].c_str(), "PCA") == 0) {
+        return mainPCA(args,opts);
+    } else if (strcasecmp(args[1].c_str(), "COMPRESS") == 0) {
+        return mainCompress(args,opts);
+    } else if (strcasecmp(args[1].c_str(), "DEMO") == 0) {
+        return mainDEMO(args,opts);
+    } else if (strcasecmp(args[1].c_str(), "PACK") == 0) {
+        return mainPack(args,opts);
+    } else if (strcasecmp(args[1].c_str(), "CASCADE_WORKER") == 0) {
+        return mainCascadeWorker(args, opts);
+    } else if (strcasecmp(args[1].c_str(), "EXTRACT") == 0) {
+        return mainExtract(args,opts);
+    } else if (strcasecmp(args[1].c_str(), "EVAL") == 0) {
+        return mainEval(args,opts);
+    } else if (strcasecmp(args[1].c_str(), "INDEX") == 0) {
+        return mainIndex(args,opts);
+    } else if (strcasecmp(args[1].c_str(), "SYNTH") == 0) {
+        return mainSynth(args,opts);
+    } else {
+        printUsage(args[0]);
+        return EXIT_FAILURE;
+    }
+}
+
 int main(int argc, char **argv)
 {
     FLAGS_logtostderr = true;
@@ -436,21 +1390,25 @@ int main(int argc, char **argv)
             printUsage(args[0]);
             return EXIT_FAILURE;
         }
-        if (strcasecmp(args[1].c_str(), "TRAIN") == 0) {
-            return mainSVMTrain(args, opts);
-        } else if (strcasecmp(args[1].c_str(), "VAL") == 0) {
-            return mainSVMVal(args, opts);
-        } else if (strcasecmp(args[1].c_str(), "TEST") == 0) {
-            return mainSVMTest(args, opts);
-        } else if (strcasecmp(args[1].c_str(), "PCA") == 0) {
-            return mainPCA(args,opts);
-        } else if (strcasecmp(args[1].c_str(), "DEMO") == 0) {
-            return mainDEMO(args,opts);
-        } else {
-            printUsage(args[0]);
-            return EXIT_FAILURE;
+
+        if(opts.count("-t") == 1) {
+            Trace::enable();
+        }
+
+        // The long loops count their items, a single thread logs them every second
+        Progress::startReporter();
+        int status = runMode(args, opts);
+        Progress::stopReporter();
+
+        // On stderr with the logs, stdout carries the results of some modes (the answers of SERVE)
+        if(Trace::isEnabled()) {
+            Trace::printSummary(cerr);
+            Progress::printSummary(cerr);
+            Trace::saveChromeTrace(opts.at("-t"));
         }
 
+        return status;
+
     } catch(std::exception& err) {
         LOG(ERROR) << err.what();
         LOG(ERROR) << "Quitting ...";
@@ -459,4 +1417,3 @@ int main(int argc, char **argv)
 
     return EXIT_SUCCESS;
 }
-
@@ -405,7 +405,7 @@ public:
 
 	void Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 		   double *alpha_, double Cp, double Cn, double eps,
-		   SolutionInfo* si, int shrinking);
+		   SolutionInfo* si, int shrinking, double *G_ = NULL);
 protected:
 	int active_size;
 	schar *y;
@@ -503,8 +503,10 @@ void Solver::reconstruct_gradient()
 
 void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 		   double *alpha_, double Cp, double Cn, double eps,
-		   SolutionInfo* si, int shrinking)
+		   SolutionInfo* si, int shrinking, double *G_)
 {
+	// G_, if given, is the gradient at alpha_ on input and the final
+	// gradient on output, and Q is left in its original order
 	this->l = l;
 	this->Q = &Q;
 	QD=Q.get_QD();
@@ -538,17 +540,20 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 		int i;
 		for(i=0;i<l;i++)
 		{
-			G[i] = p[i];
+			G[i] = G_ ? G_[i] : p[i];
 			G_bar[i] = 0;
 		}
 		for(i=0;i<l;i++)
 			if(!is_lower_bound(i))
 			{
+				if(G_ && !is_upper_bound(i))
+					continue;
 				const Qfloat *Q_i = Q.get_Q(i,l);
 				double alpha_i = alpha[i];
 				int j;
-				for(j=0;j<l;j++)
-					G[j] += alpha_i*Q_i[j];
+				if(!G_)
+					for(j=0;j<l;j++)
+						G[j] += alpha_i*Q_i[j];
 				if(is_upper_bound(i))
 					for(j=0;j<l;j++)
 						G_bar[j] += get_C(i) * Q_i[j];
@@ -767,6 +772,15 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 				swap_index(i,active_set[i]);
 				// or Q.swap_index(i,active_set[i]);
 	}*/
+	if(G_)
+	{
+		// a warm started Q is kept for the next solve
+		for(int i=0;i<l;i++)
+			while(active_set[i] != i)
+				swap_index(i,active_set[i]);
+		for(int i=0;i<l;i++)
+			G_[i] = G[i];
+	}
 
 	si->upper_bound_p = Cp;
 	si->upper_bound_n = Cn;
@@ -1472,6 +1486,104 @@ static void solve_c_svc(
 	delete[] y;
 }
 
+//
+// state kept between the solves of svm_train_warm, in the order of the
+// two class problem built by svm_train
+//
+struct svm_warm_start
+{
+	int l;
+	double Cp, Cn;		// box of the last solve, 0 before the first one
+	double *alpha;		// last solution (>= 0) and its gradient
+	double *G;
+	QMatrix *Q;		// kernel cache, it doesn't depend on C
+};
+
+//
+// solve_c_svc starting from the last solution kept in ws, which is
+// scaled to the new box when both bounds change by the same ratio and
+// clipped to it otherwise
+//
+static void solve_c_svc_warm(
+	const svm_problem *prob, const svm_parameter* param,
+	double *alpha, Solver::SolutionInfo* si, double Cp, double Cn,
+	svm_warm_start *ws)
+{
+	int l = prob->l;
+	double *minus_ones = new double[l];
+	schar *y = new schar[l];
+
+	int i;
+
+	for(i=0;i<l;i++)
+	{
+		minus_ones[i] = -1;
+		if(prob->y[i] > 0) y[i] = +1; else y[i] = -1;
+	}
+
+	if(ws->Q == NULL)
+		ws->Q = new SVC_Q(*prob,*param,y);
+
+	// scaling keeps y^T alpha = 0 and the bounded alphas at the bound,
+	// G = Q alpha - e follows without kernel evaluations
+	double *G = ws->G;
+	if(ws->Cp > 0 && Cp*ws->Cn == Cn*ws->Cp)
+	{
+		double r = Cp/ws->Cp;
+		for(i=0;i<l;i++)
+		{
+			ws->alpha[i] *= r;
+			G[i] = r*(G[i]+1)-1;
+		}
+	}
+
+	// clip alpha to the new box, then scale down the class with the
+	// larger sum so that y^T alpha = 0 holds again
+	bool clipped = false;
+	double sum_p = 0, sum_n = 0;
+	for(i=0;i<l;i++)
+	{
+		double C_i = y[i] > 0 ? Cp : Cn;
+		alpha[i] = min(ws->alpha[i],C_i);
+		if(alpha[i] != ws->alpha[i])
+			clipped = true;
+		if(y[i] > 0) sum_p += alpha[i]; else sum_n += alpha[i];
+	}
+	if(clipped && sum_p != sum_n)
+	{
+		double scale = sum_p > sum_n ? sum_n/sum_p : sum_p/sum_n;
+		schar larger = sum_p > sum_n ? +1 : -1;
+		for(i=0;i<l;i++)
+			if(y[i] == larger)
+				alpha[i] *= scale;
+	}
+
+	// only the changed alphas need their kernel column to update G
+	for(i=0;i<l;i++)
+		if(alpha[i] != ws->alpha[i])
+		{
+			const Qfloat *Q_i = ws->Q->get_Q(i,l);
+			double delta = alpha[i] - ws->alpha[i];
+			for(int j=0;j<l;j++)
+				G[j] += delta*Q_i[j];
+		}
+
+	Solver s;
+	s.Solve(l, *ws->Q, minus_ones, y,
+		alpha, Cp, Cn, param->eps, si, param->shrinking, G);
+
+	for(i=0;i<l;i++)
+	{
+		ws->alpha[i] = alpha[i];
+		alpha[i] *= y[i];
+	}
+	ws->Cp = Cp;
+	ws->Cn = Cn;
+
+	delete[] minus_ones;
+	delete[] y;
+}
+
 static void solve_nu_svc(
 	const svm_problem *prob, const svm_parameter *param,
 	double *alpha, Solver::SolutionInfo* si)
@@ -1646,14 +1758,17 @@ struct decision_function
 
 static decision_function svm_train_one(
 	const svm_problem *prob, const svm_parameter *param,
-	double Cp, double Cn)
+	double Cp, double Cn, svm_warm_start *ws = NULL)
 {
 	double *alpha = Malloc(double,prob->l);
 	Solver::SolutionInfo si;
 	switch(param->svm_type)
 	{
 		case C_SVC:
-			solve_c_svc(prob,param,alpha,&si,Cp,Cn);
+			if(ws)
+				solve_c_svc_warm(prob,param,alpha,&si,Cp,Cn,ws);
+			else
+				solve_c_svc(prob,param,alpha,&si,Cp,Cn);
 			break;
 		case NU_SVC:
 			solve_nu_svc(prob,param,alpha,&si);
@@ -2071,7 +2186,7 @@ static void svm_group_classes(const svm_problem *prob, int *nr_class_ret, int **
 //
 // Interface functions
 //
-svm_model* svm_train(const svm_problem *prob, const svm_parameter *param)
+static svm_model* svm_train_model(const svm_problem *prob, const svm_parameter *param, svm_warm_start *ws)
 {
 	svm_model *model = Malloc( svm_model,1);
 	model->param = *param;
@@ -2196,7 +2311,26 @@ svm_model* svm_train(const svm_problem *prob, const svm_parameter *param)
 				if(param->probability)
 					svm_binary_svc_probability(&sub_prob,param,weighted_C[i],weighted_C[j],probA[p],probB[p]);
 
-				f[p] = svm_train_one(&sub_prob,param,weighted_C[i],weighted_C[j]);
+				// the two class problem is the whole problem, in the same
+				// order every time it is trained
+				if(ws && nr_class == 2)
+				{
+					if(ws->l != l)
+					{
+						svm_warm_start_reset(ws);
+						ws->l = l;
+						ws->alpha = Malloc(double,l);
+						ws->G = Malloc(double,l);
+						for(k=0;k<l;k++)
+						{
+							ws->alpha[k] = 0;
+							ws->G[k] = -1;
+						}
+					}
+					f[p] = svm_train_one(&sub_prob,param,weighted_C[i],weighted_C[j],ws);
+				}
+				else
+					f[p] = svm_train_one(&sub_prob,param,weighted_C[i],weighted_C[j]);
 				for(k=0;k<ci;k++)
 					if(!nonzero[si+k] && fabs(f[p].alpha[k]) > 0)
 						nonzero[si+k] = true;
@@ -2317,6 +2451,49 @@ svm_model* svm_train(const svm_problem *prob, const svm_parameter *param)
 	return model;
 }
 
+svm_model* svm_train(const svm_problem *prob, const svm_parameter *param)
+{
+	return svm_train_model(prob,param,NULL);
+}
+
+svm_warm_start* svm_warm_start_create()
+{
+	svm_warm_start *ws = Malloc(svm_warm_start,1);
+	ws->l = 0;
+	ws->Cp = ws->Cn = 0;
+	ws->alpha = NULL;
+	ws->G = NULL;
+	ws->Q = NULL;
+	return ws;
+}
+
+void svm_warm_start_reset(svm_warm_start *ws)
+{
+	free(ws->alpha);
+	free(ws->G);
+	delete ws->Q;
+	ws->l = 0;
+	ws->Cp = ws->Cn = 0;
+	ws->alpha = NULL;
+	ws->G = NULL;
+	ws->Q = NULL;
+}
+
+void svm_warm_start_destroy(svm_warm_start **ws_ptr_ptr)
+{
+	if(ws_ptr_ptr != NULL && *ws_ptr_ptr != NULL)
+	{
+		svm_warm_start_reset(*ws_ptr_ptr);
+		free(*ws_ptr_ptr);
+		*ws_ptr_ptr = NULL;
+	}
+}
+
+svm_model* svm_train_warm(const svm_problem *prob, const svm_parameter *param, svm_warm_start *ws)
+{
+	return svm_train_model(prob,param,ws);
+}
+
 // Stratified cross validation
 void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, int nr_fold, double *target)
 {
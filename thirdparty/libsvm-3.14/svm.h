@@ -72,6 +72,15 @@ struct svm_model
 };
 
 struct svm_model *svm_train(const struct svm_problem *prob, const struct svm_parameter *param);
+
+/* warm start of two class C_SVC problems trained with several values of C: the solution, its
+   gradient and the kernel cache of a solve start the next one. The nodes of the problem and the
+   kernel parameters must not change in between, the cache points into the nodes. */
+struct svm_warm_start;
+struct svm_warm_start *svm_warm_start_create();
+void svm_warm_start_reset(struct svm_warm_start *ws);
+void svm_warm_start_destroy(struct svm_warm_start **ws_ptr_ptr);
+struct svm_model *svm_train_warm(const struct svm_problem *prob, const struct svm_parameter *param, struct svm_warm_start *ws);
 void svm_cross_validation(const struct svm_problem *prob, const struct svm_parameter *param, int nr_fold, double *target);
 
 int svm_save_model(const char *model_file_name, const struct svm_model *const model);